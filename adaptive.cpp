@@ -0,0 +1,195 @@
+#include "adaptive.h"
+
+/**
+ * @file
+ * @brief  Source for logic filters that reorder their arguments
+ */
+
+#include <iomanip>
+#include <limits>
+#include <ostream>
+
+#include "timing.h"
+
+namespace calo {
+
+/**
+ * @class adaptive_filter calclean/adaptive.h
+ * @brief Base class for logic filters that reorder their arguments.
+ *
+ * The order in which the arguments of @ref and_filter and @ref or_filter are
+ * given matters for speed: the second filter is only evaluated when the first
+ * doesn't decide the result. Putting a cheap filter that often decides first
+ * (such as @ref eb) saves calls to expensive ones (such as @ref coldeb).
+ *
+ * Adaptive filters accept any number of children and choose their order
+ * themselves. During a sampling window, all children are evaluated for every
+ * tower and their pass rate and cost (as measured by @ref ticks) are recorded.
+ * At the end of the window, children are sorted to minimize the expected cost
+ * of an evaluation. Sampling is repeated periodically so the order follows
+ * changes in the data.
+ *
+ * The result of the filter doesn't depend on the order of the children, only
+ * its speed does. Children must therefore not have side effects.
+ *
+ * The chosen order and the statistics can be logged with print().
+ *
+ * @warning Statistics are stored inside the filter, so the same filter must
+ *          not be used from several threads at the same time.
+ * @warning This class doesn't delete its children upon destruction.
+ * @ingroup logic
+ */
+
+/**
+ * @class adaptive_and_filter calclean/adaptive.h
+ * @brief A logical AND between any number of filters, reordered for speed.
+ *
+ * Children are evaluated in increasing order of @f$ c / (1 - p) @f$, where
+ * @f$ c @f$ is their mean cost and @f$ p @f$ their pass rate. This is the
+ * order that minimizes the expected cost when children are independent.
+ *
+ * @see adaptive_filter
+ * @ingroup logic
+ */
+
+/**
+ * @class adaptive_or_filter calclean/adaptive.h
+ * @brief A logical OR between any number of filters, reordered for speed.
+ *
+ * Children are evaluated in increasing order of @f$ c / p @f$, where
+ * @f$ c @f$ is their mean cost and @f$ p @f$ their pass rate.
+ *
+ * @see adaptive_filter
+ * @ingroup logic
+ */
+
+/// Constructs a filter without children
+/**
+ * Evaluation stops as soon as a child returns @c short_circuit_value.
+ */
+adaptive_filter::adaptive_filter(bool short_circuit_value) :
+  _short_circuit_value(short_circuit_value),
+  _sample_size(1000),
+  _period(1000000),
+  _calls(0),
+  _next_sample(0),
+  _sampling_left(1000),
+  _adaptations(0)
+{}
+
+/// Adds a child filter
+/**
+ * Sampling restarts with the next evaluation.
+ */
+void adaptive_filter::add(const filter *child)
+{
+  assert(child != nullptr);
+  _order.push_back(_children.size());
+  _children.push_back(child);
+  _stats.assign(_children.size(), statistics());
+  _sampling_left = _sample_size;
+}
+
+/// Changes how statistics are collected
+/**
+ * Statistics are collected during @c sample_size evaluations, after which the
+ * children are reordered. This is repeated every @c period evaluations. Both
+ * numbers count towers, not events. The default is to sample 1000 towers every
+ * million.
+ *
+ * Sampling restarts with the next evaluation.
+ */
+void adaptive_filter::set_sampling(unsigned long sample_size,
+                                   unsigned long period)
+{
+  assert(sample_size > 0);
+  assert(period >= sample_size);
+  _sample_size = sample_size;
+  _period = period;
+  _sampling_left = sample_size;
+  std::fill(_stats.begin(), _stats.end(), statistics());
+}
+
+// Evaluates all children, recording their statistics.
+bool adaptive_filter::sample(const tower_ref &tower) const
+{
+  const tower_ref t = tower; // ROOT's pseudo-C++ parser
+  bool decided = false;
+  for (unsigned i = 0; i < _children.size(); ++i) {
+    const filter &f = *_children[i];
+    const double start = ticks();
+    const bool value = CALO_FILTER_CALL(f, t);
+    _stats[i].ticks += ticks() - start;
+    ++_stats[i].calls;
+    _stats[i].passes += value;
+    decided = decided || value == _short_circuit_value;
+  }
+
+  if (--_sampling_left == 0) {
+    reorder();
+    // The next window starts _period calls after the first of this one
+    _next_sample = _calls + _period - _sample_size + 1;
+  }
+
+  return decided ? _short_circuit_value : !_short_circuit_value;
+}
+
+namespace {
+  // Orders indices by increasing key.
+  class key_less
+  {
+    const std::vector<double> *_keys;
+  public:
+    explicit key_less(const std::vector<double> *keys) : _keys(keys) {}
+
+    bool operator() (int lhs, int rhs) const
+    {
+      return (*_keys)[lhs] < (*_keys)[rhs];
+    }
+  };
+}
+
+// Sorts the children by increasing expected cost.
+void adaptive_filter::reorder() const
+{
+  // The key is the cost divided by the probability to stop after the child
+  std::vector<double> keys(_children.size());
+  for (unsigned i = 0; i < keys.size(); ++i) {
+    const double p_stop = _short_circuit_value ? _stats[i].pass_rate()
+                                               : 1 - _stats[i].pass_rate();
+    if (p_stop > 0) {
+      keys[i] = _stats[i].cost() / p_stop;
+    } else {
+      keys[i] = std::numeric_limits<double>::max();
+    }
+  }
+
+  for (unsigned i = 0; i < _order.size(); ++i) {
+    _order[i] = i;
+  }
+  std::stable_sort(_order.begin(), _order.end(), key_less(&keys));
+  ++_adaptations;
+}
+
+/// Prints the evaluation order and the statistics of every child
+/**
+ * @warning
+ * This function is there for logging purposes; the format of the output
+ * should not be relied on.
+ */
+void adaptive_filter::print(std::ostream &out) const
+{
+  out << (_short_circuit_value ? "adaptive_or_filter" : "adaptive_and_filter")
+      << ": " << _calls << " calls, " << _adaptations << " adaptations"
+      << std::endl;
+  out << std::setw(6) << "rank" << std::setw(7) << "child"
+      << std::setw(12) << "pass rate" << std::setw(12) << "cost" << std::endl;
+  for (unsigned i = 0; i < _order.size(); ++i) {
+    const statistics &s = _stats[_order[i]];
+    out << std::setw(6) << i << std::setw(7) << _order[i]
+        << std::setw(12) << s.pass_rate()
+        << std::setw(12) << s.cost() << std::endl;
+  }
+}
+
+} // namespace calo
@@ -0,0 +1,142 @@
+#ifndef CALCLEAN_ADAPTIVE
+#define CALCLEAN_ADAPTIVE
+
+/**
+ * @file
+ * @brief  Header for logic filters that reorder their arguments
+ */
+
+#include <algorithm>
+#include <iosfwd>
+
+#include "calofilter.h"
+
+namespace calo {
+
+class adaptive_filter : public filter
+{
+public:
+  /// Statistics collected for a child filter
+  struct statistics
+  {
+    /// Number of evaluations
+    unsigned long calls;
+
+    /// Number of evaluations that returned @c true
+    unsigned long passes;
+
+    /// Time spent in the filter, in units of @ref ticks
+    double ticks;
+
+    /// Constructs empty statistics
+    statistics() : calls(0), passes(0), ticks(0) {}
+
+    /// Returns the fraction of towers passing the filter
+    double pass_rate() const { return calls == 0 ? 0 : double(passes) / calls; }
+
+    /// Returns the mean cost of the filter
+    double cost() const { return calls == 0 ? 0 : ticks / calls; }
+  };
+
+private:
+  bool _short_circuit_value;
+
+  std::vector<const filter *> _children;
+  unsigned long _sample_size;
+  unsigned long _period;
+
+  mutable std::vector<int> _order;
+  mutable std::vector<statistics> _stats;
+  mutable unsigned long _calls;
+  mutable unsigned long _next_sample;
+  mutable unsigned long _sampling_left;
+  mutable unsigned long _adaptations;
+
+  bool sample(const tower_ref &tower) const;
+  void reorder() const;
+
+protected:
+  explicit adaptive_filter(bool short_circuit_value);
+
+public:
+  void add(const filter *child);
+
+  void set_sampling(unsigned long sample_size, unsigned long period);
+
+  /// Returns the number of child filters
+  int size() const { return _children.size(); }
+
+  /// Returns the child filter at index @c i (in insertion order)
+  const filter *child(int i) const { return _children[i]; }
+
+  /// Returns the indices of the children in evaluation order
+  const std::vector<int> &order() const { return _order; }
+
+  /// Returns the statistics of the last sampling window for child @c i
+  const statistics &stats(int i) const { return _stats[i]; }
+
+  /// Returns how many times the evaluation order was recomputed
+  unsigned long adaptations() const { return _adaptations; }
+
+  inline bool operator() (const tower_ref &tower) const;
+
+  void print(std::ostream &out) const;
+};
+
+/// Returns the value of the filter for @c tower
+bool adaptive_filter::operator() (const tower_ref &tower) const
+{
+  ++_calls;
+  if (_sampling_left > 0) {
+    return sample(tower);
+  } else if (_calls == _next_sample) {
+    _sampling_left = _sample_size;
+    std::fill(_stats.begin(), _stats.end(), statistics());
+    return sample(tower);
+  }
+
+  const tower_ref t = tower; // ROOT's pseudo-C++ parser
+  for (unsigned i = 0; i < _order.size(); ++i) {
+    const filter &f = *_children[_order[i]];
+    if (CALO_FILTER_CALL(f, t) == _short_circuit_value) {
+      return _short_circuit_value;
+    }
+  }
+  return !_short_circuit_value;
+}
+
+class adaptive_and_filter : public adaptive_filter
+{
+public:
+  /// Creates a filter without children, which lets all towers pass
+  explicit adaptive_and_filter() : adaptive_filter(false) {}
+
+  /// Creates a filter that returns @c true when both @c lhs and @c rhs are
+  /// @c true
+  explicit adaptive_and_filter(const filter *lhs, const filter *rhs) :
+    adaptive_filter(false)
+  {
+    add(lhs);
+    add(rhs);
+  }
+};
+
+class adaptive_or_filter : public adaptive_filter
+{
+public:
+  /// Creates a filter without children, which rejects all towers
+  explicit adaptive_or_filter() : adaptive_filter(true) {}
+
+  /// Creates a filter that returns @c true when at least one of @c lhs and
+  /// @c rhs is @c true
+  explicit adaptive_or_filter(const filter *lhs, const filter *rhs) :
+    adaptive_filter(true)
+  {
+    add(lhs);
+    add(rhs);
+  }
+};
+
+} // namespace calo
+
+#endif // CALCLEAN_ADAPTIVE
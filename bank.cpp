@@ -0,0 +1,94 @@
+#include "bank.h"
+
+#include <algorithm>
+
+#include "trace.h"
+
+/**
+ * @file
+ * @brief  Source for filter banks
+ */
+
+namespace calo {
+
+/**
+ * @class filter_bank calclean/bank.h
+ * @brief Evaluates several filters in a single sweep over the towers.
+ *
+ * Analyses often run the nominal cleaning together with a number of systematic
+ * variations (different thresholds, additional hot cells, ...). Looping over
+ * the towers once per variation reads the same columns again and again. A
+ * @c filter_bank instead visits every tower once and evaluates all filters on
+ * it while its data is still in the cache. Quantities derived from the tower,
+ * such as its logical coordinates (@ref tower_ref::ieta), are computed once per
+ * event and shared by all filters.
+ *
+ * Results are returned as one @ref tower_mask per filter:
+ *
+ * ~~~~{.cpp}
+ * filter_bank bank;
+ * bank.add(&goodeb);
+ * bank.add(&tight_goodeb);
+ *
+ * std::vector<tower_mask> masks;
+ * for (unsigned long entry = 0; entry < count; ++entry) {
+ *   tset.getentry(entry);
+ *   bank.evaluate(tset, masks);
+ *   int nominal = masks[0].count();
+ *   int tight = masks[1].count();
+ *   // ...
+ * }
+ * ~~~~
+ *
+ * The bank doesn't own its filters.
+ */
+
+/// Evaluates all filters on the current event of @c set
+/**
+ * Upon return, @c masks contains one entry per filter, in the order they were
+ * added. The vector is resized if needed; reusing it across events avoids
+ * memory allocations.
+ */
+void filter_bank::evaluate(const towerset &set,
+                           std::vector<tower_mask> &masks) const
+{
+  const int nfilters = _filters.size();
+  const int size = set.size();
+  const trace::scope traced("filter_bank::evaluate", "filter", "towers", size);
+
+  if (masks.size() != (unsigned) nfilters) {
+    masks.resize(nfilters);
+  }
+  for (int f = 0; f < nfilters; ++f) {
+    masks[f].reset(size);
+  }
+
+  // Bits are accumulated one word at a time, for groups of filters whose bits
+  // fit in a buffer on the stack, then stored. The towers of a word stay in
+  // the cache while all groups are evaluated.
+  const int group = 64;
+  tower_mask::word_type bits[group];
+  for (int begin = 0; begin < size; begin += tower_mask::word_bits) {
+    const int end = std::min(size, begin + tower_mask::word_bits);
+    for (int first = 0; first < nfilters; first += group) {
+      const int count = std::min(group, nfilters - first);
+      std::fill(bits, bits + count, 0);
+      for (int i = begin; i < end; ++i) {
+        const tower_ref t = tower_ref(&set, i);
+        const tower_mask::word_type bit =
+          tower_mask::word_type(1) << (i - begin);
+        for (int f = 0; f < count; ++f) {
+          const filter &flt = *_filters[first + f];
+          if (CALO_FILTER_CALL(flt, t)) {
+            bits[f] |= bit;
+          }
+        }
+      }
+      for (int f = 0; f < count; ++f) {
+        masks[first + f].set_word(begin / tower_mask::word_bits, bits[f]);
+      }
+    }
+  }
+}
+
+} // namespace calo
@@ -0,0 +1,42 @@
+#ifndef CALCLEAN_BANK
+#define CALCLEAN_BANK
+
+/**
+ * @file
+ * @brief  Header for filter banks
+ */
+
+#include "calofilter.h"
+
+namespace calo {
+
+class filter_bank
+{
+  std::vector<const filter *> _filters;
+public:
+  /// Constructs an empty bank
+  explicit filter_bank() {}
+
+  /// Adds a filter to the bank and returns its index
+  /**
+   * The bank doesn't take ownership of the filter.
+   */
+  int add(const filter *f)
+  {
+    assert(f != nullptr);
+    _filters.push_back(f);
+    return _filters.size() - 1;
+  }
+
+  /// Returns the number of filters in the bank
+  int size() const { return _filters.size(); }
+
+  /// Returns the filter at index @c i
+  const filter *at(int i) const { return _filters[i]; }
+
+  void evaluate(const towerset &set, std::vector<tower_mask> &masks) const;
+};
+
+} // namespace calo
+
+#endif // CALCLEAN_BANK
@@ -0,0 +1,1322 @@
+/**
+ * @file
+ * @brief  Benchmarks for the framework
+ *
+ * Usage: <tt>calobench [-f file.root] [-n entries] [-s mean size]
+ *                  [-r repeats] [-b baseline.json] [-t tolerance]
+ *                  [-o baseline.json]</tt>
+ *
+ * By default, events are generated with @ref calo::synthetic_generator, so the
+ * benchmarks don't need any input file. With @c -f, events are read from the
+ * @c CaloTree in the given file instead.
+ *
+ * The process is pinned to the CPU it starts on, and the whole suite is run
+ * once without measurement to warm caches. It is then run @c -r times (once by
+ * default) and the median of each benchmark is reported.
+ *
+ * Results are printed one per line, in the format <tt>name value unit</tt>.
+ * Names and units are stable, so the output can be used to track performance
+ * across versions. For every benchmark @c x, the following lines are printed:
+ *
+ * Name                  | Meaning
+ * :---------------------|:-----------------------------------------------------
+ * <tt>x.events</tt>     | Events processed per second
+ * <tt>x.towers</tt>     | Towers processed per nanosecond
+ * <tt>x.bytes</tt>      | Bytes read per event (I/O and @c codec benchmarks),
+ *                       | or memory used per event (@c store benchmarks)
+ * <tt>x.calls</tt>      | Read calls per event (file benchmarks only)
+ * <tt>x.noise</tt>      | Half-width of the 95% confidence interval on the
+ *                       | median, relative to the median (with @c -r only)
+ *
+ * With @c -b, the medians of <tt>x.events</tt> are compared with those stored
+ * in a baseline file, and the program fails if any benchmark is slower than
+ * the baseline by more than @c -t percent (10 by default). To avoid failing
+ * because of noise, a benchmark only counts as a regression when the whole
+ * confidence interval is below the threshold; when only the median is, it is
+ * reported as noisy. @c -o writes the medians to a new baseline file.
+ *
+ * Baseline files are flat JSON objects mapping <tt>x.events</tt> names to
+ * numbers. Members whose value is a string are ignored and can be used as
+ * comments.
+ *
+ * @c loop.fork4 is reported but neither written to nor compared with
+ * baselines: with the default @c -n, it mostly measures the cost of forking
+ * and opening the file, and its speed depends on the number of CPUs of the
+ * machine.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <unistd.h>
+#include <TDirectory.h>
+#include <TFile.h>
+#include <TH1F.h>
+#include <TTree.h>
+
+#include "calofilter.h"
+#include "bank.h"
+#include "cluster.h"
+#include "codec.h"
+#include "conditions.h"
+#include "eb.h"
+#include "eventfilter.h"
+#include "expr.h"
+#include "gap.h"
+#include "histogram.h"
+#include "logic.h"
+#include "loop.h"
+#include "store.h"
+#include "summary.h"
+#include "synth.h"
+#include "timing.h"
+
+#ifdef __linux__
+# include <sched.h>
+#endif
+
+namespace {
+
+// The data used by the benchmarks
+struct context
+{
+  // Events in memory
+  std::vector<std::vector<calo::tower> > events;
+
+  // Total number of towers in events
+  unsigned long towers;
+
+  // The same events, stored in a tree
+  calo::towerset *tree_set;
+
+  // A file with the same events
+  std::string file;
+};
+
+// The result of a benchmark
+struct measurement
+{
+  double seconds;
+  unsigned long events;
+  unsigned long towers;
+  double bytes;
+  double calls;
+  bool gated; // Written to and compared with baselines
+
+  measurement() :
+    seconds(0), events(0), towers(0), bytes(0), calls(0), gated(true) {}
+};
+
+// Measurements of every benchmark, by name
+std::map<std::string, std::vector<measurement> > results;
+
+// Benchmark names, in the order they were first run
+std::vector<std::string> names;
+
+// Records a measurement
+void record(const std::string &name, const measurement &m)
+{
+  std::vector<measurement> &runs = results[name];
+  if (runs.empty()) {
+    names.push_back(name);
+  }
+  runs.push_back(m);
+}
+
+// The median of a set of values and a 95% confidence interval on it
+struct statistics
+{
+  double median;
+  double low;
+  double high;
+
+  // Relative half-width of the interval
+  double noise() const { return (high - low) / (2 * median); }
+};
+
+// Computes the median of values and its confidence interval. The interval is
+// given by order statistics, using the normal approximation of the binomial
+// distribution to find the ranks n/2 - 0.98 sqrt(n) and 1 + n/2 + 0.98 sqrt(n)
+// (counting from 1); it doesn't assume anything about the distribution of the
+// values. For 9 runs, the interval goes from the 2nd to the 8th value.
+statistics summarize(std::vector<double> values)
+{
+  std::sort(values.begin(), values.end());
+  const int n = values.size();
+
+  statistics s;
+  s.median = n % 2 == 1 ? values[n / 2]
+                        : (values[n / 2 - 1] + values[n / 2]) / 2;
+
+  const double half_width = 0.98 * std::sqrt(double(n)); // 1.96 / 2 sqrt(n)
+  const int low = int(std::floor(n / 2. - half_width + 0.5)) - 1;
+  const int high = int(std::floor(n / 2. + 1 + half_width + 0.5)) - 1;
+  s.low = values[std::max(0, low)];
+  s.high = values[std::min(n - 1, high)];
+  return s;
+}
+
+// Returns the throughput of every run of a benchmark
+statistics throughput(const std::vector<measurement> &runs)
+{
+  std::vector<double> values;
+  for (unsigned i = 0; i < runs.size(); ++i) {
+    values.push_back(runs[i].events / runs[i].seconds);
+  }
+  return summarize(values);
+}
+
+// Prints a result in the format "name value unit"
+void report(const std::string &name, double value, const char *unit)
+{
+  std::cout << std::left << std::setw(40) << name << " "
+            << std::setprecision(6) << value << " " << unit << std::endl;
+}
+
+// Prints the results of all benchmarks
+void report()
+{
+  for (unsigned i = 0; i < names.size(); ++i) {
+    const std::vector<measurement> &runs = results[names[i]];
+    const measurement &m = runs.front();
+    const statistics s = throughput(runs);
+
+    report(names[i] + ".events", s.median, "events/s");
+    report(names[i] + ".towers", 1e-9 * s.median * m.towers / m.events,
+           "towers/ns");
+    if (m.bytes > 0) {
+      report(names[i] + ".bytes", m.bytes / m.events, "bytes/event");
+    }
+    if (m.calls > 0) {
+      report(names[i] + ".calls", m.calls / m.events, "reads/event");
+    }
+    if (runs.size() > 1) {
+      report(names[i] + ".noise", 100 * s.noise(), "%");
+    }
+  }
+}
+
+// Reads a baseline file. Returns false on error.
+bool read_baseline(const char *path, std::map<std::string, double> &baseline)
+{
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::ostringstream buffer;
+  buffer << in.rdbuf();
+  const std::string text = buffer.str();
+
+  // Just enough JSON to read flat objects: "name": value pairs
+  std::string::size_type pos = text.find('{');
+  while (pos != std::string::npos) {
+    const std::string::size_type begin = text.find('"', pos + 1);
+    if (begin == std::string::npos) {
+      break;
+    }
+    const std::string::size_type end = text.find('"', begin + 1);
+    pos = text.find_first_not_of(" \t\r\n", end + 1);
+    if (end == std::string::npos || pos == std::string::npos
+        || text[pos] != ':') {
+      return false;
+    }
+    pos = text.find_first_not_of(" \t\r\n", pos + 1);
+    if (pos == std::string::npos) {
+      return false;
+    } else if (text[pos] == '"') {
+      pos = text.find('"', pos + 1); // A comment
+      continue;
+    }
+
+    const char *number = text.c_str() + pos;
+    char *number_end;
+    const double value = std::strtod(number, &number_end);
+    if (number_end == number) {
+      return false;
+    }
+    baseline[text.substr(begin + 1, end - begin - 1)] = value;
+    pos += number_end - number;
+  }
+  return true;
+}
+
+// Writes the medians to a baseline file. Returns false on error.
+bool write_baseline(const char *path, unsigned long entries, int repeats)
+{
+  std::ofstream out(path);
+  out << "{\n  \"_comment\": \"calobench -n " << entries << " -r " << repeats
+      << "; regenerate with make perfbaseline\"";
+  for (unsigned i = 0; i < names.size(); ++i) {
+    if (!results[names[i]].front().gated) {
+      continue;
+    }
+    out << ",\n  \"" << names[i] << ".events\": "
+        << std::setprecision(6) << throughput(results[names[i]]).median;
+  }
+  out << "\n}\n";
+  return bool(out);
+}
+
+// Compares the medians with a baseline. Returns the number of regressions.
+int compare(const std::map<std::string, double> &baseline, double tolerance)
+{
+  int regressions = 0;
+  std::cout << std::endl;
+  for (unsigned i = 0; i < names.size(); ++i) {
+    const std::string name = names[i] + ".events";
+    std::cout << "perfcheck " << std::left << std::setw(30) << names[i];
+    if (!results[names[i]].front().gated) {
+      std::cout << " not gated" << std::endl;
+      continue;
+    }
+
+    const std::map<std::string, double>::const_iterator it =
+      baseline.find(name);
+    if (it == baseline.end()) {
+      std::cout << " not in baseline" << std::endl;
+      continue;
+    }
+
+    const statistics s = throughput(results[names[i]]);
+    const double threshold = it->second * (1 - tolerance / 100);
+    std::cout << std::right << std::showpos << std::fixed
+              << std::setprecision(1) << std::setw(8)
+              << 100 * (s.median / it->second - 1) << "% +-"
+              << std::noshowpos << std::setw(5) << 100 * s.noise() << "% ";
+    std::cout.unsetf(std::ios::floatfield);
+    if (s.high < threshold) {
+      std::cout << "REGRESSION" << std::endl;
+      ++regressions;
+    } else if (s.median < threshold) {
+      std::cout << "noisy" << std::endl;
+    } else {
+      std::cout << "ok" << std::endl;
+    }
+  }
+  for (std::map<std::string, double>::const_iterator it = baseline.begin();
+       it != baseline.end(); ++it) {
+    const std::string name = it->first.substr(0, it->first.rfind('.'));
+    if (results.find(name) == results.end()) {
+      std::cout << "perfcheck " << std::left << std::setw(30) << name
+                << " not run" << std::endl;
+    }
+  }
+  return regressions;
+}
+
+#ifdef __linux__
+// The CPUs the process could run on before pin(), and the one it chose
+cpu_set_t all_cpus;
+cpu_set_t pinned_cpu;
+#endif
+
+// Keeps the process on the CPU it's running on, so that it isn't moved while
+// measuring
+void pin()
+{
+#ifdef __linux__
+  const int cpu = sched_getcpu();
+  if (cpu >= 0 && sched_getaffinity(0, sizeof(all_cpus), &all_cpus) == 0) {
+    CPU_ZERO(&pinned_cpu);
+    CPU_SET(cpu, &pinned_cpu);
+    if (sched_setaffinity(0, sizeof(pinned_cpu), &pinned_cpu) == 0) {
+      std::cerr << "calobench: pinned to CPU " << cpu << std::endl;
+      return;
+    }
+    CPU_ZERO(&pinned_cpu);
+  }
+#endif
+  std::cerr << "calobench: could not pin to a CPU" << std::endl;
+}
+
+// Lets the process and the processes it forks run on all the CPUs it could
+// use before pin(), or pins it again
+void set_pinned(bool pinned)
+{
+#ifdef __linux__
+  if (CPU_COUNT(&pinned_cpu) > 0) {
+    sched_setaffinity(0, sizeof(cpu_set_t), pinned ? &pinned_cpu : &all_cpus);
+  }
+#else
+  (void) pinned;
+#endif
+}
+
+// Counts towers passing a filter in every event
+measurement bench_filter(context &ctx, const calo::filter *f, long &checksum)
+{
+  measurement m;
+  calo::towerset set(ctx.events.front());
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    set.assign(ctx.events[e]);
+
+    const double start = calo::seconds();
+    const calo::towerset::iterator end = set.end();
+    for (calo::towerset::iterator it = set.begin(f); it != end; ++it) {
+      ++checksum;
+    }
+    m.seconds += calo::seconds() - start;
+  }
+  m.events = ctx.events.size();
+  m.towers = ctx.towers;
+  return m;
+}
+
+// Reads all events from the tree
+void bench_getentry(context &ctx)
+{
+  measurement m;
+  calo::towerset &set = *ctx.tree_set;
+  const unsigned long entries = ctx.events.size();
+
+  const double start = calo::seconds();
+  for (unsigned long entry = 0; entry < entries; ++entry) {
+    set.getentry(entry);
+    m.towers += set.size();
+  }
+  m.seconds = calo::seconds() - start;
+
+  // CaloSize and ten 4-byte columns
+  m.bytes = 4. * entries + 40. * m.towers;
+  m.events = entries;
+  record("io.getentry", m);
+}
+
+// Reads all events and sums the EB energy, and the hadronic energy in one
+// event out of ten, with all columns read and in lazy mode
+void bench_lazy(context &ctx)
+{
+  calo::towerset &set = *ctx.tree_set;
+  const unsigned long entries = ctx.events.size();
+  double sums[2] = { 0, 0 };
+  for (int lazy = 0; lazy < 2; ++lazy) {
+    set.set_lazy(lazy);
+
+    measurement m;
+    const double start = calo::seconds();
+    for (unsigned long entry = 0; entry < entries; ++entry) {
+      set.getentry(entry);
+      const calo::towerset::iterator end = set.end();
+      for (calo::towerset::iterator it = set.begin(); it != end; ++it) {
+        if (it->iseb()) {
+          sums[lazy] += it->emenergy();
+        }
+        if (entry % 10 == 0) {
+          sums[lazy] += it->hadenergy();
+        }
+      }
+      m.towers += set.size();
+    }
+    m.seconds = calo::seconds() - start;
+    m.events = entries;
+    record(lazy ? "io.lazy.sparse" : "io.eager.sparse", m);
+  }
+  set.set_lazy(false);
+  if (sums[0] != sums[1]) {
+    std::cerr << "bench_lazy: results differ" << std::endl;
+    std::exit(1);
+  }
+}
+
+// A file that waits before every read, like files on a slow network file
+// system
+class slow_file : public TFile
+{
+  useconds_t _delay;
+public:
+  slow_file(const char *path, useconds_t delay) :
+    TFile(path, "READ"), _delay(delay) {}
+
+protected:
+  Int_t SysRead(Int_t fd, void *buffer, Int_t length)
+  {
+    usleep(_delay);
+    return TFile::SysRead(fd, buffer, length);
+  }
+};
+
+// Reads all events from a slow file, with and without the tree cache
+void bench_slow_file(context &ctx)
+{
+  if (ctx.file.empty()) {
+    return;
+  }
+  for (int cached = 0; cached < 2; ++cached) {
+    slow_file file(ctx.file.c_str(), 100);
+    calo::towerset set(&file);
+    if (!cached) {
+      set.set_cache_size(0);
+    }
+    for (unsigned long entry = 0; entry < ctx.events.size(); ++entry) {
+      set.getentry(entry);
+    }
+
+    const calo::io_statistics &io = set.io_stats();
+    measurement m;
+    m.seconds = io.seconds;
+    m.events = io.entries;
+    m.towers = ctx.towers;
+    m.bytes = io.bytes_read;
+    m.calls = io.read_calls;
+    record(cached ? "io.slow.cache" : "io.slow.nocache", m);
+  }
+}
+
+// Counts goodeb towers, for bench_loop
+class goodeb_counter : public calo::event_task
+{
+public:
+  int towers;
+
+  void process(const calo::towerset &set, calo::loop_output &out)
+  {
+    const calo::towerset::iterator end = set.end();
+    for (calo::towerset::iterator it = set.begin(&calo::goodeb);
+         it != end; ++it) {
+      out.count(towers);
+    }
+  }
+};
+
+// Counts goodeb towers in the file with one and four worker processes. The
+// workers may run on all CPUs; the result isn't gated, see the file comment.
+void bench_loop(context &ctx)
+{
+  if (ctx.file.empty()) {
+    return;
+  }
+  long counts[2];
+  for (int parallel = 0; parallel < 2; ++parallel) {
+    calo::event_loop loop(ctx.file, parallel ? 4 : 1);
+    goodeb_counter task;
+    task.towers = loop.add_counter();
+
+    measurement m;
+    set_pinned(!parallel);
+    const double start = calo::seconds();
+    loop.run(task);
+    m.seconds = calo::seconds() - start;
+    set_pinned(true);
+    m.events = loop.processed();
+    m.towers = ctx.towers;
+    m.gated = !parallel;
+    counts[parallel] = loop.counter(task.towers);
+    record(parallel ? "loop.fork4" : "loop.serial", m);
+  }
+  if (counts[0] != counts[1]) {
+    std::cerr << "bench_loop: results differ" << std::endl;
+    std::exit(1);
+  }
+}
+
+// Iterates over all towers without filter, then with the built-in filters
+void bench_filters(context &ctx)
+{
+  long checksum = 0;
+  record("iterate.all", bench_filter(ctx, nullptr, checksum));
+  record("filter.eb", bench_filter(ctx, &calo::eb, checksum));
+  record("filter.coldeb", bench_filter(ctx, &calo::coldeb, checksum));
+  record("filter.goodeb", bench_filter(ctx, &calo::goodeb, checksum));
+  record("filter.hoteb", bench_filter(ctx, &calo::hoteb, checksum));
+  if (checksum < 0) {
+    std::cerr << "bench_filters: overflow" << std::endl;
+  }
+}
+
+// Runs goodeb with run-dependent conditions, changing run every 100 events
+void bench_conditions(context &ctx)
+{
+  calo::conditions_store store;
+  store.add(calo::iov(1, 4), calo::eb_conditions());
+  store.add(calo::iov(5, UINT_MAX), calo::eb_conditions());
+  const calo::iov_eb_filter good(&store, calo::iov_eb_filter::good);
+
+  measurement m;
+  long checksum = 0;
+  calo::towerset set(ctx.events.front());
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    set.assign(ctx.events[e]);
+    set.set_run(1 + e / 100);
+
+    const double start = calo::seconds();
+    const calo::towerset::iterator end = set.end();
+    for (calo::towerset::iterator it = set.begin(&good); it != end; ++it) {
+      ++checksum;
+    }
+    m.seconds += calo::seconds() - start;
+  }
+  if (checksum < 0) {
+    std::cerr << "bench_conditions: overflow" << std::endl;
+  }
+  m.events = ctx.events.size();
+  m.towers = ctx.towers;
+  record("conditions.goodeb", m);
+}
+
+// Selects quiet events, with few good EB towers and little energy in them, or
+// small events, with ad-hoc loops and with an event filter
+void bench_event_filter(context &ctx)
+{
+  const calo::count_event_filter few_good(&calo::goodeb, 0, 2);
+  const calo::sum_event_filter low_eb(&calo::event_summary::eb, 0, 5,
+                                      &calo::goodeb);
+  const calo::count_event_filter small(nullptr, 0, 49);
+  const calo::and_event_filter quiet(&few_good, &low_eb);
+  const calo::or_event_filter selection(&quiet, &small);
+
+  measurement loops, filtered;
+  unsigned long selected_loops = 0, selected_filter = 0;
+  calo::towerset set(ctx.events.front());
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    set.assign(ctx.events[e]);
+
+    // One loop per cut, as usually written by hand
+    double start = calo::seconds();
+    int good = 0;
+    const calo::towerset::iterator end = set.end();
+    for (calo::towerset::iterator it = set.begin(&calo::goodeb);
+         it != end; ++it) {
+      ++good;
+    }
+    bool pass = set.size() < 50;
+    if (!pass && good <= 2) {
+      double eb = 0;
+      for (calo::towerset::iterator it = set.begin(&calo::goodeb);
+           it != end; ++it) {
+        eb += it->emenergy();
+      }
+      pass = eb <= 5;
+    }
+    selected_loops += pass;
+    loops.seconds += calo::seconds() - start;
+
+    start = calo::seconds();
+    selected_filter += selection.accept(set);
+    filtered.seconds += calo::seconds() - start;
+  }
+  if (selected_loops != selected_filter) {
+    std::cerr << "bench_event_filter: results differ" << std::endl;
+    std::exit(1);
+  }
+
+  loops.events = filtered.events = ctx.events.size();
+  loops.towers = filtered.towers = ctx.towers;
+  record("event_filter.loops", loops);
+  record("event_filter.composite", filtered);
+}
+
+// Measures the logic combinators on top of two built-in filters
+void bench_logic(context &ctx)
+{
+  const calo::and_filter f_and(&calo::eb, &calo::coldeb);
+  const calo::or_filter f_or(&calo::eb, &calo::coldeb);
+  const calo::not_filter f_not(&calo::coldeb);
+
+  long checksum = 0;
+  record("logic.and", bench_filter(ctx, &f_and, checksum));
+  record("logic.or", bench_filter(ctx, &f_or, checksum));
+  record("logic.not", bench_filter(ctx, &f_not, checksum));
+}
+
+// Sums the energy of goodeb towers through iterators, spans and indices
+void bench_selection(context &ctx)
+{
+  measurement iterated, spans, indices;
+  double sum_iterated = 0, sum_spans = 0, sum_indices = 0;
+  calo::tower_selection selection;
+  calo::towerset set(ctx.events.front());
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    set.assign(ctx.events[e]);
+
+    double start = calo::seconds();
+    float sum = 0;
+    const calo::towerset::iterator end = set.end();
+    for (calo::towerset::iterator it = set.begin(&calo::goodeb);
+         it != end; ++it) {
+      sum += it->emenergy();
+    }
+    iterated.seconds += calo::seconds() - start;
+    sum_iterated += sum;
+
+    set.assign(ctx.events[e]); // Drop cached quantities
+    start = calo::seconds();
+    set.select(&calo::goodeb, selection);
+    const calo::tower_columns &c = selection.columns();
+    sum = 0;
+    for (unsigned s = 0; s < selection.spans().size(); ++s) {
+      const calo::tower_span &span = selection.spans()[s];
+      for (int i = span.begin; i < span.end(); ++i) {
+        sum += c.emenergy[i];
+      }
+    }
+    spans.seconds += calo::seconds() - start;
+    sum_spans += sum;
+
+    set.assign(ctx.events[e]);
+    start = calo::seconds();
+    set.select(&calo::goodeb, selection);
+    sum = 0;
+    const int size = selection.size();
+    const int *index = size > 0 ? &selection.indices()[0] : nullptr;
+    for (int i = 0; i < size; ++i) {
+      sum += selection.columns().emenergy[index[i]];
+    }
+    indices.seconds += calo::seconds() - start;
+    sum_indices += sum;
+  }
+  if (sum_iterated != sum_spans || sum_iterated != sum_indices) {
+    std::cerr << "bench_selection: results differ" << std::endl;
+    std::exit(1);
+  }
+
+  iterated.events = spans.events = indices.events = ctx.events.size();
+  iterated.towers = spans.towers = indices.towers = ctx.towers;
+  record("select.iterator", iterated);
+  record("select.spans", spans);
+  record("select.indices", indices);
+}
+
+// Returns true if two sums agree within rounding errors
+bool same_sum(double a, double b)
+{
+  return std::fabs(a - b) <= 1e-6 * (1 + std::fabs(a));
+}
+
+// Computes event sums over all towers with tower_ref and event_summary
+void bench_summary(context &ctx)
+{
+  measurement iterated, fast, deterministic;
+  calo::event_summary total_iterated, total_fast, total_deterministic;
+  calo::towerset set(ctx.events.front());
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    set.assign(ctx.events[e]);
+
+    // The same sums as event_summary, tower by tower
+    double start = calo::seconds();
+    calo::event_summary sums;
+    const calo::towerset::iterator end = set.end();
+    for (calo::towerset::iterator it = set.begin(); it != end; ++it) {
+      ++sums.towers;
+      sums.emenergy += it->emenergy();
+      sums.hadenergy += it->hadenergy();
+      sums.totalenergy += it->totalenergy();
+      sums.et += it->totalenergy() / std::cosh(it->eta());
+      if (it->ebcount() > 0) {
+        sums.eb += it->emenergy();
+      } else if (it->eecount() > 0) {
+        sums.ee += it->emenergy();
+      }
+      if (it->hbcount() > 0) {
+        sums.hb += it->hadenergy();
+      } else if (it->hecount() > 0) {
+        sums.he += it->hadenergy();
+      }
+      if (it->hfcount() > 0) {
+        sums.hf += it->totalenergy();
+        if (it->eta() < 0) {
+          sums.hf_minus += it->totalenergy();
+        } else {
+          sums.hf_plus += it->totalenergy();
+        }
+      }
+    }
+    iterated.seconds += calo::seconds() - start;
+    total_iterated += sums;
+
+    set.assign(ctx.events[e]); // Drop cached quantities
+    start = calo::seconds();
+    const calo::event_summary summary(set);
+    fast.seconds += calo::seconds() - start;
+    total_fast += summary;
+
+    set.assign(ctx.events[e]);
+    start = calo::seconds();
+    const calo::event_summary exact(set, nullptr,
+                                    calo::event_summary::deterministic);
+    deterministic.seconds += calo::seconds() - start;
+    total_deterministic += exact;
+  }
+  const calo::event_summary &a = total_iterated;
+  const calo::event_summary &b = total_fast;
+  const calo::event_summary &c = total_deterministic;
+  if (a.towers != b.towers || a.towers != c.towers
+      || !same_sum(a.et, b.et) || !same_sum(a.et, c.et)
+      || !same_sum(a.ee, b.ee) || !same_sum(a.he, c.he)
+      || !same_sum(a.hf_minus, b.hf_minus)
+      || !same_sum(a.hf_plus, c.hf_plus)) {
+    std::cerr << "bench_summary: results differ" << std::endl;
+    std::exit(1);
+  }
+
+  iterated.events = fast.events = deterministic.events = ctx.events.size();
+  iterated.towers = fast.towers = deterministic.towers = ctx.towers;
+  record("summary.iterator", iterated);
+  record("summary.fast", fast);
+  record("summary.deterministic", deterministic);
+}
+
+// Histograms the energy of goodeb towers with TH1F::Fill and with histogram
+void bench_histogram(context &ctx)
+{
+  TH1F reference("bench_histogram", "", 100, 0, 20);
+  reference.SetDirectory(nullptr);
+  calo::histogram columns(calo::histogram_axis(100, 0, 20));
+
+  measurement filled, vectorized;
+  calo::towerset set(ctx.events.front());
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    set.assign(ctx.events[e]);
+    const calo::event_context event(set);
+    const calo::tower_mask &mask = event.mask(&calo::goodeb);
+    const float *energy = set.columns().emenergy;
+
+    double start = calo::seconds();
+    for (int i = 0; i < mask.size(); ++i) {
+      if (mask.test(i)) {
+        reference.Fill(energy[i]);
+      }
+    }
+    filled.seconds += calo::seconds() - start;
+
+    start = calo::seconds();
+    columns.fill(energy, mask);
+    vectorized.seconds += calo::seconds() - start;
+  }
+  for (int bin = 0; bin <= 101; ++bin) {
+    if (!same_sum(reference.GetBinContent(bin), columns.content(bin))) {
+      std::cerr << "bench_histogram: results differ" << std::endl;
+      std::exit(1);
+    }
+  }
+
+  filled.events = vectorized.events = ctx.events.size();
+  filled.towers = vectorized.towers = ctx.towers;
+  record("histogram.th1f", filled);
+  record("histogram.columns", vectorized);
+}
+
+// Orders towers by eta
+bool eta_less(const calo::tower &a, const calo::tower &b)
+{
+  return a.eta() < b.eta();
+}
+
+// Returns the lower edge of an eta bin, within the acceptance, like
+// gap_finder
+float bin_edge(int bin, float acceptance)
+{
+  const float eta = bin * 0.085;
+  return std::max(-acceptance, std::min(acceptance, eta));
+}
+
+// Finds the largest gap between the eta bins of towers sorted by eta
+float sorted_gap(const std::vector<calo::tower> &towers, float acceptance)
+{
+  float largest = 0;
+  float low = -acceptance; // Upper edge of the last occupied bin
+  for (unsigned i = 0; i < towers.size(); ++i) {
+    if (std::fabs(towers[i].eta()) > acceptance) {
+      continue;
+    }
+    const int bin = calo::eta_index(towers[i].eta());
+    largest = std::max(largest, bin_edge(bin, acceptance) - low);
+    low = bin_edge(bin + 1, acceptance);
+  }
+  return std::max(largest, acceptance - low);
+}
+
+// Finds the largest gap between goodeb towers by sorting them, then with
+// gap_finder
+void bench_gap(context &ctx)
+{
+  const calo::gap_finder finder;
+  measurement sorted, binned;
+  std::vector<calo::tower> passing;
+  calo::towerset set(ctx.events.front());
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    set.assign(ctx.events[e]);
+
+    double start = calo::seconds();
+    passing.clear();
+    const calo::towerset::iterator end = set.end();
+    for (calo::towerset::iterator it = set.begin(&calo::goodeb);
+         it != end; ++it) {
+      passing.push_back(calo::tower(*it));
+    }
+    std::sort(passing.begin(), passing.end(), eta_less);
+    const float largest = sorted_gap(passing, finder.acceptance());
+    sorted.seconds += calo::seconds() - start;
+
+    set.assign(ctx.events[e]); // Drop cached quantities
+    start = calo::seconds();
+    const calo::rapidity_gap gap = finder.find(set, &calo::goodeb);
+    binned.seconds += calo::seconds() - start;
+
+    if (!same_sum(largest, gap.size)) {
+      std::cerr << "bench_gap: results differ in event " << e << std::endl;
+      std::exit(1);
+    }
+  }
+
+  sorted.events = binned.events = ctx.events.size();
+  sorted.towers = binned.towers = ctx.towers;
+  record("gap.sort", sorted);
+  record("gap.bitmap", binned);
+}
+
+// Returns true if two towers are next to each other, including diagonally
+bool adjacent(const calo::tower_ref &a, const calo::tower_ref &b)
+{
+  const int phi_cells = calo::cluster_finder::phi_cells;
+  const int dphi = ((a.iphi() - b.iphi()) % phi_cells + phi_cells) % phi_cells;
+  return std::abs(a.ieta() - b.ieta()) <= 1
+      && (dphi <= 1 || dphi == phi_cells - 1);
+}
+
+// Orders towers by decreasing emenergy, then by index
+bool more_energetic(const calo::tower_ref &a, const calo::tower_ref &b)
+{
+  return a.emenergy() > b.emenergy()
+      || (a.emenergy() == b.emenergy() && a.index() < b.index());
+}
+
+// Builds clusters of goodeb towers with nested loops over the towers, the way
+// cluster_finder does with its default configuration. Stores the energy of
+// every cluster in energies.
+void nested_clusters(const calo::towerset &set,
+                     const calo::cluster_config &config,
+                     std::vector<double> &energies)
+{
+  // Keep the most energetic tower of every cell
+  std::vector<calo::tower_ref> candidates;
+  const calo::towerset::iterator end = set.end();
+  for (calo::towerset::iterator it = set.begin(&calo::goodeb);
+       it != end; ++it) {
+    const int row = it->ieta() + calo::cluster_finder::eta_cells / 2;
+    if (!(it->emenergy() >= config.tower_threshold)
+        || row < 0 || row >= calo::cluster_finder::eta_cells) {
+      continue;
+    }
+    unsigned c = 0;
+    while (c < candidates.size()
+           && !(candidates[c].ieta() == it->ieta()
+                && (candidates[c].iphi() - it->iphi())
+                     % calo::cluster_finder::phi_cells == 0)) {
+      ++c;
+    }
+    if (c == candidates.size()) {
+      candidates.push_back(*it);
+    } else if (candidates[c].emenergy() < it->emenergy()) {
+      candidates[c] = *it;
+    }
+  }
+  std::sort(candidates.begin(), candidates.end(), more_energetic);
+
+  // Grow a cluster from every seed that isn't part of a previous one
+  energies.clear();
+  std::vector<bool> taken(candidates.size(), false);
+  for (unsigned s = 0; s < candidates.size(); ++s) {
+    if (taken[s] || candidates[s].emenergy() < config.seed_threshold) {
+      continue;
+    }
+    std::vector<unsigned> members(1, s);
+    taken[s] = true;
+    double energy = 0;
+    for (unsigned m = 0; m < members.size(); ++m) {
+      energy += candidates[members[m]].emenergy();
+      for (unsigned c = 0; c < candidates.size(); ++c) {
+        if (!taken[c] && adjacent(candidates[members[m]], candidates[c])) {
+          taken[c] = true;
+          members.push_back(c);
+        }
+      }
+    }
+    energies.push_back(energy);
+  }
+}
+
+// Builds clusters with nested loops, then with cluster_finder
+void bench_cluster(context &ctx)
+{
+  const calo::cluster_config config;
+  calo::cluster_finder finder(config);
+  measurement nested, grid;
+  std::vector<double> energies;
+  calo::towerset set(ctx.events.front());
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    set.assign(ctx.events[e]);
+
+    double start = calo::seconds();
+    nested_clusters(set, config, energies);
+    nested.seconds += calo::seconds() - start;
+
+    set.assign(ctx.events[e]); // Drop cached quantities
+    start = calo::seconds();
+    const std::vector<calo::tower_cluster> &clusters =
+      finder.find(set, &calo::goodeb);
+    grid.seconds += calo::seconds() - start;
+
+    bool same = clusters.size() == energies.size();
+    for (unsigned i = 0; same && i < clusters.size(); ++i) {
+      same = std::fabs(clusters[i].energy - energies[i])
+             <= 1e-5 * (1 + energies[i]);
+    }
+    if (!same) {
+      std::cerr << "bench_cluster: results differ in event " << e
+                << std::endl;
+      std::exit(1);
+    }
+  }
+
+  nested.events = grid.events = ctx.events.size();
+  nested.towers = grid.towers = ctx.towers;
+  record("cluster.nested", nested);
+  record("cluster.grid", grid);
+}
+
+// A systematic variation: goodeb with a shifted energy threshold
+class emenergy_filter : public calo::filter
+{
+  float _min;
+public:
+  explicit emenergy_filter(float min) : _min(min) {}
+
+  bool operator() (const calo::tower_ref &tower) const
+  {
+    return tower.emenergy() > _min;
+  }
+};
+
+// Runs every filter in its own loop, then all of them through a filter_bank
+void bench_bank(context &ctx, int nfilters)
+{
+  std::vector<emenergy_filter> cuts;
+  for (int i = 0; i < nfilters; ++i) {
+    cuts.push_back(emenergy_filter(0.05 * i));
+  }
+  std::vector<calo::and_filter> variations;
+  calo::filter_bank bank;
+  for (int i = 0; i < nfilters; ++i) {
+    variations.push_back(calo::and_filter(&calo::goodeb, &cuts[i]));
+  }
+  for (int i = 0; i < nfilters; ++i) {
+    bank.add(&variations[i]);
+  }
+
+  measurement separate, banked;
+  long checksum = 0;
+  std::vector<calo::tower_mask> masks;
+  calo::towerset set(ctx.events.front());
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    set.assign(ctx.events[e]);
+
+    double start = calo::seconds();
+    const calo::towerset::iterator end = set.end();
+    for (int i = 0; i < nfilters; ++i) {
+      for (calo::towerset::iterator it = set.begin(&variations[i]);
+           it != end; ++it) {
+        ++checksum;
+      }
+    }
+    separate.seconds += calo::seconds() - start;
+
+    set.assign(ctx.events[e]); // Drop cached quantities
+    start = calo::seconds();
+    bank.evaluate(set, masks);
+    banked.seconds += calo::seconds() - start;
+    for (int i = 0; i < nfilters; ++i) {
+      checksum -= masks[i].count();
+    }
+  }
+  if (checksum != 0) {
+    std::cerr << "bench_bank: results differ" << std::endl;
+    std::exit(1);
+  }
+
+  separate.events = banked.events = ctx.events.size();
+  separate.towers = banked.towers = ctx.towers;
+
+  std::ostringstream name;
+  name << "bank.n" << nfilters;
+  record(name.str() + ".separate", separate);
+  record(name.str() + ".bank", banked);
+}
+
+// The selection used to compare expressions with hand-written filters
+class handwritten_filter : public calo::filter
+{
+public:
+  bool operator() (const calo::tower_ref &tower) const
+  {
+    return calo::eb(tower) && !calo::coldeb(tower)
+        && tower.emenergy() / tower.ebcount() > 0.3
+        && std::abs(tower.eta()) < 1.2;
+  }
+};
+
+// Compares an expression_filter with the equivalent hand-written filter
+void bench_expression(context &ctx)
+{
+  const handwritten_filter handwritten;
+  const calo::expression_filter expression(
+    "eb && !coldeb && emenergy / ebcount > 0.3 && abs(eta) < 1.2");
+
+  long checksum = 0;
+  record("expression.handwritten",
+         bench_filter(ctx, &handwritten, checksum));
+  record("expression.iterator", bench_filter(ctx, &expression, checksum));
+
+  measurement selected;
+  calo::tower_mask mask;
+  calo::towerset set(ctx.events.front());
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    set.assign(ctx.events[e]);
+    const double start = calo::seconds();
+    expression.select(set, mask);
+    selected.seconds += calo::seconds() - start;
+    checksum -= 2 * mask.count();
+  }
+  selected.events = ctx.events.size();
+  selected.towers = ctx.towers;
+  if (checksum != 0) {
+    std::cerr << "bench_expression: results differ" << std::endl;
+    std::exit(1);
+  }
+  record("expression.select", selected);
+}
+
+// Loads events from an event_store, then scans it without event boundaries
+void bench_store(context &ctx, calo::event_store::precision precision,
+                 const std::string &name)
+{
+  calo::event_store store(precision);
+  store.read(*ctx.tree_set, 0, ctx.events.size());
+
+  measurement loaded;
+  long checksum = 0;
+  calo::towerset set(ctx.events.front());
+  double start = calo::seconds();
+  for (unsigned long e = 0; e < store.events(); ++e) {
+    store.get(e, set);
+    const calo::towerset::iterator end = set.end();
+    for (calo::towerset::iterator it = set.begin(&calo::eb); it != end; ++it) {
+      ++checksum;
+    }
+  }
+  loaded.seconds = calo::seconds() - start;
+  loaded.events = store.events();
+  loaded.towers = store.towers();
+  loaded.bytes = store.memory(); // Memory footprint
+
+  measurement scanned;
+  start = calo::seconds();
+  checksum -= store.count(&calo::eb);
+  scanned.seconds = calo::seconds() - start;
+  scanned.events = store.events();
+  scanned.towers = store.towers();
+
+  if (checksum != 0) {
+    std::cerr << "bench_store: results differ" << std::endl;
+    std::exit(1);
+  }
+  record(name + ".get", loaded);
+  record(name + ".scan", scanned);
+}
+
+// Decodes compact towers into columns, as done by event_store
+void bench_codec(context &ctx)
+{
+  // Encode all events, keeping only the columns that need decoding
+  std::vector<unsigned short> ids, energies;
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    for (unsigned i = 0; i < ctx.events[e].size(); ++i) {
+      const calo::compact_tower t(ctx.events[e][i]);
+      ids.push_back(t.id);
+      energies.push_back(t.emenergy);
+    }
+  }
+
+  measurement m;
+  std::vector<float> eta(calo::towerset::big), phi(calo::towerset::big),
+                     energy(calo::towerset::big);
+  double checksum = 0;
+  unsigned long first = 0;
+  const double start = calo::seconds();
+  for (unsigned e = 0; e < ctx.events.size(); ++e) {
+    const int size = ctx.events[e].size();
+    if (size > 0) {
+      calo::decode_ids(&ids[first], size, &eta[0], &phi[0]);
+      calo::decode_energies(&energies[first], size, &energy[0]);
+      checksum += eta[0] + phi[0] + energy[0];
+    }
+    first += size;
+  }
+  m.seconds = calo::seconds() - start;
+  if (checksum != checksum) {
+    std::cerr << "bench_codec: NaN" << std::endl;
+  }
+
+  // Size of a whole compact tower
+  m.events = ctx.events.size();
+  m.towers = ctx.towers;
+  m.bytes = double(sizeof(calo::compact_tower)) * ctx.towers;
+  record("codec.decode", m);
+}
+
+// Runs all benchmarks once
+void run(context &ctx)
+{
+  bench_getentry(ctx);
+  bench_lazy(ctx);
+  bench_slow_file(ctx);
+  bench_loop(ctx);
+  bench_filters(ctx);
+  bench_conditions(ctx);
+  bench_event_filter(ctx);
+  bench_logic(ctx);
+  bench_selection(ctx);
+  bench_summary(ctx);
+  bench_histogram(ctx);
+  bench_gap(ctx);
+  bench_cluster(ctx);
+  bench_bank(ctx, 1);
+  bench_bank(ctx, 8);
+  bench_bank(ctx, 32);
+  bench_expression(ctx);
+  bench_store(ctx, calo::event_store::full, "store.full");
+  bench_store(ctx, calo::event_store::reduced, "store.reduced");
+  bench_store(ctx, calo::event_store::compact, "store.compact");
+  bench_codec(ctx);
+}
+
+// Writes synthetic events to a temporary file and returns its path, or an empty
+// string on failure
+std::string write_file(const calo::synthetic_config &config,
+                       unsigned long entries)
+{
+  char path[] = "/tmp/calobenchXXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) {
+    return "";
+  }
+  close(fd);
+
+  TDirectory *current = gDirectory;
+  TFile file(path, "RECREATE");
+  calo::synthetic_generator gen(config);
+  gen.write_tree(entries);
+  file.Write();
+  file.Close();
+  current->cd();
+  return path;
+}
+
+// Prints usage information
+int usage(const char *name)
+{
+  std::cerr << "Usage: " << name << " [-f file.root] [-n entries]"
+            << " [-s mean size] [-r repeats] [-b baseline.json]"
+            << " [-t tolerance] [-o baseline.json]" << std::endl;
+  return 1;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv)
+{
+  const char *path = nullptr;
+  const char *baseline_path = nullptr;
+  const char *output_path = nullptr;
+  unsigned long entries = 2000;
+  int repeats = 1;
+  double tolerance = 10;
+  calo::synthetic_config config;
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 >= argc) {
+      return usage(argv[0]);
+    } else if (std::strcmp(argv[i], "-f") == 0) {
+      path = argv[++i];
+    } else if (std::strcmp(argv[i], "-n") == 0) {
+      entries = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "-s") == 0) {
+      config.mean_size = std::strtod(argv[++i], nullptr);
+    } else if (std::strcmp(argv[i], "-r") == 0) {
+      repeats = std::max(1, std::atoi(argv[++i]));
+    } else if (std::strcmp(argv[i], "-b") == 0) {
+      baseline_path = argv[++i];
+    } else if (std::strcmp(argv[i], "-t") == 0) {
+      tolerance = std::strtod(argv[++i], nullptr);
+    } else if (std::strcmp(argv[i], "-o") == 0) {
+      output_path = argv[++i];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+
+  context ctx;
+  if (path != nullptr) {
+    TFile *in = new TFile(path, "READ");
+    ctx.tree_set = new calo::towerset(in);
+    entries = std::min(entries, ctx.tree_set->entries());
+    ctx.file = path;
+  } else {
+    calo::synthetic_generator gen(config);
+    ctx.tree_set = new calo::towerset(gen.write_tree(entries));
+    ctx.file = write_file(config, entries);
+  }
+  if (entries == 0) {
+    std::cerr << "calobench: no entries to process" << std::endl;
+    return 1;
+  }
+
+  // Keep a copy of the events in memory
+  ctx.towers = 0;
+  ctx.events.resize(entries);
+  for (unsigned long entry = 0; entry < entries; ++entry) {
+    ctx.tree_set->getentry(entry);
+    std::copy(ctx.tree_set->begin(), ctx.tree_set->end(),
+              std::back_inserter(ctx.events[entry]));
+    ctx.towers += ctx.events[entry].size();
+  }
+
+  std::map<std::string, double> baseline;
+  if (baseline_path != nullptr && !read_baseline(baseline_path, baseline)) {
+    std::cerr << "calobench: cannot read " << baseline_path << std::endl;
+    return 1;
+  }
+
+  pin();
+
+  // Warm up caches, then measure. Repeating the whole suite rather than every
+  // benchmark spreads slow drifts of the machine over all benchmarks.
+  run(ctx);
+  results.clear();
+  names.clear();
+  for (int i = 0; i < repeats; ++i) {
+    run(ctx);
+  }
+  if (path == nullptr && !ctx.file.empty()) {
+    std::remove(ctx.file.c_str());
+  }
+  report();
+
+  if (output_path != nullptr && !write_baseline(output_path, entries,
+                                                repeats)) {
+    std::cerr << "calobench: cannot write " << output_path << std::endl;
+    return 1;
+  }
+  if (baseline_path != nullptr && compare(baseline, tolerance) > 0) {
+    std::cerr << "calobench: performance regressions above " << tolerance
+              << "%" << std::endl;
+    return 1;
+  }
+  return 0;
+}
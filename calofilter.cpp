@@ -6,15 +6,24 @@
  */
 
 #include "calofilter.h"
+#include "eventfilter.h"
+#include "eventlist.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <stdexcept>
 #include <string>
 
 #include <TBranch.h>
 #include <TDirectory.h>
+#include <TFile.h>
+#include <TLeaf.h>
 #include <TTree.h>
 
+#include "timing.h"
+#include "trace.h"
+
 // At least ROOT doesn't define it in cmath
 #ifndef M_PI
 /// A macro for @f$ \pi @f$ (not all @c cmath headers define it)
@@ -35,12 +44,20 @@
  *
  * @subsection Import Importing the library
  *
- * The easiest way to import the library is by including the @c .cpp file:
+ * The easiest way to import the library is by including its @c .cpp files:
  *
  * ~~~~{.cpp}
+ * #include "schema.cpp"
+ * #include "trace.cpp"
  * #include "calofilter.cpp"
  * ~~~~
  *
+ * They need the following headers next to them: @c calofilter.h,
+ * @c eventfilter.h, @c eventlist.h, @c probe.h, @c schema.h, @c summary.h,
+ * @c timing.h and @c trace.h. Other parts of the library are in their own
+ * files, which are included the same way when needed (for instance @c eb.cpp
+ * for the EB filters, see @ref Filtering "below").
+ *
  * It is convenient to import the whole library into the global namespace:
  *
  * ~~~~{.cpp}
@@ -318,20 +335,23 @@ towerset::towerset()
 
 /// Constructs a towerset from the given directory
 /**
- * A @c TTree named @c CaloTree is looked for in the given directory. If it is
- * found, it is used as per the @c TTree constructor. Else, an exception is
- * thrown (@c std::runtime_error). The @c towerset takes ownership of the tree,
- * and you shouldn't access it directly.
+ * A @c TTree named @c CaloTree (or as given by the @c schema) is looked for in
+ * the given directory. If it is found, it is used as per the @c TTree
+ * constructor. Else, an exception is thrown (@c std::runtime_error). The
+ * @c towerset takes ownership of the tree, and you shouldn't access it
+ * directly.
  *
  * This constructor is useful to read data directly from a ROOT file.
  */
-towerset::towerset(TDirectory *dir)
+towerset::towerset(TDirectory *dir, const tree_schema &schema) :
+  _schema(schema)
 {
   TTree *tree = nullptr;
-  dir->GetObject("CaloTree", tree);
+  dir->GetObject(schema.tree().c_str(), tree);
   if (tree == nullptr) {
-    throw std::runtime_error("towerset::towerset: No TTree named \"CaloTree\" "
-                             "found in the current directory");
+    throw std::runtime_error("towerset::towerset: No TTree named \""
+                             + schema.tree()
+                             + "\" found in the current directory");
   }
   _tree = tree;
   init_branches();
@@ -361,12 +381,16 @@ towerset::towerset(TDirectory *dir)
  *   - <tt>CaloEnergy[CaloSize]</tt>: array of float that give towers' total
  *     energy
  *
- * An exception is thrown if @c tree is @c null (@c std::invalid_argument) or a
- * branch is missing (@c std::runtime_error). The @c towerset takes ownership of
- * the tree, and you shouldn't access it directly.
+ * Other branch names and types can be given with a @ref tree_schema.
+ *
+ * An exception is thrown if @c tree is @c null (@c std::invalid_argument), or
+ * if a branch is missing or has the wrong type (@c std::runtime_error). The
+ * @c towerset takes ownership of the tree, and you shouldn't access it
+ * directly.
  */
-towerset::towerset(TTree *tree) :
-  _tree(tree)
+towerset::towerset(TTree *tree, const tree_schema &schema) :
+  _tree(tree),
+  _schema(schema)
 {
   if (tree == nullptr) {
     throw std::invalid_argument("towerset::towerset: tree is null");
@@ -374,13 +398,46 @@ towerset::towerset(TTree *tree) :
   init_branches();
 }
 
+/// Constructs a towerset holding the given towers
+/**
+ * The resulting set isn't backed by a @c TTree: getentry() cannot be used, and
+ * new data is loaded with assign() instead. This is useful to run filters on
+ * data that doesn't come from a ROOT file, for instance in tests and
+ * benchmarks.
+ */
+towerset::towerset(const std::vector<tower> &towers) :
+  _tree(nullptr),
+  _direct(true),
+  _size(0),
+  _generation(0),
+  _run(0),
+  _lumi(0),
+  _event_filter(nullptr),
+  _accepted(true),
+  _has_grid(false),
+  _has_inv_cosh(false),
+  _cache_size(0),
+  _prefetch_depth(0),
+  _io(),
+  _lazy(false),
+  _lazy_entry(0),
+  _stale(0),
+  _prefetch_list(nullptr),
+  _prefetch_first(0),
+  _prefetch_end(0)
+{
+  assign(towers);
+}
+
 namespace {
   // Checks that the given branch exists in tree and sets its address to addr.
-  void check_branch_and_set_address(TTree *tree, const char *name, void *addr)
+  void check_branch_and_set_address(TTree *tree, const char *name, void *addr,
+                                    const char *caller)
   {
     TBranch *branch = tree->GetBranch(name);
     if (branch == nullptr) {
-      std::string msg = "towerset::towerset: No branch named \"";
+      std::string msg = caller;
+      msg += ": No branch named \"";
       msg += name;
       msg += "\" was found";
       throw std::runtime_error(msg);
@@ -391,37 +448,976 @@ namespace {
 
 void towerset::init_branches()
 {
-  // calo:: is needed because of a bug in CINT
-  calo::check_branch_and_set_address(_tree, "CaloSize", &_size);
   _size = 0;
-  calo::check_branch_and_set_address(_tree, "CaloEta", _eta);
-  calo::check_branch_and_set_address(_tree, "CaloPhi", _phi);
-  calo::check_branch_and_set_address(_tree, "CaloEBHits", _ebcount);
-  calo::check_branch_and_set_address(_tree, "CaloEEHits", _eecount);
-  calo::check_branch_and_set_address(_tree, "CaloHBHits", _hbcount);
-  calo::check_branch_and_set_address(_tree, "CaloHEHits", _hecount);
-  calo::check_branch_and_set_address(_tree, "CaloHFHits", _hfcount);
-  calo::check_branch_and_set_address(_tree, "CaloEmEnergy", _emenergy);
-  calo::check_branch_and_set_address(_tree, "CaloHadEnergy", _hadenergy);
-  calo::check_branch_and_set_address(_tree, "CaloEnergy", _totalenergy);
+  _generation = 0;
+  _run = _lumi = 0;
+  _event_filter = nullptr;
+  _accepted = true;
+  _has_grid = false;
+  _has_inv_cosh = false;
+  _cache_size = default_cache_size;
+  _prefetch_depth = 0;
+  _io = io_statistics();
+  _lazy = false;
+  _lazy_entry = 0;
+  _stale = 0;
+  _prefetch_list = nullptr;
+  _prefetch_first = _prefetch_end = 0;
+
+  _direct = true;
+  for (int f = 0; f < tree_schema::field_count; ++f) {
+    bind(f);
+    _direct = _direct && _bindings[f].direct;
+  }
+  if (_schema.branch(tree_schema::size).empty()) {
+    for (int f = tree_schema::eta; f < tree_schema::field_count; ++f) {
+      if (!tree_schema::is_vector(_bindings[f].type)) {
+        throw std::runtime_error("towerset::towerset: Without a size branch, "
+                                 "all branches must be vectors");
+      }
+    }
+  }
+  configure_cache();
+}
+
+// Checks the type of the branch of a field and sets its address, reading
+// directly into the column when possible.
+void towerset::bind(int field)
+{
+  const tree_schema::field f = tree_schema::field(field);
+  const std::string &name = _schema.branch(f);
+  binding &b = _bindings[field];
+  b.type = _schema.type(f);
+  b.direct = false;
+  b.object = nullptr;
+  if (name.empty()) {
+    return; // Size given by the vectors
+  }
+
+  TBranch *branch = _tree->GetBranch(name.c_str());
+  if (branch == nullptr) {
+    throw std::runtime_error("towerset::towerset: No branch named \""
+                             + name + "\" was found");
+  }
+  TLeaf *leaf = branch->GetLeaf(name.c_str());
+  const std::string actual = leaf == nullptr ? "unknown" : leaf->GetTypeName();
+  const tree_schema::storage type = tree_schema::parse_type(actual);
+  if (b.type == tree_schema::automatic) {
+    b.type = type;
+  }
+  if (type == tree_schema::automatic || type != b.type
+      || (f == tree_schema::size && type != tree_schema::int32)) {
+    throw std::runtime_error("towerset::towerset: Branch \"" + name
+                             + "\" has type " + actual + ", expected "
+                             + tree_schema::type_name(b.type));
+  }
+  if (tree_schema::is_integer(f) && type == tree_schema::uint32) {
+    throw std::runtime_error("towerset::towerset: Branch \"" + name
+                             + "\" has type " + actual
+                             + ", which doesn't fit in an int");
+  }
+
+  const tree_schema::storage native = f == tree_schema::size
+                                   || tree_schema::is_integer(f)
+                                    ? tree_schema::int32
+                                    : tree_schema::float32;
+  b.direct = b.type == native;
+  if (b.direct) {
+    branch->SetAddress(column_data(field));
+  } else if (tree_schema::is_vector(b.type)) {
+    switch (b.type) {
+    case tree_schema::vector_int32:
+      b.object = &b.ints;
+      break;
+    case tree_schema::vector_float32:
+      b.object = &b.floats;
+      break;
+    default:
+      b.object = &b.doubles;
+      break;
+    }
+    branch->SetAddress(&b.object);
+  } else {
+    b.buffer.resize(big);
+    branch->SetAddress(&b.buffer[0]);
+  }
+}
+
+// Returns the column holding a field.
+void *towerset::column_data(int field)
+{
+  switch (field) {
+  case tree_schema::size:
+    return &_size;
+  case tree_schema::eta:
+    return _eta;
+  case tree_schema::phi:
+    return _phi;
+  case tree_schema::ebcount:
+    return _ebcount;
+  case tree_schema::eecount:
+    return _eecount;
+  case tree_schema::hbcount:
+    return _hbcount;
+  case tree_schema::hecount:
+    return _hecount;
+  case tree_schema::hfcount:
+    return _hfcount;
+  case tree_schema::emenergy:
+    return _emenergy;
+  case tree_schema::hadenergy:
+    return _hadenergy;
+  default:
+    return _totalenergy;
+  }
+}
+
+// Returns the number of values read for a field that isn't read directly,
+// and sets data to point to them.
+int towerset::elements(int field, const void **data) const
+{
+  const binding &b = _bindings[field];
+  switch (b.type) {
+  case tree_schema::vector_int32:
+    *data = b.ints.empty() ? nullptr : &b.ints[0];
+    return b.ints.size();
+  case tree_schema::vector_float32:
+    *data = b.floats.empty() ? nullptr : &b.floats[0];
+    return b.floats.size();
+  case tree_schema::vector_float64:
+    *data = b.doubles.empty() ? nullptr : &b.doubles[0];
+    return b.doubles.size();
+  default:
+    *data = &b.buffer[0];
+    return _size;
+  }
+}
+
+// Copies the values read for a field to its column, converting them if
+// needed. The size must be converted before the other fields.
+void towerset::convert(int field)
+{
+  if (_bindings[field].direct) {
+    return;
+  }
+  const void *data;
+  if (field == tree_schema::size) {
+    const int size = elements(tree_schema::eta, &data);
+    if ((unsigned) size > big) {
+      throw std::length_error("towerset::getentry: too many towers");
+    }
+    _size = size;
+    return;
+  }
+
+  const int count = elements(field, &data);
+  if (count != _size) {
+    throw std::runtime_error("towerset::getentry: Branch \""
+                             + _schema.branch(tree_schema::field(field))
+                             + "\" doesn't have one value per tower");
+  }
+  if (tree_schema::is_integer(tree_schema::field(field))) {
+    convert_column(_bindings[field].type, data, count,
+                   static_cast<int *>(column_data(field)));
+  } else {
+    convert_column(_bindings[field].type, data, count,
+                   static_cast<float *>(column_data(field)));
+  }
+}
+
+// Creates the tree caches and registers the branches we read. Companion trees
+// get a cache of the same size. The learning phase is skipped, since the
+// branches are known in advance.
+void towerset::configure_cache()
+{
+  std::vector<TTree *> trees(1, _tree);
+  trees.insert(trees.end(), _companions.begin(), _companions.end());
+  for (unsigned t = 0; t < trees.size(); ++t) {
+    if (trees[t]->GetCurrentFile() != nullptr) {
+      trees[t]->SetCacheSize(_cache_size);
+    }
+  }
+  if (_cache_size == 0) {
+    return;
+  }
+
+  if (_tree->GetCurrentFile() != nullptr) {
+    for (int f = 0; f < tree_schema::field_count; ++f) {
+      const std::string &name = _schema.branch(tree_schema::field(f));
+      if (!name.empty()) {
+        _tree->AddBranchToCache(_tree->GetBranch(name.c_str()), true);
+      }
+    }
+    if (!_run_branch.empty()) {
+      _tree->AddBranchToCache(_tree->GetBranch(_run_branch.c_str()), true);
+    }
+    if (!_lumi_branch.empty()) {
+      _tree->AddBranchToCache(_tree->GetBranch(_lumi_branch.c_str()), true);
+    }
+  }
+  for (unsigned c = 0; c < _event_columns.size(); ++c) {
+    const event_column &column = _event_columns[c];
+    if (column.tree != nullptr && column.tree->GetCurrentFile() != nullptr) {
+      column.tree->AddBranchToCache(column.branch, true);
+    }
+  }
+  for (unsigned t = 0; t < trees.size(); ++t) {
+    if (trees[t]->GetCurrentFile() != nullptr) {
+      trees[t]->StopCacheLearningPhase();
+    }
+  }
+}
+
+/// Reads the run (and luminosity section) of every event from the tree
+/**
+ * By default, the run and luminosity section of events aren't known. After
+ * calling this function, they are read by getentry() from the given branches,
+ * which must hold a single 32-bit integer per entry, and are available from
+ * run() and lumi(). The luminosity section is only read if @c lumi_branch is
+ * not empty. This is used by filters that depend on the run, see
+ * @ref iov_eb_filter.
+ *
+ * An exception is thrown if the set isn't backed by a tree
+ * (@c std::logic_error) or a branch is missing (@c std::runtime_error).
+ */
+void towerset::read_run(const std::string &run_branch,
+                        const std::string &lumi_branch)
+{
+  if (_tree == nullptr) {
+    throw std::logic_error("towerset::read_run: no TTree to read from");
+  }
+  calo::check_branch_and_set_address(_tree, run_branch.c_str(), &_run,
+                                     "towerset::read_run");
+  if (!lumi_branch.empty()) {
+    calo::check_branch_and_set_address(_tree, lumi_branch.c_str(), &_lumi,
+                                       "towerset::read_run");
+  }
+  _run_branch = run_branch;
+  _lumi_branch = lumi_branch;
+  configure_cache();
+}
+
+/// Sets the run and luminosity section of the current event
+/**
+ * This is meant for sets filled with assign(), which don't come from a tree.
+ * The towers are left untouched, but generation() changes.
+ */
+void towerset::set_run(unsigned run, unsigned lumi)
+{
+  _run = run;
+  _lumi = lumi;
+  ++_generation; // The towers didn't change
+}
+
+namespace {
+  // Returns a value of the given type stored at raw.
+  double decode_value(tree_schema::storage type, const void *raw)
+  {
+    switch (type) {
+    case tree_schema::uint8: {
+      unsigned char value;
+      std::memcpy(&value, raw, sizeof(value));
+      return value;
+    }
+    case tree_schema::int16: {
+      short value;
+      std::memcpy(&value, raw, sizeof(value));
+      return value;
+    }
+    case tree_schema::uint16: {
+      unsigned short value;
+      std::memcpy(&value, raw, sizeof(value));
+      return value;
+    }
+    case tree_schema::int32: {
+      int value;
+      std::memcpy(&value, raw, sizeof(value));
+      return value;
+    }
+    case tree_schema::uint32: {
+      unsigned value;
+      std::memcpy(&value, raw, sizeof(value));
+      return value;
+    }
+    case tree_schema::float32: {
+      float value;
+      std::memcpy(&value, raw, sizeof(value));
+      return value;
+    }
+    default: {
+      double value;
+      std::memcpy(&value, raw, sizeof(value));
+      return value;
+    }
+    }
+  }
+}
+
+/// Reads a value per event from a branch of a companion tree
+/**
+ * Information about the whole event, such as the position of the primary
+ * vertex, trigger bits or the centrality, is often stored in other trees than
+ * the towers. This function makes such a value available as an event-level
+ * column: it is read by getentry() for the same entry as the towers, and its
+ * value in the current event is returned by event_value(). Event-level filters
+ * can use it to select events.
+ *
+ * ~~~~{.cpp}
+ * towerset set(file);
+ * TTree *events = nullptr;
+ * file->GetObject("EventTree", events);
+ * const int nvtx = set.add_event_column(events, "nPrimaryVertices");
+ * const int zvtx = set.add_event_column(events, "vz");
+ * for (unsigned long i = 0; i < set.entries(); ++i) {
+ *   set.getentry(i);
+ *   if (set.event_value(nvtx) < 1 || std::fabs(set.event_value(zvtx)) > 15) {
+ *     continue;
+ *   }
+ *   // ...
+ * }
+ * ~~~~
+ *
+ * The companion tree must have at least as many entries as the tower tree,
+ * with entry @c i describing the same event as the towers in entry @c i. If
+ * @c companion is @c null, the branch is read from the tower tree itself. The
+ * branch must hold a single @c Bool_t, @c UChar_t, @c Short_t, @c Int_t,
+ * @c Float_t or @c Double_t per entry; with @ref tree_schema::automatic, its
+ * type is detected.
+ *
+ * Companion trees are read in lockstep with the towers, and only the branches
+ * of event-level columns are read from them, even in lazy mode (see
+ * set_lazy()). ROOT keeps one cache per tree: companions get a cache of the
+ * same size as the tower tree (see set_cache_size()), and all caches are moved
+ * to the same range of entries by prefetch() and set_prefetch_depth(), so
+ * that they are refilled together. Companions must be plain trees, not
+ * @c TChain objects, and must outlive the set. Reads from companions are
+ * included in io_stats().
+ *
+ * Returns the index of the new column, or of the existing column if the branch
+ * is already read. The value of a new column is 0 until the next call to
+ * getentry(). An exception is thrown if the set isn't backed by a tree
+ * (@c std::logic_error), if the companion has too few entries or the branch
+ * holds towers, the run or the luminosity section (@c std::invalid_argument),
+ * or if the branch is missing or doesn't hold a single value of the expected
+ * type (@c std::runtime_error).
+ */
+int towerset::add_event_column(TTree *companion,
+                               const std::string &branch,
+                               tree_schema::storage type)
+{
+  if (_tree == nullptr) {
+    throw std::logic_error("towerset::add_event_column: no TTree to read "
+                           "from");
+  }
+  if (companion == nullptr) {
+    companion = _tree;
+  }
+  if (companion->GetEntries() < _tree->GetEntries()) {
+    throw std::invalid_argument("towerset::add_event_column: The companion "
+                                "tree has fewer entries than the towers");
+  }
+
+  TBranch *b = companion->GetBranch(branch.c_str());
+  if (b == nullptr) {
+    throw std::runtime_error("towerset::add_event_column: No branch named \""
+                             + branch + "\" was found");
+  }
+  if (companion == _tree) {
+    bool used = branch == _run_branch || branch == _lumi_branch;
+    for (int f = 0; f < tree_schema::field_count; ++f) {
+      used = used || branch == _schema.branch(tree_schema::field(f));
+    }
+    if (used) {
+      throw std::invalid_argument("towerset::add_event_column: Branch \""
+                                  + branch + "\" is already read by the set");
+    }
+  }
+  TLeaf *leaf = b->GetLeaf(branch.c_str());
+  const std::string actual = leaf == nullptr ? "unknown" : leaf->GetTypeName();
+  const tree_schema::storage detected = tree_schema::parse_type(actual);
+  if (type == tree_schema::automatic) {
+    type = detected;
+  }
+  if (detected == tree_schema::automatic || detected != type
+      || tree_schema::is_vector(type)) {
+    throw std::runtime_error("towerset::add_event_column: Branch \"" + branch
+                             + "\" has type " + actual + ", expected "
+                             + tree_schema::type_name(type));
+  }
+  if (leaf->GetLeafCount() != nullptr || leaf->GetLenStatic() != 1) {
+    throw std::runtime_error("towerset::add_event_column: Branch \"" + branch
+                             + "\" holds an array");
+  }
+  for (unsigned c = 0; c < _event_columns.size(); ++c) {
+    if (_event_columns[c].branch == b) {
+      return c; // Already read
+    }
+  }
+
+  event_column column;
+  column.name = branch;
+  column.tree = companion;
+  column.branch = b;
+  column.type = type;
+  column.raw = 0;
+  column.value = 0;
+  _event_columns.push_back(column);
+  if (companion != _tree
+      && std::find(_companions.begin(), _companions.end(), companion)
+         == _companions.end()) {
+    _companions.push_back(companion);
+  }
+
+  // The values may have moved
+  for (unsigned c = 0; c < _event_columns.size(); ++c) {
+    if (_event_columns[c].branch != nullptr) {
+      _event_columns[c].branch->SetAddress(&_event_columns[c].raw);
+    }
+  }
+  configure_cache();
+  _prefetch_first = _prefetch_end = 0; // Set the range of the new cache
+  return _event_columns.size() - 1;
+}
+
+/// Adds an event-level column whose values are given by set_event_value()
+/**
+ * This is meant for sets filled with assign(), which don't come from a tree.
+ * Returns the index of the new column, whose value is 0.
+ */
+int towerset::add_event_column(const std::string &name)
+{
+  event_column column;
+  column.name = name;
+  column.tree = nullptr;
+  column.branch = nullptr;
+  column.type = tree_schema::float64;
+  column.raw = 0;
+  column.value = 0;
+  _event_columns.push_back(column);
+  return _event_columns.size() - 1;
+}
+
+/// Returns the index of the first event-level column with the given name
+/**
+ * Columns read from a tree are named after their branch. Returns -1 if there
+ * is no such column.
+ */
+int towerset::find_event_column(const std::string &name) const
+{
+  for (unsigned c = 0; c < _event_columns.size(); ++c) {
+    if (_event_columns[c].name == name) {
+      return c;
+    }
+  }
+  return -1;
+}
+
+/// Sets the value of an event-level column in the current event
+/**
+ * The towers are left untouched, but generation() changes. For columns read
+ * from a tree, the value is overwritten by the next call to getentry().
+ */
+void towerset::set_event_value(int column, double value)
+{
+  _event_columns.at(column).value = value;
+  ++_generation;
+}
+
+// Reads the event-level columns of an entry and decodes their values. Returns
+// the number of bytes unzipped.
+int towerset::read_event_columns(unsigned long entry)
+{
+  int unzipped = 0;
+  TFile *main_file = _tree->GetCurrentFile();
+  for (int t = -1; t < (int) _companions.size(); ++t) {
+    TTree *tree = t < 0 ? _tree : _companions[t];
+    if (tree == _tree && !_lazy) {
+      continue; // Read with the towers
+    }
+    // Reads from the file of the towers are counted by getentry()
+    TFile *file = tree->GetCurrentFile();
+    const bool other_file = file != nullptr && file != main_file;
+    const unsigned long calls = other_file ? file->GetReadCalls() : 0;
+    const unsigned long bytes = other_file ? file->GetBytesRead() : 0;
+    const long local = tree == _tree ? _lazy_entry : tree->LoadTree(entry);
+    for (unsigned c = 0; c < _event_columns.size(); ++c) {
+      if (_event_columns[c].tree == tree) {
+        unzipped += std::max(0, _event_columns[c].branch->GetEntry(local));
+      }
+    }
+    if (other_file) {
+      _io.read_calls += file->GetReadCalls() - calls;
+      _io.bytes_read += file->GetBytesRead() - bytes;
+    }
+  }
+  for (unsigned c = 0; c < _event_columns.size(); ++c) {
+    event_column &column = _event_columns[c];
+    if (column.tree != nullptr) {
+      column.value = decode_value(column.type, &column.raw);
+    }
+  }
+  return unzipped;
+}
+
+/// Enables or disables lazy loading of the columns
+/**
+ * By default, getentry() reads all branches of the tree. In lazy mode, it
+ * only reads @c CaloSize, the run branches (see read_run()) and event-level
+ * columns (see add_event_column()). Every other column is read the first time
+ * it is used in the event, for instance by @ref tower_ref::emenergy or
+ * @ref tower_ref::ieta. This saves the time spent
+ * decompressing branches that aren't needed, which pays off when most events
+ * only use a few columns. columns() reads all the columns that weren't read
+ * yet.
+ *
+ * Once a column is read, using it costs a single flag check per access. Lazy
+ * loading isn't thread-safe: a set must not be used from several threads at
+ * once, even through @c const functions. An exception is thrown if the set
+ * isn't backed by a tree (@c std::logic_error).
+ */
+void towerset::set_lazy(bool lazy)
+{
+  if (_tree == nullptr) {
+    throw std::logic_error("towerset::set_lazy: no TTree to read from");
+  }
+  if (!lazy && _stale != 0) {
+    load_columns(_stale);
+  }
+  _lazy = lazy;
+}
+
+/// Sets the filter used to select events
+/**
+ * The filter is evaluated once per event by getentry(), which returns its
+ * result; it is also available from accepted(). Rejected events are loaded
+ * like the others, so that they can still be inspected, but an
+ * @ref event_loop skips them. In lazy mode, only the columns used by the
+ * filter are read for rejected events. Passing @c null accepts all events,
+ * which is the default. The filter must outlive the set or be replaced.
+ *
+ * @see @ref event_filters
+ */
+void towerset::set_event_filter(const event_filter *f)
+{
+  _event_filter = f;
+}
+
+/// Returns the context in which event filters see the current event
+/**
+ * The masks and summaries computed by event filters are kept in the context
+ * until the next event is loaded, and their memory is reused from one event to
+ * the next. This is what @ref event_filter::accept uses.
+ */
+const event_context &towerset::context() const
+{
+  if (_context.context == nullptr) {
+    _context.context = new event_context(*this);
+  }
+  return *_context.context;
+}
+
+// Deletes the context.
+towerset::context_holder::~context_holder()
+{
+  delete context;
+}
+
+/// Sets the size of the tree cache
+/**
+ * By default, a cache of @ref default_cache_size bytes is used, so that the
+ * data of many entries is read in a few large calls. This matters most for
+ * files on network file systems, where every read has a large latency. Only
+ * the branches read by the @c towerset are cached. A size of zero disables the
+ * cache.
+ */
+void towerset::set_cache_size(long bytes)
+{
+  if (bytes < 0) {
+    throw std::invalid_argument("towerset::set_cache_size: negative size");
+  }
+  _cache_size = bytes;
+  if (_tree != nullptr) {
+    configure_cache();
+  }
+}
+
+/// Sets the maximum number of clusters read at once by the cache
+/**
+ * By default (and with @c clusters = 0), the cache reads as many clusters as
+ * fit in its buffer. With a positive value, it reads at most @c clusters
+ * clusters at a time, which reduces memory usage and the amount of data read
+ * ahead when only part of the tree is processed.
+ */
+void towerset::set_prefetch_depth(int clusters)
+{
+  if (clusters < 0) {
+    throw std::invalid_argument("towerset::set_prefetch_depth: negative "
+                                "depth");
+  }
+  _prefetch_depth = clusters;
+  _prefetch_first = _prefetch_end = 0;
+  if (clusters == 0 && _prefetch_list == nullptr && _tree != nullptr) {
+    set_cache_range(0, _tree->GetEntries());
+  }
 }
 
 /// Gets the given entry from the underlying @c TTree.
 /**
+ * Returns @c false if the event is rejected by the event filter (see
+ * set_event_filter()). The towers of rejected events are loaded anyway.
+ *
  * @warning
  * This operation invalidates all iterators, so you must not use it while
  * iterators are alive. Use of invalid iterators is undefined behaviour (it
  * could, for example, trigger a beam dump).
  */
-void towerset::getentry(unsigned long entry)
+bool towerset::getentry(unsigned long entry)
+{
+  CALO_PROBE_SCOPE("towerset::getentry");
+  const trace::scope traced("towerset::getentry", "towerset", "entry", entry);
+  if (_tree == nullptr) {
+    throw std::logic_error("towerset::getentry: no TTree to read from");
+  }
+  if ((_prefetch_list != nullptr || _prefetch_depth > 0)
+      && (entry < _prefetch_first || entry >= _prefetch_end)) {
+    prefetch_clusters(entry);
+  }
+
+  TFile *file = _tree->GetCurrentFile();
+  const unsigned long calls = file == nullptr ? 0 : file->GetReadCalls();
+  const unsigned long bytes = file == nullptr ? 0 : file->GetBytesRead();
+  const double start = seconds();
+  int unzipped;
+  if (_lazy) {
+    // Read the size, from the eta vector if there's no size branch
+    const tree_schema::field f = _bindings[tree_schema::size].direct
+                               ? tree_schema::size
+                               : tree_schema::eta;
+    _lazy_entry = _tree->LoadTree(entry);
+    unzipped = _tree->GetBranch(_schema.branch(f).c_str())
+                    ->GetEntry(_lazy_entry);
+    if (!_run_branch.empty()) {
+      unzipped += _tree->GetBranch(_run_branch.c_str())->GetEntry(_lazy_entry);
+    }
+    if (!_lumi_branch.empty()) {
+      unzipped += _tree->GetBranch(_lumi_branch.c_str())
+                       ->GetEntry(_lazy_entry);
+    }
+  } else {
+    unzipped = _tree->GetEntry(entry);
+  }
+  if (!_event_columns.empty()) {
+    unzipped += read_event_columns(entry);
+  }
+  const double stop = seconds();
+  _io.seconds += stop - start;
+
+  if (!_direct) {
+    // In lazy mode, only the size was read, maybe from the eta vector
+    int fields = tree_schema::field_count;
+    if (_lazy) {
+      fields = _bindings[tree_schema::size].direct ? 1 : tree_schema::eta + 1;
+    }
+    for (int f = 0; f < fields; ++f) {
+      convert(f);
+    }
+  }
+  ++_io.entries;
+  _io.bytes_unzipped += std::max(0, unzipped);
+  if (file != nullptr && file == _tree->GetCurrentFile()) {
+    const unsigned long read = file->GetBytesRead() - bytes;
+    _io.read_calls += file->GetReadCalls() - calls;
+    _io.bytes_read += read;
+    if (trace::enabled && read > 0) {
+      trace::complete("read baskets", "io", start, stop, "bytes", read);
+    }
+  }
+
+  invalidate();
+  if (_lazy) {
+    _stale = (1u << col_count) - 1;
+    if (!_bindings[tree_schema::size].direct) {
+      _stale &= ~(1u << col_eta);
+    }
+  }
+  return filter_event();
+}
+
+// Discards the values computed from the previous event.
+void towerset::invalidate()
+{
+  ++_generation;
+  _has_grid = false;
+  _has_inv_cosh = false;
+  _stale = 0;
+}
+
+// Evaluates the event filter on the towers just loaded and returns the
+// result, which is also stored for accepted().
+bool towerset::filter_event()
+{
+  if (_event_filter == nullptr) {
+    _accepted = true;
+  } else {
+    const trace::scope filtered("event_filter", "filter");
+    _accepted = _event_filter->accept(*this);
+  }
+  return _accepted;
+}
+
+// Reads the columns of the current entry whose bits are set in columns, if
+// they weren't read yet. Only used in lazy mode.
+void towerset::load_columns(unsigned columns) const
+{
+  CALO_PROBE_SCOPE("towerset::load_columns");
+  columns &= _stale;
+  TFile *file = _tree->GetCurrentFile();
+  const unsigned long calls = file == nullptr ? 0 : file->GetReadCalls();
+  const unsigned long bytes = file == nullptr ? 0 : file->GetBytesRead();
+  const double start = seconds();
+  towerset *self = const_cast<towerset *>(this); // Only fills the columns
+  for (int c = 0; c < col_count; ++c) {
+    if (columns & (1u << c)) {
+      const tree_schema::field f = tree_schema::field(c + 1);
+      TBranch *branch = _tree->GetBranch(_schema.branch(f).c_str());
+      _io.bytes_unzipped += std::max(0, branch->GetEntry(_lazy_entry));
+      self->convert(f);
+    }
+  }
+  const double stop = seconds();
+  _io.seconds += stop - start;
+  if (file != nullptr) {
+    const unsigned long read = file->GetBytesRead() - bytes;
+    _io.read_calls += file->GetReadCalls() - calls;
+    _io.bytes_read += read;
+    if (trace::enabled && read > 0) {
+      trace::complete("read baskets", "io", start, stop, "bytes", read);
+    }
+  }
+  _stale &= ~columns;
+}
+
+// Fills the logical coordinates of all towers in the current event.
+void towerset::compute_grid() const
+{
+  need(col_eta);
+  need(col_phi);
+  if (_ieta.size() < (unsigned) _size) {
+    _ieta.resize(_size);
+    _iphi.resize(_size);
+  }
+  for (int i = 0; i < _size; ++i) {
+    _ieta[i] = eta_index(_eta[i]);
+    _iphi[i] = phi_index(_phi[i]);
+  }
+  _has_grid = true;
+}
+
+/// Returns @f$1/\cosh\eta@f$ for all towers in the current event
+/**
+ * This is the factor converting energies to transverse energies. It is
+ * computed once per event, on first use. The pointer is invalidated when new
+ * data is loaded into the set.
+ */
+const float *towerset::inv_cosh_eta() const
+{
+  if (!_has_inv_cosh) {
+    need(col_eta);
+    if (_inv_cosh.size() < big) {
+      _inv_cosh.resize(big);
+    }
+    // 1/cosh(x) = 2 exp(-|x|) / (1 + exp(-2|x|)), with a single exponential
+    for (int i = 0; i < _size; ++i) {
+      const float e = std::exp(-std::fabs(_eta[i]));
+      _inv_cosh[i] = 2 * e / (1 + e * e);
+    }
+    _has_inv_cosh = true;
+  }
+  return &_inv_cosh[0];
+}
+
+/// Reads only the clusters that contain entries in @c list
+/**
+ * When reading sparse entries, the @c TTreeCache normally fills its buffer
+ * with the baskets of all clusters that fit, including those without any
+ * entry of interest. After calling this function, the range of the cache is
+ * restricted to clusters that contain entries in @c list: when getentry()
+ * leaves the current range, it is moved to the cluster of the new entry and
+ * the following clusters, for as long as they contain entries in the list.
+ *
+ * Entries should be read in increasing order, for instance by iterating over
+ * the list. The range is also limited by the prefetch depth (see
+ * set_prefetch_depth()). Passing @c null restores the full range. The list
+ * must stay valid until prefetch() is called again.
+ *
+ * @see event_list
+ */
+void towerset::prefetch(const event_list *list)
 {
-  _tree->GetEntry(entry);
+  if (_tree == nullptr) {
+    throw std::logic_error("towerset::prefetch: no TTree to read from");
+  }
+  _prefetch_list = list;
+  _prefetch_first = _prefetch_end = 0;
+  if (list == nullptr && _prefetch_depth == 0) {
+    set_cache_range(0, _tree->GetEntries());
+  }
+}
+
+// Restricts the caches of the tower tree and of all companions to the same
+// range of entries. Does nothing when the trees have no cache.
+void towerset::set_cache_range(unsigned long first, unsigned long end)
+{
+  if (_tree->GetCurrentFile() == nullptr || _cache_size <= 0) {
+    return;
+  }
+  _tree->SetCacheEntryRange(first, end);
+  for (unsigned t = 0; t < _companions.size(); ++t) {
+    if (_companions[t]->GetCurrentFile() != nullptr) {
+      _companions[t]->SetCacheEntryRange(first, end);
+    }
+  }
+}
+
+// Sets the range of the cache for the clusters starting with that of entry.
+void towerset::prefetch_clusters(unsigned long entry)
+{
+  TTree::TClusterIterator clusters = _tree->GetClusterIterator(entry);
+  _prefetch_first = clusters.Next();
+  _prefetch_end = clusters.GetNextEntry();
+
+  // Extend the range up to the prefetch depth, and while the next cluster has
+  // entries in the list
+  const unsigned long entries = _tree->GetEntries();
+  for (int depth = 1;
+       _prefetch_end < entries
+       && (_prefetch_depth == 0 || depth < _prefetch_depth);
+       ++depth) {
+    const unsigned long first = clusters.Next();
+    const unsigned long end = clusters.GetNextEntry();
+    if (end <= first
+        || (_prefetch_list != nullptr && _prefetch_list->next(first) >= end)) {
+      break;
+    }
+    _prefetch_end = end;
+  }
+  set_cache_range(_prefetch_first, _prefetch_end);
+}
+
+/// Selects the towers that pass a filter
+/**
+ * The selection is returned both as spans of consecutive towers and as an
+ * array of indices, with pointers to the columns of the set. Loops over
+ * selected towers can then be written without iterators, so that the compiler
+ * can vectorize them:
+ *
+ * ~~~~{.cpp}
+ * tower_selection selection; // Reuse it for all events
+ * set.select(&goodeb, selection);
+ * const tower_columns &c = selection.columns();
+ * float sum = 0;
+ * for (unsigned s = 0; s < selection.spans().size(); ++s) {
+ *   const tower_span &span = selection.spans()[s];
+ *   for (int i = span.begin; i < span.end(); ++i) {
+ *     sum += c.emenergy[i];
+ *   }
+ * }
+ * ~~~~
+ *
+ * Spans are best when selected towers come in groups; the index array is
+ * better for sparse selections. The filter is called once per tower. If
+ * @c f is @c null, all towers are selected. The selection is invalidated when
+ * new data is loaded into the set.
+ */
+void towerset::select(const filter *f, tower_selection &selection) const
+{
+  selection._columns = columns();
+  selection._spans.clear();
+  selection._indices.clear();
+  if (f == nullptr) {
+    f = &_nofilter;
+  }
+
+  const filter &pass = *f;
+  for (int i = 0; i < _size; ++i) {
+    if (CALO_FILTER_CALL(pass, tower_ref(this, i))) {
+      selection._indices.push_back(i);
+      if (!selection._spans.empty() && selection._spans.back().end() == i) {
+        ++selection._spans.back().length;
+      } else {
+        selection._spans.push_back(tower_span(i, 1));
+      }
+    }
+  }
+}
+
+/// Selects the towers set in a mask
+/**
+ * This is useful with the results of a @ref filter_bank. The mask must have
+ * been computed for the current event.
+ *
+ * @see select(const filter *, tower_selection &) const
+ */
+void towerset::select(const tower_mask &mask, tower_selection &selection) const
+{
+  assert(mask.size() == _size);
+  selection._columns = columns();
+  selection._spans.clear();
+  selection._indices.clear();
+
+  for (int w = 0; w < mask.words(); ++w) {
+    int i = w * tower_mask::word_bits;
+    for (tower_mask::word_type bits = mask.word(w); bits != 0;
+         bits >>= 1, ++i) {
+      if ((bits & 1) == 0) {
+        continue;
+      }
+      selection._indices.push_back(i);
+      if (!selection._spans.empty() && selection._spans.back().end() == i) {
+        ++selection._spans.back().length;
+      } else {
+        selection._spans.push_back(tower_span(i, 1));
+      }
+    }
+  }
 }
 
 /// Gets the number of entries in the underlying @c TTree.
 unsigned long towerset::entries() const
 {
-  return _tree->GetEntries();
+  return _tree == nullptr ? 0 : _tree->GetEntries();
+}
+
+/// Replaces the contents of the set with the given towers
+/**
+ * This operation invalidates all iterators, like getentry(). If the set is
+ * backed by a @c TTree, the next call to getentry() overwrites the towers. The
+ * event filter is evaluated as in getentry(), see accepted().
+ *
+ * An exception is thrown if there are more than @ref big towers
+ * (@c std::length_error).
+ */
+void towerset::assign(const std::vector<tower> &towers)
+{
+  if (towers.size() > big) {
+    throw std::length_error("towerset::assign: too many towers");
+  }
+  _size = towers.size();
+  for (int i = 0; i < _size; ++i) {
+    const tower &t = towers[i];
+    _eta[i] = t.eta();
+    _phi[i] = t.phi();
+    _ebcount[i] = t.ebcount();
+    _eecount[i] = t.eecount();
+    _hbcount[i] = t.hbcount();
+    _hecount[i] = t.hecount();
+    _hfcount[i] = t.hfcount();
+    _emenergy[i] = t.emenergy();
+    _hadenergy[i] = t.hadenergy();
+    _totalenergy[i] = t.totalenergy();
+  }
+  invalidate();
+  filter_event();
 }
 
 } // namespace calo
\ No newline at end of file
@@ -9,7 +9,11 @@
  */
 
 #include <cassert>
+#include <climits>
+#include <cmath>
 #include <iterator>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #if __cplusplus < 201103L
@@ -23,6 +27,17 @@
 # define nullptr 0
 #endif
 
+#if __cplusplus >= 201103L && !defined(__CINT__)
+/// Marks constructors that can be used for constant initialization
+# define CALO_CONSTEXPR constexpr
+#else
+# define CALO_CONSTEXPR
+#endif
+
+#include "probe.h"
+#include "schema.h"
+
+class TBranch;
 class TTree;
 class TDirectory;
 
@@ -30,8 +45,33 @@ class TDirectory;
 namespace calo
 {
 
+class event_context;
+class event_filter;
+class event_list;
 class tower_ref;
 
+/// Returns the logical @f$\eta@f$ coordinate of a tower at @c eta
+/**
+ * Logical coordinates are defined as
+ * @f$ i_\eta \equiv \left\lfloor \frac{\eta}{0.085} \right\rfloor @f$,
+ * which corresponds to the groups of 5 by 5 crystals that @c CaloTowers use.
+ */
+inline int eta_index(float eta)
+{
+  return std::floor(eta / 0.085);
+}
+
+/// Returns the logical @f$\phi@f$ coordinate of a tower at @c phi
+/**
+ * Logical coordinates are defined as
+ * @f$ i_\phi \equiv \left\lfloor \frac{36 \phi}{\pi} \right\rfloor @f$,
+ * which corresponds to the groups of 5 by 5 crystals that @c CaloTowers use.
+ */
+inline int phi_index(float phi)
+{
+  return std::floor(phi / 3.141592653589793238462643383279502884 * 36);
+}
+
 /// Towers are @c reco objects that hold information about hits.
 /**
  * In the barrel, each tower corresponds to a group of 5 by 5 ECAL crystals and
@@ -56,6 +96,17 @@ public:
   /// Constructs an empty tower
   explicit tower() {}
 
+  /// Constructs a tower with the given properties
+  explicit tower(float eta, float phi,
+                 int ebcount, int eecount, int hbcount, int hecount,
+                 int hfcount,
+                 float emenergy, float hadenergy, float totalenergy) :
+    _eta(eta), _phi(phi),
+    _ebcount(ebcount), _eecount(eecount), _hbcount(hbcount),
+    _hecount(hecount), _hfcount(hfcount),
+    _emenergy(emenergy), _hadenergy(hadenergy), _totalenergy(totalenergy)
+  {}
+
   /// Copy constructor
   inline tower(const tower &other);
 
@@ -74,6 +125,14 @@ public:
   /// Returns the mean @f$\phi@f$ for this tower
   float phi() const { return _phi; }
 
+  /// Returns the logical @f$\eta@f$ coordinate of this tower
+  /// (see @ref eta_index)
+  int ieta() const { return eta_index(_eta); }
+
+  /// Returns the logical @f$\phi@f$ coordinate of this tower
+  /// (see @ref phi_index)
+  int iphi() const { return phi_index(_phi); }
+
   /// Returns the number of EB crystals that were taken into account when
   /// building the tower
   int ebcount() const { return _ebcount; }
@@ -121,6 +180,64 @@ public:
 
 std::ostream &operator<< (std::ostream &out, const tower &t);
 
+/// Pointers to the data of all towers in an event
+/**
+ * Each pointer refers to an array of @c size elements, which is valid until
+ * the next call to @ref towerset::getentry.
+ *
+ * @see towerset::columns()
+ */
+struct tower_columns
+{
+  /// The number of towers
+  int size;
+
+  /// @f$\eta@f$ of the towers
+  const float *eta;
+  /// @f$\phi@f$ of the towers
+  const float *phi;
+
+  /// Number of EB crystals in the towers
+  const int *ebcount;
+  /// Number of EE crystals in the towers
+  const int *eecount;
+  /// Number of HB cells in the towers
+  const int *hbcount;
+  /// Number of HE cells in the towers
+  const int *hecount;
+  /// Number of HF cells in the towers
+  const int *hfcount;
+
+  /// Electromagnetic energy of the towers
+  const float *emenergy;
+  /// Hadronic energy of the towers
+  const float *hadenergy;
+  /// Total energy of the towers
+  const float *totalenergy;
+};
+
+/// Statistics about the data read by a @ref towerset
+/**
+ * @see towerset::io_stats()
+ */
+struct io_statistics
+{
+  /// Number of entries read
+  unsigned long entries;
+
+  /// Number of read calls made to the file
+  unsigned long read_calls;
+
+  /// Number of bytes read from the file
+  unsigned long bytes_read;
+
+  /// Number of bytes after decompression
+  unsigned long bytes_unzipped;
+
+  /// Time spent reading entries, in seconds
+  double seconds;
+};
+
 class towerset;
 
 /// Zero-copy version of @ref tower
@@ -143,9 +260,18 @@ public:
   bool operator!= (const tower_ref &other) const { return !(*this == other); }
   bool operator!= (const tower &other) const { return !(*this == other); }
 
+  /// Returns the set this tower belongs to
+  const towerset *set() const { return _set; }
+
+  /// Returns the index of this tower in its set
+  int index() const { return _i; }
+
   inline float eta() const;
   inline float phi() const;
 
+  inline int ieta() const;
+  inline int iphi() const;
+
   inline int ebcount() const;
   inline int eecount() const;
   inline int hbcount() const;
@@ -203,10 +329,134 @@ public:
   virtual bool operator() (const tower_ref &) const = 0;
 };
 
+/// A set of towers in an event, stored as one bit per tower.
+/**
+ * Masks are the compact way to store the result of a filter for a whole event:
+ * bit @c i is set when the tower at index @c i passes. They are typically
+ * filled by a @ref filter_bank.
+ */
+class tower_mask
+{
+public:
+  /// The type used to store bits
+  typedef unsigned long word_type;
+
+  /// The number of bits in a @ref word_type
+  static const int word_bits = sizeof(word_type) * CHAR_BIT;
+
+private:
+  std::vector<word_type> _words;
+  int _size;
+
+public:
+  /// Constructs a mask for @c size towers, none of which is selected
+  explicit tower_mask(int size = 0) :
+    _words((size + word_bits - 1) / word_bits, 0),
+    _size(size)
+  {}
+
+  /// Clears the mask and resizes it to hold @c size towers
+  void reset(int size)
+  {
+    _words.assign((size + word_bits - 1) / word_bits, 0);
+    _size = size;
+  }
+
+  /// Returns the number of towers covered by the mask
+  int size() const { return _size; }
+
+  /// Returns the number of words used to store the mask
+  int words() const { return _words.size(); }
+
+  /// Returns the @c w-th word of the mask
+  word_type word(int w) const { return _words[w]; }
+
+  /// Sets the @c w-th word of the mask
+  void set_word(int w, word_type bits) { _words[w] = bits; }
+
+  /// Returns @c true if the tower at index @c i is selected
+  bool test(int i) const
+  {
+    assert(i >= 0 && i < _size);
+    return (_words[i / word_bits] >> (i % word_bits)) & 1;
+  }
+
+  /// Selects the tower at index @c i
+  void set(int i)
+  {
+    assert(i >= 0 && i < _size);
+    _words[i / word_bits] |= word_type(1) << (i % word_bits);
+  }
+
+  /// Unselects the tower at index @c i
+  void unset(int i)
+  {
+    assert(i >= 0 && i < _size);
+    _words[i / word_bits] &= ~(word_type(1) << (i % word_bits));
+  }
+
+  inline int count() const;
+};
+
+/// A range of consecutive towers, given by their indices in a @ref towerset
+struct tower_span
+{
+  /// Index of the first tower
+  int begin;
+
+  /// Number of towers
+  int length;
+
+  /// Constructs a span
+  tower_span(int first, int count) : begin(first), length(count) {}
+
+  /// Returns the index past the last tower
+  int end() const { return begin + length; }
+};
+
+/// The towers of an event that pass a filter, in a form suited to tight loops
+/**
+ * @see towerset::select
+ */
+class tower_selection
+{
+  friend class towerset;
+
+  tower_columns _columns;
+  std::vector<tower_span> _spans;
+  std::vector<int> _indices;
+
+public:
+  /// Constructs an empty selection
+  explicit tower_selection() { _columns.size = 0; }
+
+  /// Returns pointers to the data of all towers in the event
+  /**
+   * The pointers are invalidated when new data is loaded into the set.
+   */
+  const tower_columns &columns() const { return _columns; }
+
+  /// Returns the selected towers as runs of consecutive indices
+  const std::vector<tower_span> &spans() const { return _spans; }
+
+  /// Returns the indices of the selected towers, in increasing order
+  const std::vector<int> &indices() const { return _indices; }
+
+  /// Returns the number of selected towers
+  int size() const { return _indices.size(); }
+};
+
 /// A collection of all towers in an event.
+/**
+ * Some quantities, such as the logical coordinates of the towers, are computed
+ * on first use by const member functions and cached in the set. A set must
+ * therefore not be used by several threads at the same time, even through a
+ * const reference; give every thread its own set instead.
+ */
 class towerset
 {
   friend class tower_ref;
+  friend class event_store;
 
   /// A filter that lets every tower pass
   class nofilter : public filter
@@ -258,14 +508,105 @@ public:
     bool operator!= (const iterator &other) const { return !(*this == other); }
   };
 
-private:
+  /// The maximum number of towers in an event
   static const unsigned int big = 1000;
 
+  /// The default size of the tree cache, in bytes
+  static const long default_cache_size = 10000000;
+
+private:
+  // Columns that can be read lazily, in the order of the branches
+  enum column {
+    col_eta, col_phi,
+    col_ebcount, col_eecount, col_hbcount, col_hecount, col_hfcount,
+    col_emenergy, col_hadenergy, col_totalenergy,
+    col_count
+  };
+
+  // How a column is read from its branch, see tree_schema
+  struct binding
+  {
+    tree_schema::storage type;
+    bool direct;                // Read directly into the column
+    std::vector<double> buffer; // For C arrays that need a conversion
+    std::vector<int> ints;      // For std::vector branches
+    std::vector<float> floats;
+    std::vector<double> doubles;
+    void *object;               // The vector given to ROOT
+  };
+
+  // A value per event, see add_event_column()
+  struct event_column
+  {
+    std::string name;
+    TTree *tree;                // null for values given by set_event_value()
+    TBranch *branch;
+    tree_schema::storage type;
+    double raw;                 // Read by ROOT, interpreted according to type
+    double value;
+  };
+
   TTree *_tree;
+  tree_schema _schema;
+  binding _bindings[tree_schema::field_count];
+  bool _direct; // No column needs a conversion
 
   nofilter _nofilter; // ROOT doesn't work well with static variables
 
   int _size;
+  unsigned long _generation;
+
+  // Run and luminosity section, see read_run()
+  unsigned _run;
+  unsigned _lumi;
+  std::string _run_branch;
+  std::string _lumi_branch;
+
+  // Event-level columns and the companion trees they are read from
+  std::vector<event_column> _event_columns;
+  std::vector<TTree *> _companions;
+
+  // Event selection, see set_event_filter()
+  const event_filter *_event_filter;
+  bool _accepted;
+
+  // Owns the context of event filters, created on first use. Copies of a set
+  // create their own.
+  class context_holder
+  {
+  public:
+    event_context *context;
+
+    context_holder() : context(nullptr) {}
+    context_holder(const context_holder &) : context(nullptr) {}
+    context_holder &operator= (const context_holder &) { return *this; }
+    ~context_holder();
+  };
+  mutable context_holder _context;
+
+  // Logical coordinates, computed on first use in every event
+  mutable bool _has_grid;
+  mutable std::vector<int> _ieta;
+  mutable std::vector<int> _iphi;
+
+  // 1/cosh(eta), computed on first use in every event
+  mutable bool _has_inv_cosh;
+  mutable std::vector<float> _inv_cosh;
+
+  // I/O configuration and statistics
+  long _cache_size;
+  int _prefetch_depth;
+  mutable io_statistics _io;
+
+  // Lazy loading, see set_lazy()
+  bool _lazy;
+  long _lazy_entry;
+  mutable unsigned _stale; // One bit per column that wasn't read yet
+
+  // Cluster-aware prefetching, see prefetch()
+  const event_list *_prefetch_list;
+  unsigned long _prefetch_first;
+  unsigned long _prefetch_end;
 
   float _eta[big];
   float _phi[big];
@@ -281,16 +622,138 @@ private:
   float _totalenergy[big];
 
   void init_branches();
+  void bind(int field);
+  void *column_data(int field);
+  int elements(int field, const void **data) const;
+  void convert(int field);
+  void compute_grid() const;
+  void invalidate();
+  bool filter_event();
+  void load_columns(unsigned columns) const;
+
+  // Reads column c if it wasn't read yet
+  void need(column c) const
+  {
+    if (_stale & (1u << c)) {
+      load_columns(1u << c);
+    }
+  }
+  int read_event_columns(unsigned long entry);
+  void configure_cache();
+  void set_cache_range(unsigned long first, unsigned long end);
+  void prefetch_clusters(unsigned long entry);
 
 public:
   explicit towerset();
-  explicit towerset(TTree *tree);
-  explicit towerset(TDirectory *dir);
+  explicit towerset(TTree *tree, const tree_schema &schema = tree_schema());
+  explicit towerset(TDirectory *dir,
+                    const tree_schema &schema = tree_schema());
+  explicit towerset(const std::vector<tower> &towers);
   virtual ~towerset() {}
 
-  void getentry(unsigned long entry);
+  bool getentry(unsigned long entry);
   unsigned long entries() const;
 
+  void assign(const std::vector<tower> &towers);
+
+  /// Returns the description of the tree
+  const tree_schema &schema() const { return _schema; }
+
+  void read_run(const std::string &run_branch = "run",
+                const std::string &lumi_branch = "");
+  void set_run(unsigned run, unsigned lumi = 0);
+
+  /// Returns the run of the current event
+  /**
+   * This is 0 unless read_run() or set_run() was called.
+   */
+  unsigned run() const { return _run; }
+
+  /// Returns the luminosity section of the current event
+  /**
+   * This is 0 unless it is read from the tree or set with set_run().
+   */
+  unsigned lumi() const { return _lumi; }
+
+  int add_event_column(TTree *companion,
+                       const std::string &branch,
+                       tree_schema::storage type = tree_schema::automatic);
+  int add_event_column(const std::string &name);
+  int find_event_column(const std::string &name) const;
+  void set_event_value(int column, double value);
+
+  /// Returns the number of event-level columns
+  int event_columns() const { return _event_columns.size(); }
+
+  /// Returns the name of an event-level column
+  const std::string &event_column_name(int column) const
+  {
+    return _event_columns.at(column).name;
+  }
+
+  /// Returns how an event-level column is stored in its branch
+  tree_schema::storage event_column_type(int column) const
+  {
+    return _event_columns.at(column).type;
+  }
+
+  /// Returns the value of an event-level column in the current event
+  /**
+   * All supported types are represented exactly by a @c double. An exception
+   * is thrown if there is no such column (@c std::out_of_range).
+   */
+  double event_value(int column) const
+  {
+    if (column < 0 || column >= (int) _event_columns.size()) {
+      throw std::out_of_range("towerset::event_value: no such column, see "
+                              "add_event_column()");
+    }
+    return _event_columns[column].value;
+  }
+
+  void set_cache_size(long bytes);
+
+  /// Returns the size of the tree cache, in bytes
+  long cache_size() const { return _cache_size; }
+
+  void set_prefetch_depth(int clusters);
+
+  /// Returns the maximum number of clusters read at once (0 if unlimited)
+  int prefetch_depth() const { return _prefetch_depth; }
+
+  void prefetch(const event_list *list);
+
+  void set_lazy(bool lazy);
+
+  void set_event_filter(const event_filter *f);
+
+  /// Returns @c false if the current event was rejected by the event filter
+  bool accepted() const { return _accepted; }
+
+  const event_context &context() const;
+
+  /// Returns @c true if columns are read on first use
+  bool lazy() const { return _lazy; }
+
+  void select(const filter *f, tower_selection &selection) const;
+  void select(const tower_mask &mask, tower_selection &selection) const;
+
+  /// Returns statistics about the data read since the set was created
+  const io_statistics &io_stats() const { return _io; }
+
+  /// Returns the number of towers in the current event
+  int size() const { return _size; }
+
+  inline tower_columns columns() const;
+  const float *inv_cosh_eta() const;
+
+  /// Returns a number that changes every time new data is loaded
+  /**
+   * This can be used to detect when values computed from the current event
+   * need to be discarded.
+   */
+  unsigned long generation() const { return _generation; }
+
   inline iterator begin(const filter *filter = nullptr) const;
   inline iterator end() const;
 };
@@ -394,63 +857,113 @@ tower_ref::tower_ref(const towerset *set, int index) :
 float tower_ref::eta() const
 {
   assert(_i < _set->_size);
+  _set->need(towerset::col_eta);
   return _set->_eta[_i];
 }
 
 float tower_ref::phi() const
 {
   assert(_i < _set->_size);
+  _set->need(towerset::col_phi);
   return _set->_phi[_i];
 }
 
+/// Returns the logical @f$\eta@f$ coordinate of the tower
+/**
+ * Logical coordinates are computed once per event for all towers, so filters
+ * sharing them don't need to recompute them. The first call fills a cache in
+ * the set: it isn't safe to call concurrently from several threads.
+ */
+int tower_ref::ieta() const
+{
+  assert(_i < _set->_size);
+  if (!_set->_has_grid) {
+    _set->compute_grid();
+  }
+  return _set->_ieta[_i];
+}
+
+/// Returns the logical @f$\phi@f$ coordinate of the tower
+/**
+ * @see ieta()
+ */
+int tower_ref::iphi() const
+{
+  assert(_i < _set->_size);
+  if (!_set->_has_grid) {
+    _set->compute_grid();
+  }
+  return _set->_iphi[_i];
+}
+
 int tower_ref::ebcount() const
 {
   assert(_i < _set->_size);
+  _set->need(towerset::col_ebcount);
   return _set->_ebcount[_i];
 }
 
 int tower_ref::eecount() const
 {
   assert(_i < _set->_size);
+  _set->need(towerset::col_eecount);
   return _set->_eecount[_i];
 }
 
 int tower_ref::hbcount() const
 {
   assert(_i < _set->_size);
+  _set->need(towerset::col_hbcount);
   return _set->_hbcount[_i];
 }
 
 int tower_ref::hecount() const
 {
   assert(_i < _set->_size);
+  _set->need(towerset::col_hecount);
   return _set->_hecount[_i];
 }
 
 int tower_ref::hfcount() const
 {
   assert(_i < _set->_size);
-   return _set->_hfcount[_i];
+  _set->need(towerset::col_hfcount);
+  return _set->_hfcount[_i];
 }
 
 float tower_ref::emenergy() const
 {
   assert(_i < _set->_size);
+  _set->need(towerset::col_emenergy);
   return _set->_emenergy[_i];
 }
 
 float tower_ref::hadenergy() const
 {
   assert(_i < _set->_size);
+  _set->need(towerset::col_hadenergy);
   return _set->_hadenergy[_i];
 }
 
 float tower_ref::totalenergy() const
 {
   assert(_i < _set->_size);
+  _set->need(towerset::col_totalenergy);
   return _set->_totalenergy[_i];
 }
 
+/// Returns the number of selected towers
+int tower_mask::count() const
+{
+  int count = 0;
+  for (unsigned w = 0; w < _words.size(); ++w) {
+    for (word_type bits = _words[w]; bits != 0; bits &= bits - 1) {
+      ++count;
+    }
+  }
+  return count;
+}
+
 /// Sets the value pointed to by the iterator
 void towerset::iterator::set(const towerset *set,
                              int index,
@@ -467,7 +980,7 @@ void towerset::iterator::set(const towerset *set,
 void towerset::iterator::step_forward()
 {
   const filter &f = *_filter;
-  while (_i < _set->_size && !f(_t)) {
+  while (_i < _set->_size && !CALO_FILTER_CALL(f, _t)) {
     _t = tower_ref(_set, ++_i);
   }
 }
@@ -476,7 +989,7 @@ void towerset::iterator::step_forward()
 void towerset::iterator::step_backward()
 {
   const filter &f = *_filter;
-  while (_i >= 0 && !f(_t)) {
+  while (_i >= 0 && !CALO_FILTER_CALL(f, _t)) {
     _t = tower_ref(_set, --_i);
   }
 }
@@ -528,6 +1041,32 @@ towerset::iterator towerset::begin(const filter *filter) const
   return it;
 }
 
+/// Returns pointers to the data of all towers in the current event
+/**
+ * This is the fastest way to access the data, intended for tight loops over
+ * all towers. The pointers are invalidated by getentry(). In lazy mode, all
+ * columns that weren't read yet are read first.
+ */
+tower_columns towerset::columns() const
+{
+  if (_stale != 0) {
+    load_columns(_stale);
+  }
+  tower_columns c;
+  c.size = _size;
+  c.eta = _eta;
+  c.phi = _phi;
+  c.ebcount = _ebcount;
+  c.eecount = _eecount;
+  c.hbcount = _hbcount;
+  c.hecount = _hecount;
+  c.hfcount = _hfcount;
+  c.emenergy = _emenergy;
+  c.hadenergy = _hadenergy;
+  c.totalenergy = _totalenergy;
+  return c;
+}
+
 /// Returns a past-the-end iterator
 towerset::iterator towerset::end() const
 {
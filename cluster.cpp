@@ -0,0 +1,235 @@
+#include "cluster.h"
+
+/**
+ * @file
+ * @brief  Source for seeded tower clustering
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace calo {
+
+/**
+ * @class cluster_finder calclean/cluster.h
+ * @brief Groups adjacent towers into clusters grown from seeds.
+ *
+ * Building clusters by comparing every tower with every other is quadratic
+ * in the number of towers. A @c cluster_finder instead places the towers that
+ * pass a filter on the @f$(i_\eta, i_\phi)@f$ grid (see @ref eta_index and
+ * @ref phi_index), so that the neighbours of a tower are found in constant
+ * time:
+ *
+ * ~~~~{.cpp}
+ * cluster_finder finder; // Reuse it for all events
+ * const std::vector<tower_cluster> &clusters = finder.find(set, &goodeb);
+ * for (unsigned i = 0; i < clusters.size(); ++i) {
+ *   std::cout << clusters[i].energy << " GeV at eta = " << clusters[i].eta
+ *             << std::endl;
+ * }
+ * ~~~~
+ *
+ * Towers are used if they pass the filter and their energy is at least
+ * @ref cluster_config::tower_threshold. Those above
+ * @ref cluster_config::seed_threshold are seeds, which are processed by
+ * decreasing energy. A cluster is grown from every seed that doesn't belong
+ * to a cluster yet, by adding all neighbouring towers that aren't used by
+ * another cluster, then their neighbours, and so on. Every tower is visited
+ * a bounded number of times, so apart from sorting the seeds, the time taken
+ * is linear in the number of towers.
+ *
+ * Towers with @f$i_\eta@f$ outside of [-64, 63] are ignored, as are towers
+ * that share a cell with a more energetic one. The grid and the results are
+ * kept from one event to the next to avoid allocating memory; as a
+ * consequence, a @c cluster_finder must not be used from several threads at
+ * the same time.
+ */
+
+namespace {
+  const float pi = 3.141592653589793238462643383279502884;
+
+  // Offsets to the neighbours of a cell, sides first
+  const int row_offset[8] = { 0, 0, -1, 1, -1, -1, 1, 1 };
+  const int column_offset[8] = { -1, 1, 0, 0, -1, 1, -1, 1 };
+
+  // Returns the cell of a tower, or -1 if it is outside of the grid.
+  int cell_of(int ieta, int iphi)
+  {
+    const int row = ieta + cluster_finder::eta_cells / 2;
+    if (row < 0 || row >= cluster_finder::eta_cells) {
+      return -1;
+    }
+    const int n = cluster_finder::phi_cells;
+    const int column = ((iphi + n / 2) % n + n) % n;
+    return row * n + column;
+  }
+
+  // Brings an angle back to [-pi, pi].
+  float wrap(float phi)
+  {
+    if (phi > pi) {
+      return phi - 2 * pi;
+    } else if (phi < -pi) {
+      return phi + 2 * pi;
+    }
+    return phi;
+  }
+
+  // Orders seeds by decreasing energy, then by index.
+  struct seed_order
+  {
+    const float *energy;
+
+    explicit seed_order(const float *e) : energy(e) {}
+
+    bool operator() (int a, int b) const
+    {
+      return energy[a] > energy[b] || (energy[a] == energy[b] && a < b);
+    }
+  };
+}
+
+/// Constructs a cluster finder with the given configuration
+/**
+ * An exception is thrown if the configuration is invalid
+ * (@c std::invalid_argument).
+ */
+cluster_finder::cluster_finder(const cluster_config &config) :
+  _config(config),
+  _grid(eta_cells * phi_cells, 0)
+{
+  if (config.neighbours != cluster_config::four_neighbours
+      && config.neighbours != cluster_config::eight_neighbours) {
+    throw std::invalid_argument("cluster_finder: invalid topology");
+  }
+  if (config.seed_threshold < config.tower_threshold) {
+    throw std::invalid_argument("cluster_finder: seed threshold below tower "
+                                "threshold");
+  }
+}
+
+/// Finds the clusters of the current event
+/**
+ * Only towers that pass @c f are used; if @c f is @c null, all towers are
+ * used. Clusters are returned in the order of their seeds, by decreasing
+ * energy. The result is overwritten by the next call.
+ */
+const std::vector<tower_cluster> &cluster_finder::find(const towerset &set,
+                                                       const filter *f)
+{
+  _cells.clear();
+  _seeds.clear();
+  _members.clear();
+  _clusters.clear();
+
+  const tower_columns c = set.columns();
+  const float *energy = _config.energy == cluster_config::em ? c.emenergy
+                      : _config.energy == cluster_config::had ? c.hadenergy
+                      : c.totalenergy;
+
+  // Place candidates on the grid
+  for (int i = 0; i < c.size; ++i) {
+    if (!(energy[i] >= _config.tower_threshold)) {
+      continue;
+    }
+    const tower_ref t(&set, i);
+    if (f != nullptr && !CALO_FILTER_CALL(*f, t)) {
+      continue;
+    }
+    const int cell = cell_of(t.ieta(), t.iphi());
+    if (cell < 0) {
+      continue;
+    }
+    if (_grid[cell] == 0) {
+      _cells.push_back(cell);
+    } else if (energy[_grid[cell] - 1] >= energy[i]) {
+      continue;
+    }
+    _grid[cell] = i + 1;
+  }
+
+  for (unsigned k = 0; k < _cells.size(); ++k) {
+    const int i = _grid[_cells[k]] - 1;
+    if (energy[i] >= _config.seed_threshold) {
+      _seeds.push_back(i);
+    }
+  }
+  std::sort(_seeds.begin(), _seeds.end(), seed_order(energy));
+
+  for (unsigned k = 0; k < _seeds.size(); ++k) {
+    const int seed = _seeds[k];
+    const tower_ref t(&set, seed);
+    const int cell = cell_of(t.ieta(), t.iphi());
+    if (_grid[cell] == seed + 1) { // Not taken by a previous cluster
+      grow(c, energy, seed, cell);
+    }
+  }
+
+  // Leave the grid empty for the next event
+  for (unsigned k = 0; k < _cells.size(); ++k) {
+    _grid[_cells[k]] = 0;
+  }
+  return _clusters;
+}
+
+// Builds a cluster around the seed at the given cell. Towers added to the
+// cluster are removed from the grid.
+void cluster_finder::grow(const tower_columns &c,
+                          const float *energy,
+                          int seed,
+                          int cell)
+{
+  tower_cluster cluster;
+  cluster.seed = seed;
+  cluster.first = _members.size();
+
+  // Breadth-first search
+  _queue.clear();
+  _queue.push_back(cell);
+  _members.push_back(seed);
+  _grid[cell] = 0;
+  for (unsigned q = 0; q < _queue.size(); ++q) {
+    const int row = _queue[q] / phi_cells;
+    const int column = _queue[q] % phi_cells;
+    for (int n = 0; n < _config.neighbours; ++n) {
+      const int r = row + row_offset[n];
+      int col = column + column_offset[n];
+      if (r < 0 || r >= eta_cells) {
+        continue;
+      }
+      if (col < 0 || col >= phi_cells) {
+        if (!_config.wrap_phi) {
+          continue;
+        }
+        col = (col + phi_cells) % phi_cells;
+      }
+      const int neighbour = r * phi_cells + col;
+      if (_grid[neighbour] != 0) {
+        _members.push_back(_grid[neighbour] - 1);
+        _queue.push_back(neighbour);
+        _grid[neighbour] = 0;
+      }
+    }
+  }
+
+  // Energy-weighted position, with phi measured from the seed
+  cluster.size = _members.size() - cluster.first;
+  float sum = 0, eta = 0, dphi = 0;
+  for (int m = cluster.first; m < cluster.first + cluster.size; ++m) {
+    const int i = _members[m];
+    sum += energy[i];
+    eta += energy[i] * c.eta[i];
+    dphi += energy[i] * wrap(c.phi[i] - c.phi[seed]);
+  }
+  cluster.energy = sum;
+  if (sum > 0) {
+    cluster.eta = eta / sum;
+    cluster.phi = wrap(c.phi[seed] + dphi / sum);
+  } else {
+    cluster.eta = c.eta[seed];
+    cluster.phi = c.phi[seed];
+  }
+  _clusters.push_back(cluster);
+}
+
+} // namespace calo
@@ -0,0 +1,128 @@
+#ifndef CALCLEAN_CLUSTER
+#define CALCLEAN_CLUSTER
+
+/**
+ * @file
+ * @brief  Header for seeded tower clustering
+ */
+
+#include "calofilter.h"
+
+namespace calo {
+
+/// Parameters of the @ref cluster_finder
+struct cluster_config
+{
+  /// Towers considered adjacent on the @f$(i_\eta, i_\phi)@f$ grid
+  enum topology {
+    /// Towers sharing a side
+    four_neighbours = 4,
+    /// Towers sharing a side or a corner
+    eight_neighbours = 8
+  };
+
+  /// The energy used to build clusters
+  enum energy_type {
+    /// Electromagnetic energy
+    em,
+    /// Hadronic energy
+    had,
+    /// Total energy
+    total
+  };
+
+  /// Minimum energy of seeds, in GeV
+  float seed_threshold;
+
+  /// Minimum energy of the other towers of a cluster, in GeV
+  float tower_threshold;
+
+  /// Neighbours through which clusters grow
+  topology neighbours;
+
+  /// Whether towers at @f$i_\phi = -36@f$ and @f$i_\phi = 35@f$ are adjacent
+  bool wrap_phi;
+
+  /// The energy used for thresholds and cluster properties
+  energy_type energy;
+
+  /// Constructs the default configuration, for electromagnetic clusters
+  cluster_config() :
+    seed_threshold(1),
+    tower_threshold(0.2),
+    neighbours(eight_neighbours),
+    wrap_phi(true),
+    energy(em)
+  {}
+};
+
+/// A group of adjacent towers grown from a seed
+/**
+ * @see cluster_finder
+ */
+struct tower_cluster
+{
+  /// Index of the seed in the @ref towerset
+  int seed;
+
+  /// Position of the first tower in @ref cluster_finder::members
+  int first;
+
+  /// Number of towers
+  int size;
+
+  /// Sum of the energies of the towers
+  float energy;
+
+  /// Energy-weighted @f$\eta@f$
+  float eta;
+
+  /// Energy-weighted @f$\phi@f$, in @f$[-\pi, \pi]@f$
+  float phi;
+};
+
+class cluster_finder
+{
+  cluster_config _config;
+
+  // Index + 1 of the candidate tower in every cell of the grid, or 0
+  std::vector<int> _grid;
+
+  // Buffers reused from one event to the next
+  std::vector<int> _cells;
+  std::vector<int> _seeds;
+  std::vector<int> _queue;
+  std::vector<int> _members;
+  std::vector<tower_cluster> _clusters;
+
+  void grow(const tower_columns &c, const float *energy, int seed, int cell);
+
+public:
+  /// The number of @f$i_\eta@f$ values covered by the grid
+  static const int eta_cells = 128;
+
+  /// The number of @f$i_\phi@f$ values covered by the grid
+  static const int phi_cells = 72;
+
+  explicit cluster_finder(const cluster_config &config = cluster_config());
+
+  /// Returns the configuration of the finder
+  const cluster_config &config() const { return _config; }
+
+  const std::vector<tower_cluster> &find(const towerset &set,
+                                         const filter *f = nullptr);
+
+  /// Returns the clusters found by the last call to find()
+  const std::vector<tower_cluster> &clusters() const { return _clusters; }
+
+  /// Returns the indices of the towers in all clusters, cluster by cluster
+  /**
+   * The towers of a cluster @c c are at positions @c c.first to
+   * <tt>c.first + c.size - 1</tt>, starting with the seed.
+   */
+  const std::vector<int> &members() const { return _members; }
+};
+
+} // namespace calo
+
+#endif // CALCLEAN_CLUSTER
@@ -0,0 +1,109 @@
+#ifndef CALCLEAN_CODEC
+#define CALCLEAN_CODEC
+
+/**
+ * @file
+ * @brief  Header for the compact encoding of towers
+ */
+
+#include <cstring>
+
+#include "calofilter.h"
+
+namespace calo {
+
+/// Regions of the calorimeters, as stored in tower IDs
+enum tower_region {
+  /// EB or HB
+  barrel_region = 0,
+  /// EE or HE, but not HF
+  endcap_region = 1,
+  /// HF
+  forward_region = 2,
+  /// No hits
+  no_region = 3
+};
+
+/// Returns the region of a tower from its hit counts
+inline tower_region region_of(int ebcount, int eecount, int hbcount,
+                              int hecount, int hfcount)
+{
+  if (hfcount > 0) {
+    return forward_region;
+  } else if (eecount > 0 || hecount > 0) {
+    return endcap_region;
+  } else if (ebcount > 0 || hbcount > 0) {
+    return barrel_region;
+  }
+  return no_region;
+}
+
+unsigned short encode_id(int ieta, int iphi, tower_region region);
+
+/// Returns the logical @f$\eta@f$ coordinate stored in a tower ID
+inline int id_ieta(unsigned short id) { return (id >> 9) - 64; }
+
+/// Returns the logical @f$\phi@f$ coordinate stored in a tower ID
+inline int id_iphi(unsigned short id) { return ((id >> 2) & 0x7f) - 64; }
+
+/// Returns the region stored in a tower ID
+inline tower_region id_region(unsigned short id)
+{
+  return tower_region(id & 3);
+}
+
+unsigned short encode_energy(float energy);
+
+/// Decodes an energy encoded with @ref encode_energy
+inline float decode_energy(unsigned short code)
+{
+  const unsigned int magnitude = code & 0x7fff;
+  const unsigned int bits = (unsigned int) (code & 0x8000) << 16
+                          | (magnitude == 0 ? 0 : (magnitude << 13)
+                                                  + (111u << 23));
+  float energy;
+  std::memcpy(&energy, &bits, sizeof(energy));
+  return energy;
+}
+
+void decode_ids(const unsigned short *ids, int count, float *eta, float *phi);
+void decode_energies(const unsigned short *codes, int count, float *energies);
+
+/// A tower in 14 bytes instead of 40
+/**
+ * @see codec.h for the encoding.
+ */
+struct compact_tower
+{
+  /// Position and region, see @ref encode_id
+  unsigned short id;
+
+  /// Number of EB crystals
+  unsigned char ebcount;
+  /// Number of EE crystals
+  unsigned char eecount;
+  /// Number of HB cells
+  unsigned char hbcount;
+  /// Number of HE cells
+  unsigned char hecount;
+  /// Number of HF cells
+  unsigned char hfcount;
+
+  /// Electromagnetic energy, see @ref encode_energy
+  unsigned short emenergy;
+  /// Hadronic energy, see @ref encode_energy
+  unsigned short hadenergy;
+  /// Total energy, see @ref encode_energy
+  unsigned short totalenergy;
+
+  /// Constructs an uninitialized tower
+  compact_tower() {}
+
+  explicit compact_tower(const tower &t);
+
+  tower decode() const;
+};
+
+} // namespace calo
+
+#endif // CALCLEAN_CODEC
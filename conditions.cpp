@@ -0,0 +1,383 @@
+#include "conditions.h"
+
+/**
+ * @file
+ * @brief  Source for run-dependent conditions
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include "eb.h"
+
+namespace calo {
+
+/**
+ * @defgroup conditions Conditions
+ * @brief Parameters that depend on the run
+ *
+ * Hot cells and noise thresholds change from one data-taking period to the
+ * next. This module stores them by ranges of runs (intervals of validity, or
+ * IOVs) in a @ref conditions_store, and provides filters that use the
+ * conditions valid for the event being processed.
+ */
+
+namespace {
+  // Parses "run" or "run:lumi". lumi is left unchanged if not given.
+  bool parse_position(const std::string &text, unsigned &run, unsigned &lumi)
+  {
+    std::istringstream ss(text);
+    char colon = 0;
+    if (!(ss >> run)) {
+      return false;
+    }
+    if (ss >> colon) {
+      if (colon != ':' || !(ss >> lumi)) {
+        return false;
+      }
+    }
+    return ss.eof();
+  }
+
+  // Returns "file:line: " for error messages.
+  std::string location(const std::string &path, int line)
+  {
+    std::ostringstream ss;
+    ss << "conditions_store::load: " << path << ":" << line << ": ";
+    return ss.str();
+  }
+}
+
+/// Constructs the default conditions, those of @ref coldeb and @ref goodeb
+eb_conditions::eb_conditions() :
+  hotcells_eta(coldeb.hotcells_eta()),
+  hotcells_phi(coldeb.hotcells_phi()),
+  thresholds(goodeb_filter::default_thresholds,
+             goodeb_filter::default_thresholds
+             + goodeb_filter::default_thresholds_size)
+{}
+
+/**
+ * @class conditions_store calclean/conditions.h
+ * @brief Hot cells and thresholds by ranges of runs.
+ *
+ * A store maps non-overlapping ranges of runs and luminosity sections (see
+ * @ref iov) to @ref eb_conditions. It is typically read from a text file:
+ *
+ * ~~~~
+ * # Lines starting with # are comments
+ * iov 273150 275376
+ * hotcell -16 -36
+ * hotcell -16 -35
+ * thresholds 0.36 0.29 0.26 0.24 0.22
+ *
+ * iov 275377:1 276000:120
+ * hotcell 14 12
+ * ~~~~
+ *
+ * Every @c iov line starts a new range, given by its first and last runs,
+ * optionally followed by a luminosity section. The ranges include both ends;
+ * when no luminosity section is given, they cover whole runs. The @c hotcell
+ * lines give the @f$ i_\eta @f$ and @f$ i_\phi @f$ coordinates of hot cells,
+ * and the @c thresholds line the thresholds of @ref goodeb_filter. A range
+ * without @c hotcell lines has no hot cells; when the thresholds are omitted,
+ * the default ones are used.
+ *
+ * The conditions valid for an event are used through an @ref iov_eb_filter.
+ *
+ * @ingroup conditions
+ */
+
+/// Constructs an empty store
+conditions_store::conditions_store() :
+  _revision(0)
+{}
+
+/// Constructs a store with the ranges defined in a file
+/**
+ * @see load()
+ */
+conditions_store::conditions_store(const std::string &path) :
+  _revision(0)
+{
+  load(path);
+}
+
+/// Adds conditions valid in a range of runs
+/**
+ * An exception is thrown if the range is empty or overlaps with another one,
+ * if the hot cells don't have as many @f$ i_\eta @f$ as @f$ i_\phi @f$
+ * coordinates, or if there are no thresholds (@c std::invalid_argument).
+ */
+void conditions_store::add(const iov &range, const eb_conditions &payload)
+{
+  if (range.after(range.last_run, range.last_lumi)) {
+    throw std::invalid_argument("conditions_store::add: empty range");
+  }
+  if (payload.hotcells_eta.size() != payload.hotcells_phi.size()) {
+    throw std::invalid_argument("conditions_store::add: hot cells need as "
+                                "many ieta as iphi coordinates");
+  }
+  if (payload.thresholds.empty()) {
+    throw std::invalid_argument("conditions_store::add: no thresholds");
+  }
+
+  // Ranges are kept sorted; only the neighbours can overlap
+  unsigned i = 0;
+  while (i < _iovs.size()
+         && !_iovs[i].after(range.first_run, range.first_lumi)) {
+    ++i;
+  }
+  if ((i > 0 && !_iovs[i - 1].before(range.first_run, range.first_lumi))
+      || (i < _iovs.size()
+          && !_iovs[i].after(range.last_run, range.last_lumi))) {
+    throw std::invalid_argument("conditions_store::add: overlapping ranges");
+  }
+  _iovs.insert(_iovs.begin() + i, range);
+  _payloads.insert(_payloads.begin() + i, payload);
+  ++_revision;
+}
+
+/// Adds the ranges defined in a file
+/**
+ * See the class documentation for the format. An exception is thrown if the
+ * file can't be read or is malformed (@c std::runtime_error); the store is
+ * left unchanged in that case.
+ */
+void conditions_store::load(const std::string &path)
+{
+  std::ifstream in(path.c_str());
+  if (!in) {
+    throw std::runtime_error("conditions_store::load: cannot open " + path);
+  }
+
+  conditions_store result(*this);
+  iov range;
+  eb_conditions payload;
+  int first_line = 0;
+  bool pending = false;
+
+  std::string line;
+  for (int number = 1; ; ++number) {
+    const bool done = !std::getline(in, line);
+    std::istringstream ss(line);
+    std::string keyword;
+    if (!done && (!(ss >> keyword) || keyword[0] == '#')) {
+      continue;
+    }
+
+    if (done || keyword == "iov") {
+      if (pending) {
+        try {
+          result.add(range, payload);
+        } catch (std::invalid_argument &e) {
+          throw std::runtime_error(location(path, first_line) + e.what());
+        }
+      }
+      if (done) {
+        break;
+      }
+      std::string first, last;
+      range = iov();
+      if (!(ss >> first >> last)
+          || !parse_position(first, range.first_run, range.first_lumi)
+          || !parse_position(last, range.last_run, range.last_lumi)) {
+        throw std::runtime_error(location(path, number) + "bad range");
+      }
+      payload = eb_conditions();
+      payload.hotcells_eta.clear();
+      payload.hotcells_phi.clear();
+      first_line = number;
+      pending = true;
+    } else if (!pending) {
+      throw std::runtime_error(location(path, number) + "expected iov");
+    } else if (keyword == "hotcell") {
+      int ieta, iphi;
+      if (!(ss >> ieta >> iphi)) {
+        throw std::runtime_error(location(path, number) + "bad hot cell");
+      }
+      payload.hotcells_eta.push_back(ieta);
+      payload.hotcells_phi.push_back(iphi);
+    } else if (keyword == "thresholds") {
+      payload.thresholds.clear();
+      float threshold;
+      while (ss >> threshold) {
+        payload.thresholds.push_back(threshold);
+      }
+      if (!ss.eof() || payload.thresholds.empty()) {
+        throw std::runtime_error(location(path, number) + "bad thresholds");
+      }
+    } else {
+      throw std::runtime_error(location(path, number) + "unknown keyword "
+                               + keyword);
+    }
+  }
+
+  std::swap(_iovs, result._iovs);
+  std::swap(_payloads, result._payloads);
+  ++_revision;
+}
+
+/// Writes all ranges to a file, in the format understood by load()
+/**
+ * An exception is thrown if the file can't be written
+ * (@c std::runtime_error).
+ */
+void conditions_store::save(const std::string &path) const
+{
+  std::ofstream out(path.c_str());
+  out << std::setprecision(9);
+  for (unsigned i = 0; i < _iovs.size(); ++i) {
+    const iov &range = _iovs[i];
+    const eb_conditions &payload = _payloads[i];
+    out << (i > 0 ? "\n" : "")
+        << "iov " << range.first_run << ":" << range.first_lumi << " "
+        << range.last_run << ":" << range.last_lumi << "\n";
+    for (unsigned c = 0; c < payload.hotcells_eta.size(); ++c) {
+      out << "hotcell " << payload.hotcells_eta[c] << " "
+          << payload.hotcells_phi[c] << "\n";
+    }
+    out << "thresholds";
+    for (unsigned t = 0; t < payload.thresholds.size(); ++t) {
+      out << " " << payload.thresholds[t];
+    }
+    out << "\n";
+  }
+  if (!out) {
+    throw std::runtime_error("conditions_store::save: cannot write " + path);
+  }
+}
+
+/// Returns the index of the range containing @c run and @c lumi, or -1
+int conditions_store::find(unsigned run, unsigned lumi) const
+{
+  // Find the first range starting after the position
+  int low = 0, high = _iovs.size();
+  while (low < high) {
+    const int middle = (low + high) / 2;
+    if (_iovs[middle].after(run, lumi)) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+  return low > 0 && !_iovs[low - 1].before(run, lumi) ? low - 1 : -1;
+}
+
+/**
+ * @class iov_eb_filter calclean/conditions.h
+ * @brief EB filters using the conditions valid for every event.
+ *
+ * This filter behaves like @ref coldeb, @ref hoteb or @ref goodeb, with the hot
+ * cells and thresholds taken from a @ref conditions_store for the run of the
+ * event being processed. The run is obtained from the @ref towerset, which
+ * must be told where to read it:
+ *
+ * ~~~~{.cpp}
+ * conditions_store store("eb_conditions.txt");
+ * iov_eb_filter good(&store, iov_eb_filter::good);
+ *
+ * towerset set(file);
+ * set.read_run("run", "lumi");
+ * for (unsigned long i = 0; i < set.entries(); ++i) {
+ *   set.getentry(i);
+ *   for (towerset::iterator it = set.begin(&good); it != set.end(); ++it) {
+ *     // ...
+ *   }
+ * }
+ * ~~~~
+ *
+ * The conditions of every range are turned into lookup tables the first time
+ * they are needed, and kept for later use. Once per event, the filter checks
+ * that the run is still in the current range, which is the case most of the
+ * time; only when it isn't is the store searched. An exception is thrown if no
+ * range contains the run (@c std::runtime_error), or if the run of the event
+ * is unknown because neither @ref towerset::read_run nor
+ * @ref towerset::set_run were called (@c std::logic_error).
+ *
+ * Hot cells with @f$ i_\eta @f$ outside of [-64, 63] or @f$ i_\phi @f$ outside
+ * of [-36, 35] are ignored. Since the filter keeps track of the current range,
+ * an instance must not be shared between threads.
+ *
+ * @ingroup conditions
+ */
+
+/// Constructs a filter using the conditions in @c store
+/**
+ * The store must outlive the filter. It can be modified while the filter
+ * exists.
+ */
+iov_eb_filter::iov_eb_filter(const conditions_store *store, kind k) :
+  _store(store),
+  _kind(k),
+  _revision(0),
+  _set(nullptr),
+  _generation(0),
+  _current(-1)
+{
+  assert(store != nullptr);
+  _tables.resize(store->size());
+  _revision = store->revision();
+}
+
+// Selects the conditions for the current event of set, building the lookup
+// tables if needed.
+void iov_eb_filter::update(const towerset *set) const
+{
+  if (_revision != _store->revision()) {
+    _tables.assign(_store->size(), compiled());
+    _revision = _store->revision();
+    _current = -1;
+  }
+
+  const unsigned run = set->run();
+  const unsigned lumi = set->lumi();
+  if (run == 0) {
+    throw std::logic_error("iov_eb_filter: the run of the event is unknown, "
+                           "see towerset::read_run()");
+  }
+  if (_current < 0 || !_store->range(_current).contains(run, lumi)) {
+    const int i = _store->find(run, lumi);
+    if (i < 0) {
+      std::ostringstream ss;
+      ss << "iov_eb_filter: no conditions for run " << run
+         << ", luminosity section " << lumi;
+      throw std::runtime_error(ss.str());
+    }
+
+    compiled &table = _tables[i];
+    if (!table.ready) {
+      const eb_conditions &payload = _store->payload(i);
+      table.hot.assign(eta_cells * phi_cells, false);
+      for (unsigned c = 0; c < payload.hotcells_eta.size(); ++c) {
+        const int ieta = payload.hotcells_eta[c] + eta_cells / 2;
+        const int iphi = payload.hotcells_phi[c] + phi_cells / 2;
+        if (ieta >= 0 && ieta < eta_cells && iphi >= 0 && iphi < phi_cells) {
+          table.hot[ieta * phi_cells + iphi] = true;
+        }
+      }
+
+      // Same rule as goodeb_filter, for up to 25 crystals (5x5)
+      const std::vector<float> &thresholds = payload.thresholds;
+      table.last = thresholds.back();
+      table.cuts.resize(std::max<unsigned>(26, thresholds.size() + 1));
+      table.cuts[0] = 0;
+      for (unsigned n = 1; n < table.cuts.size(); ++n) {
+        const int crystals = n;
+        table.cuts[n] = n < thresholds.size()
+                      ? thresholds[n - 1] * crystals
+                      : table.last * crystals;
+      }
+      table.ready = true;
+    }
+    _current = i;
+  }
+
+  _set = set;
+  _generation = set->generation();
+}
+
+} // namespace calo
@@ -0,0 +1,192 @@
+#ifndef CALCLEAN_CONDITIONS
+#define CALCLEAN_CONDITIONS
+
+/**
+ * @file
+ * @brief  Header for run-dependent conditions
+ */
+
+#include <string>
+
+#include "calofilter.h"
+
+namespace calo {
+
+/// A range of runs and luminosity sections
+/**
+ * Both ends are included. Positions are compared run first, then luminosity
+ * section.
+ *
+ * @ingroup conditions
+ */
+struct iov
+{
+  /// First run
+  unsigned first_run;
+  /// First luminosity section in the first run
+  unsigned first_lumi;
+  /// Last run
+  unsigned last_run;
+  /// Last luminosity section in the last run
+  unsigned last_lumi;
+
+  /// Constructs a range covering whole runs
+  explicit iov(unsigned first = 0, unsigned last = UINT_MAX) :
+    first_run(first), first_lumi(0), last_run(last), last_lumi(UINT_MAX)
+  {}
+
+  /// Constructs a range starting and ending at given luminosity sections
+  explicit iov(unsigned first_run, unsigned first_lumi,
+               unsigned last_run, unsigned last_lumi) :
+    first_run(first_run), first_lumi(first_lumi),
+    last_run(last_run), last_lumi(last_lumi)
+  {}
+
+  /// Returns @c true if the range starts after @c run and @c lumi
+  bool after(unsigned run, unsigned lumi) const
+  {
+    return first_run > run || (first_run == run && first_lumi > lumi);
+  }
+
+  /// Returns @c true if the range ends before @c run and @c lumi
+  bool before(unsigned run, unsigned lumi) const
+  {
+    return last_run < run || (last_run == run && last_lumi < lumi);
+  }
+
+  /// Returns @c true if the range contains @c run and @c lumi
+  bool contains(unsigned run, unsigned lumi) const
+  {
+    return !after(run, lumi) && !before(run, lumi);
+  }
+};
+
+/// Hot cells and thresholds used to clean EB in a range of runs
+/**
+ * @see conditions_store, iov_eb_filter
+ * @ingroup conditions
+ */
+struct eb_conditions
+{
+  /// @f$ i_\eta @f$ coordinates of the hot cells
+  std::vector<int> hotcells_eta;
+  /// @f$ i_\phi @f$ coordinates of the hot cells
+  std::vector<int> hotcells_phi;
+  /// Thresholds on @f$E_\mathrm{em}/N@f$, see @ref goodeb_filter
+  std::vector<float> thresholds;
+
+  explicit eb_conditions();
+};
+
+class conditions_store
+{
+  std::vector<iov> _iovs;
+  std::vector<eb_conditions> _payloads;
+  unsigned long _revision;
+
+public:
+  explicit conditions_store();
+  explicit conditions_store(const std::string &path);
+
+  void add(const iov &range, const eb_conditions &payload);
+
+  void load(const std::string &path);
+  void save(const std::string &path) const;
+
+  int find(unsigned run, unsigned lumi = 0) const;
+
+  /// Returns the number of ranges
+  int size() const { return _iovs.size(); }
+
+  /// Returns the @c i-th range, by increasing runs
+  const iov &range(int i) const { return _iovs.at(i); }
+
+  /// Returns the conditions valid in the @c i-th range
+  const eb_conditions &payload(int i) const { return _payloads.at(i); }
+
+  /// Returns a number that changes every time the store is modified
+  unsigned long revision() const { return _revision; }
+};
+
+class iov_eb_filter : public filter
+{
+public:
+  /// Towers selected by the filter
+  enum kind {
+    /// EB towers that aren't hot, like @ref coldeb
+    cold,
+    /// Hot EB towers, like @ref hoteb
+    hot,
+    /// EB towers that aren't hot and pass the thresholds, like @ref goodeb
+    good
+  };
+
+private:
+  // Size of the (ieta, iphi) grid used to look up hot cells
+  static const int eta_cells = 128;
+  static const int phi_cells = 72;
+
+  // Lookup tables built from the conditions of one range
+  struct compiled
+  {
+    bool ready;
+    std::vector<bool> hot;   // One flag per cell of the grid
+    std::vector<float> cuts; // Minimum energy, by number of crystals
+    float last;              // Threshold used for more crystals
+
+    compiled() : ready(false), last(0) {}
+  };
+
+  const conditions_store *_store;
+  kind _kind;
+
+  mutable std::vector<compiled> _tables;
+  mutable unsigned long _revision;
+  mutable const towerset *_set;
+  mutable unsigned long _generation;
+  mutable int _current;
+
+  void update(const towerset *set) const;
+
+public:
+  explicit iov_eb_filter(const conditions_store *store, kind k = good);
+
+  /// Returns the kind of towers selected by the filter
+  kind selects() const { return _kind; }
+
+  inline bool operator() (const tower_ref &tower) const;
+};
+
+/// Returns @c true if @c tower passes the conditions valid for its event
+bool iov_eb_filter::operator() (const tower_ref &tower) const
+{
+  if (!tower.iseb()) {
+    return false;
+  }
+  const towerset *set = tower.set();
+  if (set != _set || set->generation() != _generation) {
+    update(set);
+  }
+  const compiled &table = _tables[_current];
+
+  const int ieta = tower.ieta() + eta_cells / 2;
+  const int iphi = tower.iphi() + phi_cells / 2;
+  const bool is_hot = ieta >= 0 && ieta < eta_cells
+                   && iphi >= 0 && iphi < phi_cells
+                   && table.hot[ieta * phi_cells + iphi];
+  if (_kind != good) {
+    return is_hot == (_kind == hot);
+  }
+  if (is_hot) {
+    return false;
+  }
+  const int crystals = tower.ebcount();
+  const float cut = (unsigned) crystals < table.cuts.size()
+                  ? table.cuts[crystals]
+                  : table.last * crystals;
+  return tower.emenergy() > cut;
+}
+
+} // namespace calo
+
+#endif // CALCLEAN_CONDITIONS
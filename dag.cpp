@@ -0,0 +1,282 @@
+#include "dag.h"
+
+/**
+ * @file
+ * @brief  Source for filter graphs with shared subfilters
+ */
+
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+#include "logic.h"
+
+namespace calo {
+
+/**
+ * @class filter_dag calclean/dag.h
+ * @brief Builds filters from shared subfilters that are evaluated only once.
+ *
+ * Filters built with the classes from the @ref logic module form a tree: when
+ * the same filter appears twice, it is evaluated twice. For instance, the
+ * following filter runs the hot tower scan of @ref coldeb twice for every EB
+ * tower, once through @ref goodeb and once through the @ref not_filter:
+ *
+ * ~~~~{.cpp}
+ * and_filter f = and_filter(&goodeb, new not_filter(&coldeb));
+ * ~~~~
+ *
+ * A @c filter_dag instead builds a directed acyclic graph of filters. Every
+ * filter registered with share() and every combination built with make_and(),
+ * make_or() and make_not() becomes a @ref node that remembers its result for
+ * every tower of the current event. Identical combinations are detected and
+ * return the same node, so a subfilter used in several places is evaluated at
+ * most once per tower:
+ *
+ * ~~~~{.cpp}
+ * filter_dag dag;
+ * const filter *cold = dag.share(&coldeb, "coldeb");
+ * goodeb_filter good(cold); // Uses the shared node instead of its own list
+ * const filter *f = dag.make_and(dag.share(&good, "goodeb"),
+ *                                dag.make_not(cold));
+ *
+ * // Use f as any other filter, then:
+ * dag.print(std::cout);
+ * ~~~~
+ *
+ * The graph owns the nodes it creates, but not the filters given to share().
+ * Nodes are only valid as long as the graph is alive.
+ *
+ * @warning Nodes store their results inside the node, so the same graph must
+ *          not be used from several threads at the same time.
+ */
+
+/**
+ * @class filter_dag::node calclean/dag.h
+ * @brief A node in a @ref filter_dag.
+ *
+ * Nodes wrap another filter and cache its result for every tower of the
+ * current event. The cache is invalidated when the @ref towerset loads a new
+ * event (see @ref towerset::generation).
+ */
+
+/// Constructs a node evaluating @c arg
+filter_dag::node::node(const filter *arg, const std::string &name) :
+  _arg(arg),
+  _name(name),
+  _set(nullptr),
+  _generation(0),
+  _epoch(0),
+  _calls(0),
+  _evaluations(0)
+{}
+
+/// Returns the (possibly cached) result of the underlying filter
+bool filter_dag::node::operator() (const tower_ref &tower) const
+{
+  ++_calls;
+
+  const towerset *set = tower.set();
+  if (set != _set || set->generation() != _generation) {
+    // New event: invalidate all cached values at once
+    _set = set;
+    _generation = set->generation();
+    ++_epoch;
+  }
+
+  const unsigned i = tower.index();
+  if (i >= _stamps.size()) {
+    _stamps.resize(set->size(), 0);
+    _values.resize(set->size());
+  } else if (_stamps[i] == _epoch) {
+    return _values[i];
+  }
+
+  ++_evaluations;
+  const filter &arg = *_arg;
+  const tower_ref t = tower; // ROOT's pseudo-C++ parser
+  const bool value = CALO_FILTER_CALL(arg, t);
+  _stamps[i] = _epoch;
+  _values[i] = value;
+  return value;
+}
+
+/// Destructor
+/**
+ * All nodes created by the graph are deleted.
+ */
+filter_dag::~filter_dag()
+{
+  for (unsigned i = 0; i < _nodes.size(); ++i) {
+    delete _nodes[i];
+  }
+  for (unsigned i = 0; i < _owned.size(); ++i) {
+    delete _owned[i];
+  }
+}
+
+/// Registers a filter in the graph
+/**
+ * Returns the node corresponding to @c f. Calling this function several times
+ * with the same filter returns the same node. Passing a node of this graph
+ * returns it unchanged.
+ *
+ * The optional @c name is used by print().
+ */
+const filter_dag::node *filter_dag::share(const filter *f,
+                                          const std::string &name)
+{
+  assert(f != nullptr);
+
+  for (unsigned i = 0; i < _nodes.size(); ++i) {
+    if (_nodes[i] == f) {
+      return _nodes[i];
+    }
+  }
+
+  std::map<const filter *, node *>::iterator it = _shared.find(f);
+  if (it != _shared.end()) {
+    return it->second;
+  }
+
+  std::string label = name;
+  if (label.empty()) {
+    std::ostringstream ss;
+    ss << "filter@" << f;
+    label = ss.str();
+  }
+  node *n = new node(f, label);
+  _nodes.push_back(n);
+  _shared[f] = n;
+  return n;
+}
+
+// Returns the node for the given operation, creating it if needed.
+const filter_dag::node *filter_dag::combine(operation op,
+                                            const filter *lhs,
+                                            const filter *rhs,
+                                            const char *symbol)
+{
+  const node *l = share(lhs);
+  const node *r = rhs == nullptr ? nullptr : share(rhs);
+
+  // AND and OR are commutative: store operands in a canonical order
+  operands key_operands(l, r);
+  if (op != op_not && std::less<const filter *>()(r, l)) {
+    key_operands = operands(r, l);
+  }
+  const node_key key(op, key_operands);
+
+  std::map<node_key, node *>::iterator it = _combined.find(key);
+  if (it != _combined.end()) {
+    return it->second;
+  }
+
+  filter *f;
+  std::string label;
+  switch (op) {
+  case op_and:
+    f = new and_filter(l, r);
+    label = "(" + l->name() + " " + symbol + " " + r->name() + ")";
+    break;
+  case op_or:
+    f = new or_filter(l, r);
+    label = "(" + l->name() + " " + symbol + " " + r->name() + ")";
+    break;
+  default:
+    f = new not_filter(l);
+    label = symbol + l->name();
+    break;
+  }
+  _owned.push_back(f);
+
+  node *n = new node(f, label);
+  _nodes.push_back(n);
+  _combined[key] = n;
+  return n;
+}
+
+/// Returns a node that passes when both @c lhs and @c rhs pass
+/**
+ * The arguments can be nodes of this graph or any other filter, which is then
+ * registered using share().
+ */
+const filter_dag::node *filter_dag::make_and(const filter *lhs,
+                                             const filter *rhs)
+{
+  return combine(op_and, lhs, rhs, "&&");
+}
+
+/// Returns a node that passes when at least one of @c lhs and @c rhs passes
+/**
+ * @see make_and()
+ */
+const filter_dag::node *filter_dag::make_or(const filter *lhs,
+                                            const filter *rhs)
+{
+  return combine(op_or, lhs, rhs, "||");
+}
+
+/// Returns a node that passes when @c arg doesn't
+/**
+ * @see make_and()
+ */
+const filter_dag::node *filter_dag::make_not(const filter *arg)
+{
+  return combine(op_not, arg, nullptr, "!");
+}
+
+/// Returns the total number of times nodes were queried
+unsigned long filter_dag::calls() const
+{
+  unsigned long calls = 0;
+  for (unsigned i = 0; i < _nodes.size(); ++i) {
+    calls += _nodes[i]->calls();
+  }
+  return calls;
+}
+
+/// Returns the total number of distinct evaluations
+/**
+ * This is the number of times the underlying filters were actually called,
+ * summed over all nodes.
+ */
+unsigned long filter_dag::evaluations() const
+{
+  unsigned long evaluations = 0;
+  for (unsigned i = 0; i < _nodes.size(); ++i) {
+    evaluations += _nodes[i]->evaluations();
+  }
+  return evaluations;
+}
+
+/// Sets all counters to zero
+void filter_dag::reset_counters()
+{
+  for (unsigned i = 0; i < _nodes.size(); ++i) {
+    _nodes[i]->_calls = 0;
+    _nodes[i]->_evaluations = 0;
+  }
+}
+
+/// Prints call and evaluation counts for every node
+/**
+ * @warning
+ * This function is there for logging purposes; the format of the output
+ * should not be relied on.
+ */
+void filter_dag::print(std::ostream &out) const
+{
+  out << std::setw(12) << "calls" << " "
+      << std::setw(12) << "evaluations" << "  node" << std::endl;
+  for (unsigned i = 0; i < _nodes.size(); ++i) {
+    out << std::setw(12) << _nodes[i]->calls() << " "
+        << std::setw(12) << _nodes[i]->evaluations() << "  "
+        << _nodes[i]->name() << std::endl;
+  }
+  out << std::setw(12) << calls() << " "
+      << std::setw(12) << evaluations() << "  total" << std::endl;
+}
+
+} // namespace calo
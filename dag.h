@@ -0,0 +1,97 @@
+#ifndef CALCLEAN_DAG
+#define CALCLEAN_DAG
+
+/**
+ * @file
+ * @brief  Header for filter graphs with shared subfilters
+ */
+
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <utility>
+
+#include "calofilter.h"
+
+namespace calo {
+
+class filter_dag
+{
+public:
+  class node : public filter
+  {
+    friend class filter_dag;
+
+    const filter *_arg;
+    std::string _name;
+
+    mutable const towerset *_set;
+    mutable unsigned long _generation;
+    mutable unsigned long _epoch;
+    mutable std::vector<unsigned long> _stamps;
+    mutable std::vector<bool> _values;
+
+    mutable unsigned long _calls;
+    mutable unsigned long _evaluations;
+
+    explicit node(const filter *arg, const std::string &name);
+
+  public:
+    bool operator() (const tower_ref &tower) const;
+
+    /// Returns the filter evaluated by this node
+    const filter *arg() const { return _arg; }
+
+    /// Returns a human-readable description of the node
+    const std::string &name() const { return _name; }
+
+    /// Returns how many times the node was queried
+    unsigned long calls() const { return _calls; }
+
+    /// Returns how many times the underlying filter was evaluated
+    unsigned long evaluations() const { return _evaluations; }
+  };
+
+private:
+  enum operation { op_and, op_or, op_not };
+  typedef std::pair<const filter *, const filter *> operands;
+  typedef std::pair<operation, operands> node_key;
+
+  std::vector<node *> _nodes;
+  std::vector<filter *> _owned;
+  std::map<const filter *, node *> _shared;
+  std::map<node_key, node *> _combined;
+
+  const node *combine(operation op,
+                      const filter *lhs,
+                      const filter *rhs,
+                      const char *symbol);
+
+  // Not copyable
+  filter_dag(const filter_dag &);
+  filter_dag &operator= (const filter_dag &);
+
+public:
+  /// Constructs an empty graph
+  explicit filter_dag() {}
+  ~filter_dag();
+
+  const node *share(const filter *f, const std::string &name = "");
+
+  const node *make_and(const filter *lhs, const filter *rhs);
+  const node *make_or(const filter *lhs, const filter *rhs);
+  const node *make_not(const filter *arg);
+
+  /// Returns the number of distinct nodes in the graph
+  int size() const { return _nodes.size(); }
+
+  unsigned long calls() const;
+  unsigned long evaluations() const;
+  void reset_counters();
+
+  void print(std::ostream &out) const;
+};
+
+} // namespace calo
+
+#endif // CALCLEAN_DAG
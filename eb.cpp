@@ -19,8 +19,27 @@ namespace calo {
  * basic is @ref eb_filter "eb", which returns all EB towers. The
  * @ref coldeb_filter "coldeb" filter is designed to remove hot cells; and
  * @ref goodeb_filter "goodeb" defines energy thresholds.
+ *
+ * The default hot cells and thresholds are constant tables, and the instances
+ * @ref eb, @ref coldeb, @ref hoteb and @ref goodeb are shared by the whole
+ * program. None of them allocates memory. When compiled as C++11, they are
+ * initialized before any code runs, so they can safely be used from the
+ * constructors of other global objects.
+ */
+
+/**
+ * @class parameter_table calclean/eb.h
+ * @brief A read-only list of filter parameters.
+ *
+ * A table either refers to a constant array, such as the default parameters of
+ * the EB filters, or owns a copy of a vector given by the user. Only the latter
+ * allocates memory.
+ *
+ * @ingroup EB
  */
 
+const eb_filter eb;
+
 /**
  * @class eb_filter calclean/eb.h
  * @brief Iterate over all EB towers.
@@ -42,7 +61,9 @@ namespace calo {
  * Hot towers are handled by defining logical coordinates for towers as
  * @f$ i_\eta \equiv \left\lfloor \frac{\eta}{0.085} \right\rfloor @f$ and
  * @f$ i_\phi \equiv \left\lfloor \frac{36 \phi}{\pi} \right\rfloor @f$. This
- * corresponds to the groups of 5 by 5 crystals that @c CaloTowers use.
+ * corresponds to the groups of 5 by 5 crystals that @c CaloTowers use. They
+ * are computed once per event and shared with other filters (see
+ * @ref tower_ref::ieta).
  *
  * The filter uses a list of hot cells' logical coordinates to remove them. The
  * default list is:
@@ -75,6 +96,37 @@ namespace calo {
  * @ingroup EB
  */
 
+const int coldeb_filter::default_hotcells_eta[default_hotcells_size] = {
+  -16, -16, -15, -11,
+  -18, -17, -16, -15,
+  -17, -10,
+   -9,   8,
+    2,   0,
+   -6,
+  -18,
+   11,  13,  14,  14,  15,  16
+};
+
+const int coldeb_filter::default_hotcells_phi[default_hotcells_size] = {
+  -36, -35, -35, -35,
+   35,  35,  35,  35,
+  -11,  -7,
+    0,  -8,
+   11,  11,
+   24,
+   31,
+   11,  12,  12,  11,  11,  11
+};
+
+const coldeb_filter coldeb;
+
+namespace {
+  // Used by hoteb to remove cold towers
+  const not_filter notcoldeb(&coldeb);
+}
+
+const and_filter hoteb(&eb, &notcoldeb);
+
 /// Constructs a filter for the given hot cells
 /**
  * The first two arguments are vectors containing the position of hot cells. The
@@ -87,15 +139,15 @@ coldeb_filter::coldeb_filter(const std::vector<int> &hotcells_eta,
   _hotcells_eta(hotcells_eta),
   _hotcells_phi(hotcells_phi)
 {
-  assert(_hotcells_eta.size() == _hotcells_phi.size());
+  assert(hotcells_eta.size() == hotcells_phi.size());
 }
 
 bool coldeb_filter::operator() (const tower_ref &tower) const
 {
   if (tower.iseb()) {
     // Remove hot cells
-    int ieta = std::floor(tower.eta() / 0.085);
-    int iphi = std::floor(tower.phi() / M_PI * 36);
+    int ieta = tower.ieta();
+    int iphi = tower.iphi();
     for (unsigned i = 0; i < _hotcells_eta.size(); ++i) {
       if (ieta == _hotcells_eta[i] && iphi == _hotcells_phi[i]) {
         return false;
@@ -141,6 +193,12 @@ bool coldeb_filter::operator() (const tower_ref &tower) const
  * @ingroup EB
  */
 
+const float goodeb_filter::default_thresholds[default_thresholds_size] = {
+  0.36f, 0.29f, 0.26f, 0.24f, 0.22f
+};
+
+const goodeb_filter goodeb;
+
 /// Constructs a filter with the given thresholds
 /**
  * The first two arguments are vectors containing the position of hot cells; see
@@ -156,18 +214,37 @@ goodeb_filter::goodeb_filter(const std::vector<int> &hotcells_eta,
                              const std::vector<int> &hotcells_phi,
                              const std::vector<float> &thresholds) :
   _cold(hotcells_eta, hotcells_phi),
+  _external_cold(nullptr),
   _thresholds(thresholds)
 {}
 
+/// Constructs a filter with the given thresholds and hot tower filter
+/**
+ * Instead of a list of hot cells, this constructor takes a filter that returns
+ * @c false for hot towers, typically a shared @ref coldeb_filter (see
+ * @ref filter_dag). The filter isn't deleted by @c goodeb_filter.
+ *
+ * See the other constructor for the meaning of @c thresholds.
+ */
+goodeb_filter::goodeb_filter(const filter *cold,
+                             const std::vector<float> &thresholds) :
+  _external_cold(cold),
+  _thresholds(thresholds)
+{
+  assert(cold != nullptr);
+}
+
 bool goodeb_filter::operator() (const tower_ref &tower) const
 {
-  if (tower.iseb() && _cold(tower)) {
+  const filter &cold = _external_cold == nullptr ? _cold : *_external_cold;
+  if (tower.iseb() && CALO_FILTER_CALL(cold, tower)) {
     // Filter energy
     int crystals = tower.ebcount();
     if ((unsigned) crystals < _thresholds.size()) {
       return tower.emenergy() > _thresholds[crystals - 1] * crystals;
     } else {
-      return tower.emenergy() > _thresholds.back() * crystals;
+      const float last = _thresholds[_thresholds.size() - 1];
+      return tower.emenergy() > last * crystals;
     }
   } else {
     return false;
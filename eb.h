@@ -8,15 +8,92 @@
  * @date   2017
  */
 
+#include <algorithm>
+
 #include "calofilter.h"
 #include "logic.h"
 
 namespace calo {
 
+template<class T>
+class parameter_table
+{
+  const T *_data;
+  unsigned _size;
+  T *_owned;
+
+public:
+  /// Refers to a constant table of @c size elements
+  /**
+   * The table isn't copied and must outlive the object.
+   */
+  CALO_CONSTEXPR parameter_table(const T *data, unsigned size) :
+    _data(data), _size(size), _owned(nullptr) {}
+
+  inline explicit parameter_table(const std::vector<T> &values);
+  inline parameter_table(const parameter_table &other);
+
+  /// Destructor
+  ~parameter_table() { delete[] _owned; }
+
+  inline parameter_table &operator= (const parameter_table &other);
+
+  /// Returns the number of elements
+  unsigned size() const { return _size; }
+
+  /// Returns element @c i
+  const T &operator[] (unsigned i) const { return _data[i]; }
+
+  /// Returns a copy of the elements
+  std::vector<T> values() const { return std::vector<T>(_data, _data + _size); }
+};
+
+/// Constructs a table holding a copy of @c values
+template<class T>
+parameter_table<T>::parameter_table(const std::vector<T> &values) :
+  _data(nullptr),
+  _size(values.size()),
+  _owned(nullptr)
+{
+  if (_size > 0) {
+    _owned = new T[_size];
+    std::copy(values.begin(), values.end(), _owned);
+    _data = _owned;
+  }
+}
+
+/// Copy constructor
+/**
+ * Constant tables are shared, copies of vectors are copied again.
+ */
+template<class T>
+parameter_table<T>::parameter_table(const parameter_table &other) :
+  _data(other._data),
+  _size(other._size),
+  _owned(nullptr)
+{
+  if (other._owned != nullptr) {
+    _owned = new T[_size];
+    std::copy(other._data, other._data + _size, _owned);
+    _data = _owned;
+  }
+}
+
+/// Assignment operator
+template<class T>
+parameter_table<T> &parameter_table<T>::operator= (const parameter_table &other)
+{
+  parameter_table copy(other);
+  std::swap(_data, copy._data);
+  std::swap(_size, copy._size);
+  std::swap(_owned, copy._owned);
+  return *this;
+}
+
 class eb_filter : public filter
 {
 public:
-  eb_filter() {}
+  CALO_CONSTEXPR eb_filter() {}
 
   bool operator() (const tower_ref &tower) const { return tower.iseb(); }
 };
@@ -25,60 +102,48 @@ public:
 /**
  * @relates eb_filter
  */
-const eb_filter eb;
+extern const eb_filter eb;
 
 class coldeb_filter : public filter
 {
-  std::vector<int> _hotcells_eta;
-  std::vector<int> _hotcells_phi;
 public:
-  explicit inline coldeb_filter();
-  explicit coldeb_filter(const std::vector<int> &hotcells_eta,
-                         const std::vector<int> &hotcells_phi);
+  /// The number of cells in the default hot cells list
+  static const unsigned default_hotcells_size = 22;
 
-  bool operator() (const tower_ref &tower) const;
-};
+  /// The @f$ i_\eta @f$ coordinates of the default hot cells
+  static const int default_hotcells_eta[default_hotcells_size];
 
-// Needs to be before declaring the static goodeb because of Cint
-/// Constructs a filter with the default hot towers list.
-coldeb_filter::coldeb_filter()
-{
-  _hotcells_eta.push_back(-16); _hotcells_phi.push_back(-36);
-  _hotcells_eta.push_back(-16); _hotcells_phi.push_back(-35);
-  _hotcells_eta.push_back(-15); _hotcells_phi.push_back(-35);
-  _hotcells_eta.push_back(-11); _hotcells_phi.push_back(-35);
+  /// The @f$ i_\phi @f$ coordinates of the default hot cells
+  static const int default_hotcells_phi[default_hotcells_size];
 
-  _hotcells_eta.push_back(-18); _hotcells_phi.push_back( 35);
-  _hotcells_eta.push_back(-17); _hotcells_phi.push_back( 35);
-  _hotcells_eta.push_back(-16); _hotcells_phi.push_back( 35);
-  _hotcells_eta.push_back(-15); _hotcells_phi.push_back( 35);
+private:
+  parameter_table<int> _hotcells_eta;
+  parameter_table<int> _hotcells_phi;
 
-  _hotcells_eta.push_back(-17); _hotcells_phi.push_back(-11);
-  _hotcells_eta.push_back(-10); _hotcells_phi.push_back( -7);
-
-  _hotcells_eta.push_back( -9); _hotcells_phi.push_back(  0);
-  _hotcells_eta.push_back(  8); _hotcells_phi.push_back( -8);
+public:
+  /// Constructs a filter with the default hot cells list.
+  CALO_CONSTEXPR coldeb_filter() :
+    _hotcells_eta(default_hotcells_eta, default_hotcells_size),
+    _hotcells_phi(default_hotcells_phi, default_hotcells_size)
+  {}
 
-  _hotcells_eta.push_back(  2); _hotcells_phi.push_back( 11);
-  _hotcells_eta.push_back(  0); _hotcells_phi.push_back( 11);
+  explicit coldeb_filter(const std::vector<int> &hotcells_eta,
+                         const std::vector<int> &hotcells_phi);
 
-  _hotcells_eta.push_back( -6); _hotcells_phi.push_back( 24);
+  /// Returns the @f$ i_\eta @f$ coordinates of the hot cells
+  std::vector<int> hotcells_eta() const { return _hotcells_eta.values(); }
 
-  _hotcells_eta.push_back(-18); _hotcells_phi.push_back( 31);
+  /// Returns the @f$ i_\phi @f$ coordinates of the hot cells
+  std::vector<int> hotcells_phi() const { return _hotcells_phi.values(); }
 
-  _hotcells_eta.push_back( 11); _hotcells_phi.push_back( 11);
-  _hotcells_eta.push_back( 13); _hotcells_phi.push_back( 12);
-  _hotcells_eta.push_back( 14); _hotcells_phi.push_back( 12);
-  _hotcells_eta.push_back( 14); _hotcells_phi.push_back( 11);
-  _hotcells_eta.push_back( 15); _hotcells_phi.push_back( 11);
-  _hotcells_eta.push_back( 16); _hotcells_phi.push_back( 11);
-}
+  bool operator() (const tower_ref &tower) const;
+};
 
 /// An instance of @ref coldeb_filter using the default parameters.
 /**
  * @relates coldeb_filter
  */
-static const coldeb_filter coldeb;
+extern const coldeb_filter coldeb;
 
 /// A filter for hot towers.
 /**
@@ -86,37 +151,49 @@ static const coldeb_filter coldeb;
  *
  * @relates coldeb_filter
  */
-static const and_filter hoteb = and_filter(&eb, new not_filter(&coldeb));
+extern const and_filter hoteb;
 
 class goodeb_filter : public filter
 {
+public:
+  /// The number of default thresholds
+  static const unsigned default_thresholds_size = 5;
+
+  /// The default thresholds, in GeV per crystal
+  static const float default_thresholds[default_thresholds_size];
+
+private:
   coldeb_filter _cold;
-  std::vector<float> _thresholds;
+  const filter *_external_cold;
+  parameter_table<float> _thresholds;
+
 public:
-  explicit inline goodeb_filter();
+  /// Constructs a filter with default parameters
+  /**
+   * If @c cold is given, it is used instead of the default @ref coldeb_filter
+   * to remove hot towers. This allows sharing its result with other filters,
+   * see @ref filter_dag.
+   */
+  explicit CALO_CONSTEXPR goodeb_filter(const filter *cold = nullptr) :
+    _cold(),
+    _external_cold(cold),
+    _thresholds(default_thresholds, default_thresholds_size)
+  {}
+
   explicit goodeb_filter(const std::vector<int> &hotcells_eta,
                          const std::vector<int> &hotcells_phi,
                          const std::vector<float> &thresholds);
+  explicit goodeb_filter(const filter *cold,
+                         const std::vector<float> &thresholds);
 
   bool operator() (const tower_ref &tower) const;
 };
 
-// Needs to be before declaring the static goodeb because of Cint
-/// Constructs a filter with default parameters
-goodeb_filter::goodeb_filter()
-{
-  _thresholds.push_back(0.36);
-  _thresholds.push_back(0.29);
-  _thresholds.push_back(0.26);
-  _thresholds.push_back(0.24);
-  _thresholds.push_back(0.22);
-}
-
 /// An instance of @ref goodeb_filter using the default parameters.
 /**
  * @relates goodeb_filter
  */
-static const goodeb_filter goodeb;
+extern const goodeb_filter goodeb;
 
 } // namespace calo
 
@@ -0,0 +1,278 @@
+#include "eventfilter.h"
+
+/**
+ * @file
+ * @brief  Source for event-level filters
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "trace.h"
+
+namespace calo {
+
+/**
+ * @defgroup event_filters Event filters
+ * @brief Filters selecting whole events
+ *
+ * A @ref filter decides whether a single tower is kept. Event selections, such
+ * as "no good EB tower and less than 50 GeV in the HF", are made with
+ * @ref event_filter "event filters" instead. They are built from a few simple
+ * cuts combined with logical operations:
+ *
+ * ~~~~{.cpp}
+ * count_event_filter no_good_eb(&goodeb, 0, 0);
+ * sum_event_filter low_hf(&event_summary::hf, 0, 50);
+ * and_event_filter quiet(&no_good_eb, &low_hf);
+ *
+ * towerset set(file);
+ * set.set_event_filter(&quiet);
+ * for (unsigned long i = 0; i < set.entries(); ++i) {
+ *   if (!set.getentry(i)) {
+ *     continue; // Rejected
+ *   }
+ *   // ...
+ * }
+ * ~~~~
+ *
+ * An event filter is evaluated once per event, by @ref towerset::getentry or
+ * by an @ref event_loop, which skips rejected events before calling its task.
+ * Filters receive an @ref event_context, which computes the masks and
+ * @ref event_summary "summaries" of tower filters on first use and caches
+ * them: all cuts using @ref goodeb above share a single pass over the towers.
+ *
+ * @warning Classes in this module don't delete their arguments.
+ */
+
+/**
+ * @class event_context calclean/eventfilter.h
+ * @brief An event seen by event filters, with cached per-event results.
+ *
+ * The results of tower filters are computed the first time they are requested
+ * and kept until the set loads another event (see @ref towerset::generation).
+ * The memory used by the cache is then reused for the next event, so a context
+ * is meant to be kept for the whole loop: every @ref towerset has one, which is
+ * what @ref event_filter::accept uses.
+ *
+ * @ingroup event_filters
+ */
+
+// Forgets the results of the previous event when the set has loaded another.
+void event_context::refresh() const
+{
+  if (_set->generation() != _generation) {
+    _generation = _set->generation();
+    _used = 0;
+  }
+}
+
+// Returns an unused cache entry for f, reusing the memory of a previous event
+// if possible.
+event_context::cached &event_context::add(const filter *f) const
+{
+  if (_used == _cache.size()) {
+    _cache.push_back(cached());
+  }
+  cached &entry = _cache[_used++];
+  entry.f = f;
+  entry.has_summary = false;
+  return entry;
+}
+
+// Returns the cache entry of f, evaluating the filter if needed.
+event_context::cached &event_context::lookup(const filter *f) const
+{
+  refresh();
+  for (unsigned c = 0; c < _used; ++c) {
+    if (_cache[c].f == f) {
+      return _cache[c];
+    }
+  }
+
+  cached &entry = add(f);
+
+  const int size = _set->size();
+  const trace::scope traced("event_context::mask", "filter", "towers", size);
+  entry.mask.reset(size);
+  const filter &pass = *f;
+  for (int begin = 0; begin < size; begin += tower_mask::word_bits) {
+    const int end = std::min(size, begin + tower_mask::word_bits);
+    tower_mask::word_type bits = 0;
+    for (int i = begin; i < end; ++i) {
+      if (CALO_FILTER_CALL(pass, tower_ref(_set, i))) {
+        bits |= tower_mask::word_type(1) << (i - begin);
+      }
+    }
+    entry.mask.set_word(begin / tower_mask::word_bits, bits);
+  }
+  return entry;
+}
+
+/// Returns the towers passing a filter
+/**
+ * The filter is evaluated on all towers the first time its mask is requested.
+ * It is identified by its address: the same object must be used to benefit
+ * from the cache.
+ */
+const tower_mask &event_context::mask(const filter *f) const
+{
+  assert(f != nullptr);
+  return lookup(f).mask;
+}
+
+/// Returns the number of towers passing a filter
+/**
+ * If @c f is @c null, returns the number of towers in the event.
+ */
+int event_context::count(const filter *f) const
+{
+  return f == nullptr ? _set->size() : lookup(f).mask.count();
+}
+
+/// Returns the energy sums of the towers passing a filter
+/**
+ * If @c f is @c null, all towers are summed. The summary is computed on first
+ * use, from the cached mask of the filter.
+ */
+const event_summary &event_context::summary(const filter *f) const
+{
+  if (f == nullptr) {
+    // Stored under the null key, without a mask
+    refresh();
+    for (unsigned c = 0; c < _used; ++c) {
+      if (_cache[c].f == nullptr) {
+        return _cache[c].summary;
+      }
+    }
+    cached &entry = add(nullptr);
+    entry.has_summary = true;
+    entry.summary = event_summary(*_set);
+    return entry.summary;
+  }
+
+  cached &entry = lookup(f);
+  if (!entry.has_summary) {
+    entry.summary = event_summary(*_set, entry.mask);
+    entry.has_summary = true;
+  }
+  return entry.summary;
+}
+
+/**
+ * @class event_filter calclean/eventfilter.h
+ * @brief Base class for filters selecting whole events.
+ *
+ * Event filters derive from this class and implement @c operator(), which
+ * receives an @ref event_context:
+ *
+ * ~~~~{.cpp}
+ * class isolated_hf : public event_filter
+ * {
+ * public:
+ *   bool operator() (const event_context &event) const
+ *   {
+ *     const event_summary &sum = event.summary(&goodeb);
+ *     return sum.hf_plus > 10 && sum.hf_minus > 10 && sum.eb < 1;
+ *   }
+ * };
+ * ~~~~
+ *
+ * Results that are requested from the context are computed once per event,
+ * even when several filters use them.
+ *
+ * @ingroup event_filters
+ */
+
+/**
+ * @class count_event_filter calclean/eventfilter.h
+ * @brief Selects events by their number of towers passing a filter.
+ *
+ * With a @c null filter, all towers are counted, which cuts on the size of the
+ * event.
+ *
+ * @ingroup event_filters
+ */
+
+/// Constructs a filter accepting events with @c min to @c max towers passing
+/// @c f (included)
+count_event_filter::count_event_filter(const filter *f, int min, int max) :
+  _filter(f),
+  _min(min),
+  _max(max)
+{}
+
+/// Returns @c true if the number of towers is in range
+bool count_event_filter::operator() (const event_context &event) const
+{
+  const int count = event.count(_filter);
+  return count >= _min && count <= _max;
+}
+
+/**
+ * @class sum_event_filter calclean/eventfilter.h
+ * @brief Selects events by an energy sum.
+ *
+ * The sum is one of the members of @ref event_summary, computed for the towers
+ * that pass a filter (all towers if it is @c null):
+ *
+ * ~~~~{.cpp}
+ * sum_event_filter low_hf(&event_summary::hf, 0, 50);
+ * sum_event_filter eb_et(&event_summary::et, 20, HUGE_VAL, &goodeb);
+ * ~~~~
+ *
+ * @ingroup event_filters
+ */
+
+/// Constructs a filter accepting events with a sum in [@c min, @c max]
+sum_event_filter::sum_event_filter(double event_summary::*quantity,
+                                   double min,
+                                   double max,
+                                   const filter *f) :
+  _quantity(quantity),
+  _filter(f),
+  _min(min),
+  _max(max)
+{
+  if (quantity == nullptr) {
+    throw std::invalid_argument("sum_event_filter: quantity is null");
+  }
+}
+
+/// Returns @c true if the sum is in range
+bool sum_event_filter::operator() (const event_context &event) const
+{
+  const double sum = event.summary(_filter).*_quantity;
+  return sum >= _min && sum <= _max;
+}
+
+/**
+ * @class column_event_filter calclean/eventfilter.h
+ * @brief Selects events by the value of an event-level column.
+ *
+ * Event-level columns are read from companion trees, see
+ * @ref towerset::add_event_column:
+ *
+ * ~~~~{.cpp}
+ * const int vz = set.add_event_column(events, "vz");
+ * column_event_filter centered(vz, -15, 15);
+ * ~~~~
+ *
+ * @ingroup event_filters
+ */
+
+/// Constructs a filter accepting events where @c column is in [@c min, @c max]
+column_event_filter::column_event_filter(int column, double min, double max) :
+  _column(column),
+  _min(min),
+  _max(max)
+{}
+
+/// Returns @c true if the value is in range
+bool column_event_filter::operator() (const event_context &event) const
+{
+  const double value = event.value(_column);
+  return value >= _min && value <= _max;
+}
+
+} // namespace calo
@@ -0,0 +1,196 @@
+#ifndef CALCLEAN_EVENTFILTER
+#define CALCLEAN_EVENTFILTER
+
+/**
+ * @file
+ * @brief  Header for event-level filters
+ */
+
+#include <deque>
+
+#include "calofilter.h"
+#include "summary.h"
+
+namespace calo {
+
+class event_context
+{
+  // Results cached for one tower filter
+  struct cached
+  {
+    const filter *f;
+    tower_mask mask;
+    bool has_summary;
+    event_summary summary;
+  };
+
+  const towerset *_set;
+  mutable unsigned long _generation; // Of the event in the cache
+  mutable std::deque<cached> _cache; // References stay valid
+  mutable unsigned _used;            // Entries holding results of the event
+
+  void refresh() const;
+  cached &add(const filter *f) const;
+  cached &lookup(const filter *f) const;
+
+  // Not copyable
+  event_context(const event_context &);
+  event_context &operator= (const event_context &);
+
+public:
+  /// Constructs a context for the events of @c set
+  explicit event_context(const towerset &set) :
+    _set(&set), _generation(set.generation()), _used(0) {}
+
+  /// Returns the set holding the event
+  const towerset &set() const { return *_set; }
+
+  /// Returns the number of towers in the event
+  int size() const { return _set->size(); }
+
+  /// Returns the value of an event-level column
+  /**
+   * An exception is thrown if there is no such column (@c std::out_of_range).
+   *
+   * @see towerset::add_event_column
+   */
+  double value(int column) const { return _set->event_value(column); }
+
+  const tower_mask &mask(const filter *f) const;
+  int count(const filter *f) const;
+  const event_summary &summary(const filter *f = nullptr) const;
+};
+
+class event_filter
+{
+public:
+  /// Destructor
+  virtual ~event_filter() {}
+
+  /// Returns @c true if the event passes the filter
+  virtual bool operator() (const event_context &event) const = 0;
+
+  inline bool accept(const towerset &set) const;
+};
+
+/// Evaluates the filter on the current event of @c set
+/**
+ * This is what @ref towerset::getentry does. Results are cached in the
+ * @ref towerset::context of the set. Defined inline so that
+ * @c calofilter.cpp can be used on its own.
+ */
+bool event_filter::accept(const towerset &set) const
+{
+  return (*this)(set.context());
+}
+
+/// An event filter that implements a logical AND between two event filters
+/**
+ * @c rhs isn't evaluated when @c lhs rejects the event.
+ *
+ * @warning This class doesn't delete its arguments upon destruction.
+ * @ingroup event_filters
+ */
+class and_event_filter : public event_filter
+{
+  const event_filter *_lhs;
+  const event_filter *_rhs;
+public:
+  /// Creates a filter that returns @c true when both @c lhs and @c rhs are
+  /// @c true
+  CALO_CONSTEXPR and_event_filter(const event_filter *lhs,
+                                  const event_filter *rhs) :
+    _lhs(lhs), _rhs(rhs) {}
+
+  /// Returns <tt>lhs(event) && rhs(event)</tt>
+  bool operator() (const event_context &event) const
+  {
+    return (*_lhs)(event) && (*_rhs)(event);
+  }
+};
+
+/// An event filter that implements a logical OR between two event filters
+/**
+ * @c rhs isn't evaluated when @c lhs accepts the event.
+ *
+ * @warning This class doesn't delete its arguments upon destruction.
+ * @ingroup event_filters
+ */
+class or_event_filter : public event_filter
+{
+  const event_filter *_lhs;
+  const event_filter *_rhs;
+public:
+  /// Creates a filter that returns @c true when at least one of @c lhs and
+  /// @c rhs is @c true
+  CALO_CONSTEXPR or_event_filter(const event_filter *lhs,
+                                 const event_filter *rhs) :
+    _lhs(lhs), _rhs(rhs) {}
+
+  /// Returns <tt>lhs(event) || rhs(event)</tt>
+  bool operator() (const event_context &event) const
+  {
+    return (*_lhs)(event) || (*_rhs)(event);
+  }
+};
+
+/// An event filter that negates another (logical NOT)
+/**
+ * @warning This class doesn't delete its argument upon destruction.
+ * @ingroup event_filters
+ */
+class not_event_filter : public event_filter
+{
+  const event_filter *_arg;
+public:
+  /// Creates a filter that returns @c true when @c arg is @c false
+  explicit CALO_CONSTEXPR not_event_filter(const event_filter *arg) :
+    _arg(arg) {}
+
+  /// Returns <tt>!arg(event)</tt>
+  bool operator() (const event_context &event) const
+  {
+    return !(*_arg)(event);
+  }
+};
+
+class count_event_filter : public event_filter
+{
+  const filter *_filter;
+  int _min;
+  int _max;
+public:
+  explicit count_event_filter(const filter *f, int min, int max = INT_MAX);
+
+  bool operator() (const event_context &event) const;
+};
+
+class sum_event_filter : public event_filter
+{
+  double event_summary::*_quantity;
+  const filter *_filter;
+  double _min;
+  double _max;
+public:
+  explicit sum_event_filter(double event_summary::*quantity,
+                            double min,
+                            double max,
+                            const filter *f = nullptr);
+
+  bool operator() (const event_context &event) const;
+};
+
+class column_event_filter : public event_filter
+{
+  int _column;
+  double _min;
+  double _max;
+public:
+  explicit column_event_filter(int column, double min, double max);
+
+  bool operator() (const event_context &event) const;
+};
+
+} // namespace calo
+
+#endif // CALCLEAN_EVENTFILTER
@@ -0,0 +1,109 @@
+#include "eventlist.h"
+
+/**
+ * @file
+ * @brief  Source for event lists
+ */
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+namespace calo {
+
+/**
+ * @class event_list calclean/eventlist.h
+ * @brief A sorted set of entries, for analyses that read a tree twice.
+ *
+ * A common workflow is to find interesting events in a first pass, then to
+ * study them in detail in a second one. An @c event_list records the entries
+ * selected by the first pass:
+ *
+ * ~~~~{.cpp}
+ * event_list hot = event_list::select(set, has_tower(&hoteb));
+ * std::ofstream out("hot.txt");
+ * hot.write(out);
+ * ~~~~
+ *
+ * In the second pass, entries are read in increasing order, and the tree
+ * cache is told to prefetch only the clusters that contain selected entries:
+ *
+ * ~~~~{.cpp}
+ * set.prefetch(&hot);
+ * for (event_list::iterator it = hot.begin(); it != hot.end(); ++it) {
+ *   set.getentry(*it);
+ *   // ...
+ * }
+ * ~~~~
+ *
+ * Selected entries tend to come in groups (runs with a noisy channel, ...),
+ * so they are stored as runs of consecutive entries: a list takes
+ * 16 bytes per run on 64-bit systems, however many entries the runs contain.
+ *
+ * Lists are written to disk in a small text format: a header line, the number
+ * of runs, then the first entry and the length of every run on its own line.
+ */
+
+/// Adds an entry to the list
+/**
+ * Entries must be added in increasing order, else an exception is thrown
+ * (@c std::invalid_argument).
+ */
+void event_list::add(unsigned long entry)
+{
+  if (!_end.empty() && entry < _end.back()) {
+    throw std::invalid_argument("event_list::add: entries must be added in "
+                                "increasing order");
+  }
+  if (!_end.empty() && entry == _end.back()) {
+    ++_end.back();
+  } else {
+    _first.push_back(entry);
+    _end.push_back(entry + 1);
+  }
+  ++_size;
+}
+
+/// Writes the list to a stream
+/**
+ * @see read()
+ */
+void event_list::write(std::ostream &out) const
+{
+  out << "calclean-event-list 1\n" << _first.size() << "\n";
+  for (unsigned long i = 0; i < _first.size(); ++i) {
+    out << _first[i] << " " << _end[i] - _first[i] << "\n";
+  }
+}
+
+/// Reads a list written by write()
+/**
+ * An exception is thrown if the stream doesn't contain a valid list
+ * (@c std::runtime_error).
+ */
+event_list event_list::read(std::istream &in)
+{
+  std::string magic;
+  int version = 0;
+  unsigned long runs = 0;
+  in >> magic >> version >> runs;
+  if (!in || magic != "calclean-event-list" || version != 1) {
+    throw std::runtime_error("event_list::read: not an event list");
+  }
+
+  event_list list;
+  for (unsigned long i = 0; i < runs; ++i) {
+    unsigned long first, length;
+    in >> first >> length;
+    if (!in || length == 0
+        || (!list._end.empty() && first <= list._end.back())) {
+      throw std::runtime_error("event_list::read: invalid run");
+    }
+    list._first.push_back(first);
+    list._end.push_back(first + length);
+    list._size += length;
+  }
+  return list;
+}
+
+} // namespace calo
@@ -0,0 +1,169 @@
+#ifndef CALCLEAN_EVENTLIST
+#define CALCLEAN_EVENTLIST
+
+/**
+ * @file
+ * @brief  Header for event lists
+ */
+
+#include <algorithm>
+#include <iosfwd>
+
+#include "calofilter.h"
+
+namespace calo {
+
+class event_list
+{
+  // Selected entries are stored as runs [_first[i], _end[i])
+  std::vector<unsigned long> _first;
+  std::vector<unsigned long> _end;
+  unsigned long _size;
+
+public:
+  /// Iterator over the entries in an @ref event_list, in increasing order
+  class iterator
+  {
+    friend class event_list;
+
+    const event_list *_list;
+    unsigned long _run;
+    unsigned long _entry;
+
+    iterator(const event_list *list, unsigned long run, unsigned long entry) :
+      _list(list), _run(run), _entry(entry) {}
+
+  public:
+    /// Returns the current entry
+    unsigned long operator* () const { return _entry; }
+
+    /// Moves to the next entry
+    iterator &operator++ ()
+    {
+      if (++_entry == _list->_end[_run]) {
+        ++_run;
+        _entry = _run < _list->_first.size() ? _list->_first[_run] : 0;
+      }
+      return *this;
+    }
+
+    /// Compares two iterators for equality
+    bool operator== (const iterator &other) const
+    {
+      return _run == other._run && _entry == other._entry;
+    }
+
+    /// Compares two iterators for inequality
+    bool operator!= (const iterator &other) const { return !(*this == other); }
+  };
+
+  /// Constructs an empty list
+  explicit event_list() : _size(0) {}
+
+  void add(unsigned long entry);
+
+  /// Returns the number of entries in the list
+  unsigned long size() const { return _size; }
+
+  /// Returns @c true if the list has no entries
+  bool empty() const { return _size == 0; }
+
+  /// Returns the number of runs of consecutive entries
+  unsigned long runs() const { return _first.size(); }
+
+  inline bool contains(unsigned long entry) const;
+  inline unsigned long next(unsigned long entry) const;
+
+  /// Returns an iterator to the first entry
+  iterator begin() const
+  {
+    return iterator(this, 0, _first.empty() ? 0 : _first.front());
+  }
+
+  /// Returns a past-the-end iterator
+  iterator end() const { return iterator(this, _first.size(), 0); }
+
+  template<class Predicate>
+  static event_list select(towerset &set,
+                           Predicate predicate,
+                           unsigned long first = 0,
+                           unsigned long count = ULONG_MAX);
+
+  void write(std::ostream &out) const;
+  static event_list read(std::istream &in);
+};
+
+/// An event predicate: selects events with at least one tower passing a filter
+/**
+ * @see event_list::select
+ */
+class has_tower
+{
+  const filter *_filter;
+public:
+  /// Constructs a predicate using filter @c f
+  explicit has_tower(const filter *f) : _filter(f) {}
+
+  /// Returns @c true if a tower of @c set passes the filter
+  bool operator() (const towerset &set) const
+  {
+    return set.begin(_filter) != set.end();
+  }
+};
+
+/// Returns @c true if @c entry is in the list
+bool event_list::contains(unsigned long entry) const
+{
+  return next(entry) == entry;
+}
+
+/// Returns the first entry in the list that is not smaller than @c entry
+/**
+ * If there is none, @c ULONG_MAX is returned.
+ */
+unsigned long event_list::next(unsigned long entry) const
+{
+  // First run that ends after entry
+  const std::vector<unsigned long>::const_iterator it =
+    std::upper_bound(_end.begin(), _end.end(), entry);
+  if (it == _end.end()) {
+    return ULONG_MAX;
+  }
+  return std::max(entry, _first[it - _end.begin()]);
+}
+
+/// Builds the list of entries for which @c predicate returns @c true
+/**
+ * Entries @c first to <tt>first + count - 1</tt> of @c set are read, stopping
+ * at the end of the tree. @c predicate is called as
+ * <tt>predicate(const towerset &set)</tt> after every entry is loaded;
+ * entries rejected by the @ref event_filter of the set are skipped. For
+ * instance, to select all events with a hot tower:
+ *
+ * ~~~~{.cpp}
+ * event_list hot = event_list::select(set, has_tower(&hoteb));
+ * ~~~~
+ */
+template<class Predicate>
+event_list event_list::select(towerset &set,
+                              Predicate predicate,
+                              unsigned long first,
+                              unsigned long count)
+{
+  event_list list;
+  const unsigned long entries = set.entries();
+  const unsigned long last = first < entries
+                           ? first + std::min(count, entries - first)
+                           : first;
+  for (unsigned long entry = first; entry < last; ++entry) {
+    if (set.getentry(entry)
+        && predicate(const_cast<const towerset &>(set))) {
+      list.add(entry);
+    }
+  }
+  return list;
+}
+
+} // namespace calo
+
+#endif // CALCLEAN_EVENTLIST
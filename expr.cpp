@@ -0,0 +1,799 @@
+#include "expr.h"
+
+/**
+ * @file
+ * @brief  Source for filters defined by text expressions
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+
+#include "eb.h"
+
+#ifdef __GNUC__
+# define CALO_RESTRICT __restrict
+#else
+# define CALO_RESTRICT
+#endif
+
+namespace calo {
+
+/**
+ * @class expression_filter calclean/expr.h
+ * @brief A filter defined by a text expression.
+ *
+ * Instead of writing a new filter class for every selection, one can describe
+ * it with an expression similar to C++:
+ *
+ * ~~~~{.cpp}
+ * expression_filter f("eb && !coldeb && emenergy / ebcount > 0.3"
+ *                     " && abs(eta) < 1.2");
+ * ~~~~
+ *
+ * The expression is compiled once, when the filter is constructed, and can then
+ * be used as any other filter. Expressions can come from configuration files,
+ * so changing a selection doesn't need a recompilation.
+ *
+ * ### Syntax
+ *
+ * Expressions are made of the following elements, listed by increasing
+ * precedence:
+ *
+ * Elements                           | Meaning
+ * :----------------------------------|:----------------------------------------
+ * <tt>a || b</tt>                    | Logical OR
+ * <tt>a && b</tt>                    | Logical AND
+ * <tt>< <= > >= == !=</tt>           | Comparisons
+ * <tt>a + b</tt>, <tt>a - b</tt>     | Addition and subtraction
+ * <tt>a * b</tt>, <tt>a / b</tt>     | Multiplication and division
+ * <tt>!a</tt>, <tt>-a</tt>           | Logical NOT and negation
+ * <tt>abs(a)</tt>, <tt>sqrt(a)</tt>  | Functions
+ * <tt>(a)</tt>                       | Grouping
+ *
+ * Values are floating-point numbers; logical operations treat non-zero values
+ * as @c true and return 0 or 1. A tower passes the filter if the expression
+ * evaluates to a non-zero value.
+ *
+ * The following names can be used:
+ *
+ *   - The tower properties <tt>eta phi ieta iphi ebcount eecount hbcount
+ *     hecount hfcount emenergy hadenergy totalenergy</tt> (see @ref tower);
+ *   - The predicates <tt>iseb isee ishb ishe ishf</tt>;
+ *   - Named filters, which evaluate to 1 when the tower passes them. By
+ *     default, @ref eb, @ref coldeb, @ref goodeb and @ref hoteb are available
+ *     (see default_filters()). Other filters can be made available by passing
+ *     a @ref filter_table to the constructor.
+ *
+ * Errors are reported by throwing an @ref expression_error whose message
+ * points at the offending token.
+ *
+ * ### Evaluation
+ *
+ * Expressions are compiled to a compact bytecode for a stack machine. When
+ * used through select(), the machine processes towers in batches of
+ * @ref batch: every instruction runs a tight loop over the batch, reading
+ * whole columns of the @ref towerset (see @ref towerset::columns). This
+ * amortizes the cost of interpreting the bytecode and lets the compiler
+ * vectorize the arithmetic, comparisons and logical operators.
+ *
+ * Named filters are only called for towers where the result of the enclosing
+ * <tt>&&</tt> and <tt>||</tt> operators isn't decided yet, so placing cheap
+ * conditions first is as effective as in C++. Arithmetic and comparisons,
+ * on the other hand, are computed for every tower of the batch and masked
+ * afterwards. An expression that a hand-written filter would short-circuit
+ * early is thus slower: in the <tt>expression</tt> benchmark of
+ * <tt>calobench</tt>, where about a quarter of the towers are in the barrel,
+ * select() runs at about 70% of the speed of the equivalent C++ filter.
+ * Named filters are also called through a virtual function for each tower.
+ *
+ * @warning The work space of the machine is stored inside the filter, so the
+ *          same filter must not be used from several threads at the same time.
+ */
+
+namespace {
+  // Operation codes
+  enum opcode {
+    op_const,       // Push a constant
+    op_load,        // Push a tower property
+    op_filter,      // Push the result of a named filter
+    op_neg,
+    op_not,
+    op_abs,
+    op_sqrt,
+    op_add,
+    op_sub,
+    op_mul,
+    op_div,
+    op_lt,
+    op_le,
+    op_gt,
+    op_ge,
+    op_eq,
+    op_ne,
+    op_and,
+    op_or,
+    op_narrow_and,  // Restrict active towers to those where the top is true
+    op_narrow_or,   // Restrict active towers to those where the top is false
+    op_widen        // Undo the last restriction
+  };
+
+  const char *const opcode_names[] = {
+    "const", "load", "filter", "neg", "not", "abs", "sqrt", "add", "sub",
+    "mul", "div", "lt", "le", "gt", "ge", "eq", "ne", "and", "or",
+    "narrow_and", "narrow_or", "widen"
+  };
+
+  // Tower properties
+  enum field {
+    f_eta,
+    f_phi,
+    f_ieta,
+    f_iphi,
+    f_ebcount,
+    f_eecount,
+    f_hbcount,
+    f_hecount,
+    f_hfcount,
+    f_emenergy,
+    f_hadenergy,
+    f_totalenergy,
+    f_count
+  };
+
+  const char *const field_names[f_count] = {
+    "eta", "phi", "ieta", "iphi", "ebcount", "eecount", "hbcount", "hecount",
+    "hfcount", "emenergy", "hadenergy", "totalenergy"
+  };
+
+  // Predicates, defined as field > 0
+  struct predicate
+  {
+    const char *name;
+    field count;
+  };
+
+  const predicate predicates[] = {
+    { "iseb", f_ebcount },
+    { "isee", f_eecount },
+    { "ishb", f_hbcount },
+    { "ishe", f_hecount },
+    { "ishf", f_hfcount }
+  };
+
+  const int predicate_count = sizeof(predicates) / sizeof(predicates[0]);
+
+  // A token of the expression language
+  struct token
+  {
+    enum kind_type { identifier, number, symbol, end };
+
+    kind_type kind;
+    std::string text;
+    double value;
+    int position;
+  };
+
+  // Builds an error message pointing at the given position.
+  expression_error make_error(const std::string &source,
+                              int position,
+                              const std::string &what)
+  {
+    std::string msg = "expression_filter: " + what + "\n  " + source + "\n  ";
+    msg += std::string(position, ' ') + "^";
+    return expression_error(msg, position);
+  }
+
+  // Splits the source into tokens.
+  std::vector<token> tokenize(const std::string &source)
+  {
+    static const char *const symbols[] = {
+      "&&", "||", "<=", ">=", "==", "!=",
+      "<", ">", "!", "+", "-", "*", "/", "(", ")"
+    };
+    static const int symbol_count = sizeof(symbols) / sizeof(symbols[0]);
+
+    std::vector<token> tokens;
+    unsigned i = 0;
+    while (i < source.size()) {
+      const char c = source[i];
+      token t;
+      t.position = i;
+      t.value = 0;
+
+      if (std::isspace((unsigned char) c)) {
+        ++i;
+        continue;
+      } else if (std::isalpha((unsigned char) c) || c == '_') {
+        t.kind = token::identifier;
+        while (i < source.size()
+               && (std::isalnum((unsigned char) source[i])
+                   || source[i] == '_')) {
+          t.text += source[i++];
+        }
+      } else if (std::isdigit((unsigned char) c) || c == '.') {
+        t.kind = token::number;
+        const char *begin = source.c_str() + i;
+        char *end;
+        t.value = std::strtod(begin, &end);
+        if (end == begin) {
+          throw make_error(source, i, "invalid number");
+        }
+        t.text = source.substr(i, end - begin);
+        i += end - begin;
+      } else {
+        t.kind = token::symbol;
+        for (int s = 0; s < symbol_count; ++s) {
+          if (source.compare(i, std::strlen(symbols[s]), symbols[s]) == 0) {
+            t.text = symbols[s];
+            break;
+          }
+        }
+        if (t.text.empty()) {
+          throw make_error(source, i, std::string("unexpected character '")
+                                      + c + "'");
+        }
+        i += t.text.size();
+      }
+      tokens.push_back(t);
+    }
+
+    token t;
+    t.kind = token::end;
+    t.value = 0;
+    t.position = source.size();
+    tokens.push_back(t);
+    return tokens;
+  }
+
+  // Recursive descent parser that emits bytecode.
+  class compiler
+  {
+    typedef expression_filter::instruction instruction;
+
+    const std::string &_source;
+    const filter_table &_names;
+    std::vector<token> _tokens;
+    unsigned _pos;
+
+    std::vector<instruction> &_code;
+    std::vector<float> &_constants;
+    std::vector<const filter *> &_filters;
+
+    int _depth, _max_depth;
+    int _mask_depth, _max_mask_depth;
+
+    const token &current() const { return _tokens[_pos]; }
+
+    bool accept(const char *symbol)
+    {
+      if (current().kind == token::symbol && current().text == symbol) {
+        ++_pos;
+        return true;
+      }
+      return false;
+    }
+
+    void expect(const char *symbol)
+    {
+      if (!accept(symbol)) {
+        error(std::string("expected '") + symbol + "'");
+      }
+    }
+
+    void error(const std::string &what) const
+    {
+      if (current().kind == token::end) {
+        throw make_error(_source, current().position,
+                         what + " at end of expression");
+      }
+      throw make_error(_source, current().position, what);
+    }
+
+    void emit(opcode op, int arg, int depth_change, int mask_change)
+    {
+      if (arg > 65535) {
+        error("expression too long");
+      }
+      instruction insn;
+      insn.op = op;
+      insn.arg = arg;
+      _code.push_back(insn);
+
+      _depth += depth_change;
+      _max_depth = std::max(_max_depth, _depth);
+      _mask_depth += mask_change;
+      _max_mask_depth = std::max(_max_mask_depth, _mask_depth);
+    }
+
+    void emit_constant(float value)
+    {
+      _constants.push_back(value);
+      emit(op_const, _constants.size() - 1, 1, 0);
+    }
+
+    void parse_or()
+    {
+      parse_and();
+      while (accept("||")) {
+        emit(op_narrow_or, 0, 0, 1);
+        parse_and();
+        emit(op_widen, 0, 0, -1);
+        emit(op_or, 0, -1, 0);
+      }
+    }
+
+    void parse_and()
+    {
+      parse_comparison();
+      while (accept("&&")) {
+        emit(op_narrow_and, 0, 0, 1);
+        parse_comparison();
+        emit(op_widen, 0, 0, -1);
+        emit(op_and, 0, -1, 0);
+      }
+    }
+
+    void parse_comparison()
+    {
+      parse_sum();
+      for (;;) {
+        opcode op = op_lt;
+        if (accept("<")) {
+          op = op_lt;
+        } else if (accept("<=")) {
+          op = op_le;
+        } else if (accept(">")) {
+          op = op_gt;
+        } else if (accept(">=")) {
+          op = op_ge;
+        } else if (accept("==")) {
+          op = op_eq;
+        } else if (accept("!=")) {
+          op = op_ne;
+        } else {
+          return;
+        }
+        parse_sum();
+        emit(op, 0, -1, 0);
+      }
+    }
+
+    void parse_sum()
+    {
+      parse_product();
+      for (;;) {
+        if (accept("+")) {
+          parse_product();
+          emit(op_add, 0, -1, 0);
+        } else if (accept("-")) {
+          parse_product();
+          emit(op_sub, 0, -1, 0);
+        } else {
+          return;
+        }
+      }
+    }
+
+    void parse_product()
+    {
+      parse_unary();
+      for (;;) {
+        if (accept("*")) {
+          parse_unary();
+          emit(op_mul, 0, -1, 0);
+        } else if (accept("/")) {
+          parse_unary();
+          emit(op_div, 0, -1, 0);
+        } else {
+          return;
+        }
+      }
+    }
+
+    void parse_unary()
+    {
+      if (accept("!")) {
+        parse_unary();
+        emit(op_not, 0, 0, 0);
+      } else if (accept("-")) {
+        parse_unary();
+        emit(op_neg, 0, 0, 0);
+      } else if (accept("+")) {
+        parse_unary();
+      } else {
+        parse_primary();
+      }
+    }
+
+    void parse_primary()
+    {
+      const token &t = current();
+      if (t.kind == token::number) {
+        ++_pos;
+        emit_constant(t.value);
+      } else if (t.kind == token::identifier) {
+        parse_identifier();
+      } else if (accept("(")) {
+        parse_or();
+        expect(")");
+      } else {
+        error("expected a value");
+      }
+    }
+
+    void parse_identifier()
+    {
+      const token &t = current();
+
+      // Functions
+      if (_tokens[_pos + 1].kind == token::symbol
+          && _tokens[_pos + 1].text == "(") {
+        opcode op = op_abs;
+        if (t.text == "abs") {
+          op = op_abs;
+        } else if (t.text == "sqrt") {
+          op = op_sqrt;
+        } else {
+          error("unknown function '" + t.text + "'");
+        }
+        _pos += 2;
+        parse_or();
+        expect(")");
+        emit(op, 0, 0, 0);
+        return;
+      }
+
+      // Fields
+      for (int f = 0; f < f_count; ++f) {
+        if (t.text == field_names[f]) {
+          ++_pos;
+          emit(op_load, f, 1, 0);
+          return;
+        }
+      }
+
+      // Predicates
+      for (int p = 0; p < predicate_count; ++p) {
+        if (t.text == predicates[p].name) {
+          ++_pos;
+          emit(op_load, predicates[p].count, 1, 0);
+          emit_constant(0);
+          emit(op_gt, 0, -1, 0);
+          return;
+        }
+      }
+
+      // Named filters
+      filter_table::const_iterator it = _names.find(t.text);
+      if (it != _names.end()) {
+        ++_pos;
+        _filters.push_back(it->second);
+        emit(op_filter, _filters.size() - 1, 1, 0);
+        return;
+      }
+
+      error("unknown name '" + t.text + "'");
+    }
+
+  public:
+    compiler(const std::string &source,
+             const filter_table &names,
+             std::vector<instruction> &code,
+             std::vector<float> &constants,
+             std::vector<const filter *> &filters) :
+      _source(source),
+      _names(names),
+      _tokens(tokenize(source)),
+      _pos(0),
+      _code(code),
+      _constants(constants),
+      _filters(filters),
+      _depth(0),
+      _max_depth(0),
+      _mask_depth(0),
+      _max_mask_depth(0)
+    {}
+
+    void compile()
+    {
+      parse_or();
+      if (current().kind != token::end) {
+        error("unexpected '" + current().text + "'");
+      }
+      assert(_depth == 1);
+      assert(_mask_depth == 0);
+    }
+
+    int max_depth() const { return _max_depth; }
+    int max_mask_depth() const { return _max_mask_depth; }
+  };
+}
+
+const int expression_filter::batch;
+
+/// Returns the filters that can be used in expressions by default
+/**
+ * The table contains @ref eb, @ref coldeb, @ref goodeb and @ref hoteb. It can
+ * be extended and passed to the constructor of @ref expression_filter:
+ *
+ * ~~~~{.cpp}
+ * filter_table names = default_filters();
+ * names["mine"] = &my_filter;
+ * expression_filter f("mine && goodeb", names);
+ * ~~~~
+ *
+ * @relates expression_filter
+ */
+filter_table default_filters()
+{
+  filter_table names;
+  names["eb"] = &eb;
+  names["coldeb"] = &coldeb;
+  names["goodeb"] = &goodeb;
+  names["hoteb"] = &hoteb;
+  return names;
+}
+
+/// Compiles an expression using the default filters
+/**
+ * An @ref expression_error is thrown if the expression is invalid.
+ *
+ * @see default_filters()
+ */
+expression_filter::expression_filter(const std::string &source) :
+  _source(source),
+  _set(nullptr),
+  _generation(0)
+{
+  compile(default_filters());
+}
+
+/// Compiles an expression using the given filters
+/**
+ * @c names maps the names that can be used in the expression to filters. The
+ * filters aren't copied and must stay alive as long as this object.
+ *
+ * An @ref expression_error is thrown if the expression is invalid.
+ */
+expression_filter::expression_filter(const std::string &source,
+                                     const filter_table &names) :
+  _source(source),
+  _set(nullptr),
+  _generation(0)
+{
+  compile(names);
+}
+
+// Compiles _source and allocates the work space.
+void expression_filter::compile(const filter_table &names)
+{
+  compiler c(_source, names, _code, _constants, _filters);
+  c.compile();
+  _depth = c.max_depth();
+  _mask_depth = c.max_mask_depth();
+  _stack.resize(_depth * batch);
+  _active.resize((_mask_depth + 1) * batch);
+}
+
+namespace {
+  // Converts count values of a column to float. Full batches use a constant
+  // trip count, which lets the compiler vectorize the loop.
+  template<class T>
+  void load(float *CALO_RESTRICT out, const T *CALO_RESTRICT in, int count)
+  {
+    if (count == expression_filter::batch) {
+      for (int i = 0; i < expression_filter::batch; ++i) {
+        out[i] = in[i];
+      }
+    } else {
+      for (int i = 0; i < count; ++i) {
+        out[i] = in[i];
+      }
+    }
+  }
+
+  // Computes the mask of the active towers for which condition is nonzero
+  // (keep) or zero (!keep). The masks and the stack are separate arrays, so
+  // the loop only vectorizes with restrict.
+  void narrow(float *CALO_RESTRICT out, const float *CALO_RESTRICT active,
+              const float *CALO_RESTRICT condition, bool keep)
+  {
+    for (int i = 0; i < expression_filter::batch; ++i) {
+      out[i] = (active[i] != 0) & ((condition[i] != 0) == keep);
+    }
+  }
+}
+
+// Runs the bytecode for count towers starting at begin. The result is left in
+// the first count elements of _stack.
+//
+// Only loads and named filters look at count. All other instructions process
+// whole batches: their loops then have a constant trip count and don't need
+// alias checks, so the compiler vectorizes them at -O2. The values past count
+// are never used.
+void expression_filter::run(const towerset &set, int begin, int count) const
+{
+  assert(count <= batch);
+
+  const tower_columns columns = set.columns();
+  float *const stack = &_stack[0];
+  float *const masks = &_active[0];
+
+  int sp = 0; // Number of values on the stack
+  int mp = 0; // Index of the current mask
+  std::fill(masks, masks + batch, 1);
+
+  for (unsigned pc = 0; pc < _code.size(); ++pc) {
+    const instruction insn = _code[pc];
+    float *const top = stack + (sp - 1) * batch;
+    float *const next = stack + sp * batch;
+    const float *const active = masks + mp * batch;
+
+    switch (insn.op) {
+    case op_const:
+      std::fill(next, next + batch, _constants[insn.arg]);
+      ++sp;
+      break;
+    case op_load:
+      switch (insn.arg) {
+#define CALO_LOAD(field, column)                                              \
+      case field:                                                             \
+        load(next, columns.column + begin, count);                            \
+        break;
+      CALO_LOAD(f_eta, eta)
+      CALO_LOAD(f_phi, phi)
+      CALO_LOAD(f_ebcount, ebcount)
+      CALO_LOAD(f_eecount, eecount)
+      CALO_LOAD(f_hbcount, hbcount)
+      CALO_LOAD(f_hecount, hecount)
+      CALO_LOAD(f_hfcount, hfcount)
+      CALO_LOAD(f_emenergy, emenergy)
+      CALO_LOAD(f_hadenergy, hadenergy)
+      CALO_LOAD(f_totalenergy, totalenergy)
+#undef CALO_LOAD
+      case f_ieta:
+        for (int i = 0; i < count; ++i) {
+          next[i] = tower_ref(&set, begin + i).ieta();
+        }
+        break;
+      case f_iphi:
+        for (int i = 0; i < count; ++i) {
+          next[i] = tower_ref(&set, begin + i).iphi();
+        }
+        break;
+      }
+      ++sp;
+      break;
+    case op_filter:
+      {
+        const filter &f = *_filters[insn.arg];
+        for (int i = 0; i < count; ++i) {
+          next[i] = active[i] != 0
+                    && CALO_FILTER_CALL(f, tower_ref(&set, begin + i));
+        }
+      }
+      ++sp;
+      break;
+
+#define CALO_UNARY(op, expression)                                            \
+    case op:                                                                  \
+      for (int i = 0; i < batch; ++i) {                                       \
+        const float x = top[i];                                               \
+        top[i] = (expression);                                                \
+      }                                                                       \
+      break;
+    CALO_UNARY(op_neg, -x)
+    CALO_UNARY(op_not, x == 0)
+    CALO_UNARY(op_abs, std::abs(x))
+    CALO_UNARY(op_sqrt, std::sqrt(x))
+#undef CALO_UNARY
+
+#define CALO_BINARY(op, expression)                                           \
+    case op:                                                                  \
+      {                                                                       \
+        float *const lhs = top - batch;                                       \
+        for (int i = 0; i < batch; ++i) {                                     \
+          const float x = lhs[i];                                             \
+          const float y = top[i];                                             \
+          lhs[i] = (expression);                                              \
+        }                                                                     \
+      }                                                                       \
+      --sp;                                                                   \
+      break;
+    CALO_BINARY(op_add, x + y)
+    CALO_BINARY(op_sub, x - y)
+    CALO_BINARY(op_mul, x * y)
+    CALO_BINARY(op_div, x / y)
+    CALO_BINARY(op_lt, x < y)
+    CALO_BINARY(op_le, x <= y)
+    CALO_BINARY(op_gt, x > y)
+    CALO_BINARY(op_ge, x >= y)
+    CALO_BINARY(op_eq, x == y)
+    CALO_BINARY(op_ne, x != y)
+    CALO_BINARY(op_and, (x != 0) & (y != 0))
+    CALO_BINARY(op_or, (x != 0) | (y != 0))
+#undef CALO_BINARY
+
+    case op_narrow_and:
+      narrow(masks + (mp + 1) * batch, active, top, true);
+      ++mp;
+      break;
+    case op_narrow_or:
+      narrow(masks + (mp + 1) * batch, active, top, false);
+      ++mp;
+      break;
+    case op_widen:
+      --mp;
+      break;
+    }
+  }
+}
+
+/// Evaluates the expression for a single tower
+/**
+ * The first call for an event evaluates the expression for all towers with
+ * select() and keeps the result until the @ref towerset loads another event
+ * (see @ref towerset::generation). Later calls for the same event only look
+ * the result up.
+ */
+bool expression_filter::operator() (const tower_ref &tower) const
+{
+  const towerset *set = tower.set();
+  if (set != _set || set->generation() != _generation) {
+    select(*set, _mask);
+    _set = set;
+    _generation = set->generation();
+  }
+  return _mask.test(tower.index());
+}
+
+/// Evaluates the expression for all towers of the current event in @c set
+/**
+ * The result is stored in @c mask, which is resized as needed.
+ */
+void expression_filter::select(const towerset &set, tower_mask &mask) const
+{
+  const int size = set.size();
+  mask.reset(size);
+  for (int begin = 0; begin < size; begin += batch) {
+    const int count = std::min(batch, size - begin);
+    run(set, begin, count);
+    for (int i = 0; i < count; ++i) {
+      if (_stack[i] != 0) {
+        mask.set(begin + i);
+      }
+    }
+  }
+}
+
+/// Prints the compiled bytecode
+/**
+ * @warning
+ * This function is there for debugging purposes; the format of the output
+ * should not be relied on.
+ */
+void expression_filter::disassemble(std::ostream &out) const
+{
+  out << "; " << _source << std::endl;
+  out << "; stack depth " << _depth << ", mask depth " << _mask_depth
+      << std::endl;
+  for (unsigned pc = 0; pc < _code.size(); ++pc) {
+    const instruction insn = _code[pc];
+    out << std::setw(4) << pc << "  " << opcode_names[insn.op];
+    if (insn.op == op_const) {
+      out << " " << _constants[insn.arg];
+    } else if (insn.op == op_load) {
+      out << " " << field_names[insn.arg];
+    } else if (insn.op == op_filter) {
+      out << " #" << insn.arg;
+    }
+    out << std::endl;
+  }
+}
+
+} // namespace calo
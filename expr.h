@@ -0,0 +1,94 @@
+#ifndef CALCLEAN_EXPR
+#define CALCLEAN_EXPR
+
+/**
+ * @file
+ * @brief  Header for filters defined by text expressions
+ */
+
+#include <iosfwd>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include "calofilter.h"
+
+namespace calo {
+
+/// A table of named filters usable in expressions
+typedef std::map<std::string, const filter *> filter_table;
+
+filter_table default_filters();
+
+/// Error thrown when an expression cannot be compiled
+/**
+ * The message points at the offending token.
+ */
+class expression_error : public std::runtime_error
+{
+  int _position;
+public:
+  /// Constructs an error at character @c position of the expression
+  explicit expression_error(const std::string &what, int position) :
+    std::runtime_error(what), _position(position) {}
+
+  /// Returns the position of the offending token in the expression
+  int position() const { return _position; }
+};
+
+class expression_filter : public filter
+{
+public:
+  /// The number of towers processed at once
+  static const int batch = 64;
+
+  /// Bytecode instruction
+  struct instruction
+  {
+    /// Operation code
+    unsigned char op;
+    /// Argument of the operation (field, constant or filter index)
+    unsigned short arg;
+  };
+
+private:
+  std::string _source;
+  std::vector<instruction> _code;
+  std::vector<float> _constants;
+  std::vector<const filter *> _filters;
+  int _depth;
+  int _mask_depth;
+
+  // Work space for the virtual machine
+  mutable std::vector<float> _stack;
+  mutable std::vector<float> _active; // 1 for active towers, 0 otherwise
+
+  // Results for the last event seen by operator()
+  mutable const towerset *_set;
+  mutable unsigned long _generation;
+  mutable tower_mask _mask;
+
+  void compile(const filter_table &names);
+  void run(const towerset &set, int begin, int count) const;
+
+public:
+  explicit expression_filter(const std::string &source);
+  explicit expression_filter(const std::string &source,
+                             const filter_table &names);
+
+  /// Returns the source of the expression
+  const std::string &source() const { return _source; }
+
+  /// Returns the compiled bytecode
+  const std::vector<instruction> &code() const { return _code; }
+
+  bool operator() (const tower_ref &tower) const;
+
+  void select(const towerset &set, tower_mask &mask) const;
+
+  void disassemble(std::ostream &out) const;
+};
+
+} // namespace calo
+
+#endif // CALCLEAN_EXPR
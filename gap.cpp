@@ -0,0 +1,203 @@
+#include "gap.h"
+#include "store.h"
+
+/**
+ * @file
+ * @brief  Source for the rapidity gap finder
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace calo {
+
+/**
+ * @class gap_finder calclean/gap.h
+ * @brief Finds the largest pseudorapidity gap in events.
+ *
+ * Diffractive events are identified by a large region of @f$\eta@f$ without
+ * any activity. After noise cleaning, the gaps can be found by sorting the
+ * towers that pass a filter by @f$\eta@f$ and looking at the distance between
+ * neighbours. A @c gap_finder does this without sorting and without
+ * allocating memory: the @f$\eta@f$ axis is divided into bins of the size of
+ * a tower (see @ref eta_index), and the occupied bins are recorded in a
+ * bitmap. The gaps are then read from the bitmap in a single pass:
+ *
+ * ~~~~{.cpp}
+ * gap_finder finder;
+ * rapidity_gap gap = finder.find(set, &goodeb);
+ * std::cout << "Largest gap: " << gap.size << " from " << gap.low
+ *           << " to " << gap.high << std::endl;
+ * ~~~~
+ *
+ * Gaps are measured between the edges of the bins, and between the edges of
+ * the acceptance and the outermost occupied bins (@ref rapidity_gap::forward
+ * and @ref rapidity_gap::backward). Gaps at the edges are candidates for the
+ * largest gap; when several gaps have the same size, the most backward one
+ * is returned. If no tower passes the filter, the whole acceptance is a gap.
+ *
+ * Gaps for many events are computed at once with the batch versions of
+ * find(). The one taking an @ref event_store processes events in parallel
+ * when OpenMP is enabled (for instance with @c -fopenmp); the filter must
+ * then be safe to call from several threads. The results are stored in
+ * event order and don't depend on the number of threads.
+ */
+
+/// Constructs a gap finder for towers with @f$|\eta| \leq@f$ @c acceptance
+/**
+ * The default covers the HF. The acceptance must be positive and span at most
+ * @ref max_bins bins, else an exception is thrown (@c std::invalid_argument).
+ */
+gap_finder::gap_finder(float acceptance) :
+  _acceptance(acceptance),
+  _first_bin(eta_index(-acceptance)),
+  _bins(eta_index(acceptance) - _first_bin + 1)
+{
+  if (!(acceptance > 0) || _bins > max_bins) {
+    throw std::invalid_argument("gap_finder: acceptance out of range");
+  }
+}
+
+// Returns the lower edge of a bin, within the acceptance.
+float gap_finder::edge(int bin) const
+{
+  const float eta = (_first_bin + bin) * 0.085;
+  return std::max(-_acceptance, std::min(_acceptance, eta));
+}
+
+// Finds the gaps between the occupied bins of a bitmap.
+rapidity_gap gap_finder::scan(const word_type *bitmap) const
+{
+  rapidity_gap gap;
+  int previous = -1; // Last occupied bin
+  for (int w = 0; w < words; ++w) {
+    int bin = w * tower_mask::word_bits;
+    for (word_type bits = bitmap[w]; bits != 0; bits >>= 1, ++bin) {
+      if ((bits & 1) == 0) {
+        continue;
+      }
+      ++gap.occupied;
+      const float low = previous < 0 ? -_acceptance : edge(previous + 1);
+      const float high = edge(bin);
+      if (previous < 0) {
+        gap.backward = high - low;
+      }
+      if (high - low > gap.size) {
+        gap.size = high - low;
+        gap.low = low;
+        gap.high = high;
+      }
+      previous = bin;
+    }
+  }
+
+  const float low = previous < 0 ? -_acceptance : edge(previous + 1);
+  gap.forward = _acceptance - low;
+  if (previous < 0) {
+    gap.backward = gap.forward;
+  }
+  if (gap.forward > gap.size) {
+    gap.size = gap.forward;
+    gap.low = low;
+    gap.high = _acceptance;
+  }
+  return gap;
+}
+
+/// Finds the largest gap between towers that pass a filter
+/**
+ * If @c f is @c null, all towers are used.
+ */
+rapidity_gap gap_finder::find(const towerset &set, const filter *f) const
+{
+  word_type bitmap[words] = {0};
+  const tower_columns c = set.columns();
+  if (f == nullptr) {
+    for (int i = 0; i < c.size; ++i) {
+      mark(bitmap, c.eta[i]);
+    }
+  } else {
+    const filter &pass = *f;
+    for (int i = 0; i < c.size; ++i) {
+      if (CALO_FILTER_CALL(pass, tower_ref(&set, i))) {
+        mark(bitmap, c.eta[i]);
+      }
+    }
+  }
+  return scan(bitmap);
+}
+
+/// Finds the largest gap between towers set in a mask
+/**
+ * The mask must have been computed for the current event.
+ */
+rapidity_gap gap_finder::find(const towerset &set,
+                              const tower_mask &mask) const
+{
+  assert(mask.size() == set.size());
+  word_type bitmap[words] = {0};
+  const tower_columns c = set.columns();
+  for (int w = 0; w < mask.words(); ++w) {
+    int i = w * tower_mask::word_bits;
+    for (tower_mask::word_type bits = mask.word(w); bits != 0;
+         bits >>= 1, ++i) {
+      if (bits & 1) {
+        mark(bitmap, c.eta[i]);
+      }
+    }
+  }
+  return scan(bitmap);
+}
+
+/// Finds the largest gap in every event of a tree
+/**
+ * Entries @c first to <tt>first + count - 1</tt> of @c set are read, stopping
+ * at the end of the tree, and the gap of every entry is appended to @c gaps.
+ */
+void gap_finder::find(towerset &set,
+                      const filter *f,
+                      std::vector<rapidity_gap> &gaps,
+                      unsigned long first,
+                      unsigned long count) const
+{
+  const unsigned long entries = set.entries();
+  if (first >= entries) {
+    return;
+  }
+  const unsigned long last = first + std::min(count, entries - first);
+  gaps.reserve(gaps.size() + last - first);
+  for (unsigned long entry = first; entry < last; ++entry) {
+    set.getentry(entry);
+    gaps.push_back(find(set, f));
+  }
+}
+
+/// Finds the largest gap in every event of a store
+/**
+ * @c gaps is resized to the number of events, and the gap of event @c e is
+ * stored at index @c e. Events are processed in parallel when OpenMP is
+ * enabled.
+ */
+void gap_finder::find(const event_store &store,
+                      const filter *f,
+                      std::vector<rapidity_gap> &gaps) const
+{
+  const long events = store.events();
+  gaps.resize(events);
+#ifdef _OPENMP
+# pragma omp parallel
+#endif
+  {
+    const std::vector<tower> empty;
+    towerset set(empty); // One per thread
+#ifdef _OPENMP
+# pragma omp for schedule(static)
+#endif
+    for (long e = 0; e < events; ++e) {
+      store.get(e, set);
+      gaps[e] = find(set, f);
+    }
+  }
+}
+
+} // namespace calo
@@ -0,0 +1,101 @@
+#ifndef CALCLEAN_GAP
+#define CALCLEAN_GAP
+
+/**
+ * @file
+ * @brief  Header for the rapidity gap finder
+ */
+
+#include "calofilter.h"
+
+namespace calo {
+
+class event_store;
+
+/// The largest pseudorapidity gap in an event
+/**
+ * @see gap_finder
+ */
+struct rapidity_gap
+{
+  /// Number of occupied @f$\eta@f$ bins
+  int occupied;
+
+  /// Size of the largest gap
+  float size;
+  /// Lower edge of the largest gap
+  float low;
+  /// Upper edge of the largest gap
+  float high;
+
+  /// Gap between the most forward occupied bin and the acceptance edge at
+  /// positive @f$\eta@f$
+  float forward;
+  /// Gap between the acceptance edge at negative @f$\eta@f$ and the most
+  /// backward occupied bin
+  float backward;
+
+  /// Constructs an empty gap
+  rapidity_gap() :
+    occupied(0), size(0), low(0), high(0), forward(0), backward(0)
+  {}
+};
+
+class gap_finder
+{
+public:
+  /// The maximum number of @f$\eta@f$ bins
+  static const int max_bins = 128;
+
+private:
+  typedef tower_mask::word_type word_type;
+
+  // Number of words in the bitmap of occupied bins
+  static const int words = max_bins / tower_mask::word_bits;
+
+  float _acceptance;
+  int _first_bin;
+  int _bins;
+
+  inline void mark(word_type *bitmap, float eta) const;
+  float edge(int bin) const;
+  rapidity_gap scan(const word_type *bitmap) const;
+
+public:
+  explicit gap_finder(float acceptance = 5.191f);
+
+  /// Returns the upper bound of @f$|\eta|@f$ for towers to be considered
+  float acceptance() const { return _acceptance; }
+
+  /// Returns the number of @f$\eta@f$ bins
+  int bins() const { return _bins; }
+
+  rapidity_gap find(const towerset &set, const filter *f = nullptr) const;
+  rapidity_gap find(const towerset &set, const tower_mask &mask) const;
+
+  void find(towerset &set,
+            const filter *f,
+            std::vector<rapidity_gap> &gaps,
+            unsigned long first = 0,
+            unsigned long count = ULONG_MAX) const;
+  void find(const event_store &store,
+            const filter *f,
+            std::vector<rapidity_gap> &gaps) const;
+};
+
+/// Marks the bin of a tower at @c eta as occupied
+/**
+ * Towers outside of the acceptance are ignored.
+ */
+void gap_finder::mark(word_type *bitmap, float eta) const
+{
+  const int bin = eta_index(eta) - _first_bin;
+  if (std::fabs(eta) <= _acceptance && bin >= 0 && bin < _bins) {
+    bitmap[bin / tower_mask::word_bits] |=
+      word_type(1) << (bin % tower_mask::word_bits);
+  }
+}
+
+} // namespace calo
+
+#endif // CALCLEAN_GAP
@@ -0,0 +1,578 @@
+#include "histogram.h"
+
+/**
+ * @file
+ * @brief  Source for histograms filled from tower columns
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <TH1F.h>
+#include <TH2F.h>
+
+namespace calo {
+
+namespace {
+  // Values are processed in blocks of one mask word
+  const int block = tower_mask::word_bits;
+
+  // Variable bins are found by comparing with every edge up to this number of
+  // edges, and by binary search above
+  const unsigned linear_edges = 32;
+
+  // Copies the values whose bit is set in bits to the front of selected,
+  // without branches, and returns their number
+  int compact(const float *values,
+              int count,
+              tower_mask::word_type bits,
+              float *selected)
+  {
+    int n = 0;
+    for (int i = 0; i < count; ++i) {
+      selected[n] = values[i];
+      n += int((bits >> i) & 1);
+    }
+    return n;
+  }
+}
+
+/**
+ * @class histogram_axis calclean/histogram.h
+ * @brief The binning of a @ref histogram along one axis.
+ *
+ * Bins are either uniform, given by their number and range, or variable, given
+ * by their edges. Like in ROOT, bin 0 is the underflow, bins 1 to bins() cover
+ * the range, and bin <tt>bins() + 1</tt> is the overflow. Each bin includes
+ * its lower edge; values that aren't numbers go to the overflow.
+ *
+ * Bins are found for a whole block of values at once, in loops that the
+ * compiler can vectorize. With uniform binning, the bin is computed from the
+ * value; values within rounding errors of an edge may be put in a different
+ * bin than ROOT would. With up to 32 variable bins, every value is compared
+ * with all edges, which is faster than a binary search with unpredictable
+ * branches.
+ */
+
+/// Constructs an axis with @c bins bins of equal width between @c low and
+/// @c high
+/**
+ * An exception is thrown if there are no bins or the range is empty
+ * (@c std::invalid_argument).
+ */
+histogram_axis::histogram_axis(int bins, double low, double high) :
+  _bins(bins),
+  _low(low),
+  _high(high),
+  _scale(0)
+{
+  if (bins < 1) {
+    throw std::invalid_argument("histogram_axis: need at least one bin");
+  }
+  if (!(low < high)) {
+    throw std::invalid_argument("histogram_axis: empty range");
+  }
+  _scale = bins / (high - low);
+}
+
+/// Constructs an axis with variable bins, given by their edges
+/**
+ * An exception is thrown if there are fewer than two edges or they aren't
+ * increasing (@c std::invalid_argument).
+ */
+histogram_axis::histogram_axis(const std::vector<double> &edges) :
+  _bins(int(edges.size()) - 1),
+  _low(0),
+  _high(0),
+  _scale(0),
+  _edges(edges)
+{
+  if (edges.size() < 2) {
+    throw std::invalid_argument("histogram_axis: need at least two edges");
+  }
+  for (unsigned i = 1; i < edges.size(); ++i) {
+    if (!(edges[i - 1] < edges[i])) {
+      throw std::invalid_argument("histogram_axis: edges must increase");
+    }
+  }
+  _low = edges.front();
+  _high = edges.back();
+}
+
+/// Returns the edges of all bins, from low() to high()
+std::vector<double> histogram_axis::edges() const
+{
+  if (!uniform()) {
+    return _edges;
+  }
+  std::vector<double> result(_bins + 1);
+  for (int i = 0; i <= _bins; ++i) {
+    result[i] = _low + (_high - _low) * i / _bins;
+  }
+  return result;
+}
+
+/// Returns the bin containing @c x
+int histogram_axis::index(double x) const
+{
+  if (uniform()) {
+    const double t = (x - _low) * _scale;
+    return t < 0 ? 0 : (t < _bins ? int(t) + 1 : _bins + 1);
+  }
+  if (x < _low) {
+    return 0;
+  } else if (!(x < _high)) {
+    return _bins + 1;
+  }
+  return std::upper_bound(_edges.begin(), _edges.end(), x) - _edges.begin();
+}
+
+/// Stores the bins containing @c count values in @c bins
+void histogram_axis::index(const float *values, int count, int *bins) const
+{
+  if (uniform()) {
+    const double low = _low;
+    const double scale = _scale;
+    const int n = _bins;
+    for (int i = 0; i < count; ++i) {
+      const double t = (values[i] - low) * scale;
+      bins[i] = t < 0 ? 0 : (t < n ? int(t) + 1 : n + 1);
+    }
+  } else if (_edges.size() <= linear_edges) {
+    // The bin is the number of edges below the value
+    std::fill(bins, bins + count, 0);
+    for (unsigned e = 0; e < _edges.size(); ++e) {
+      const double edge = _edges[e];
+      for (int i = 0; i < count; ++i) {
+        bins[i] += !(values[i] < edge);
+      }
+    }
+  } else {
+    for (int i = 0; i < count; ++i) {
+      bins[i] = index(values[i]);
+    }
+  }
+}
+
+/// Returns @c true if both axes have the same bins
+bool histogram_axis::operator== (const histogram_axis &other) const
+{
+  return _bins == other._bins && _low == other._low && _high == other._high
+      && _edges == other._edges;
+}
+
+/// Constructs empty contents for @c cells bins
+/**
+ * An exception is thrown if @c replicas isn't a power of two between 1 and
+ * @ref tower_mask::word_bits (@c std::invalid_argument).
+ */
+histogram_contents::histogram_contents(int cells, int replicas) :
+  _cells(cells),
+  _replicas(replicas),
+  _sums(replicas * cells, 0),
+  _entries(0)
+{
+  if (replicas < 1 || replicas > block || (replicas & (replicas - 1)) != 0) {
+    throw std::invalid_argument("histogram: the number of replicas must be a "
+                                "power of two");
+  }
+}
+
+/// Adds a block of at most @ref tower_mask::word_bits values
+/**
+ * @c cells gives the bin of every value and is overwritten. If @c weights is
+ * @c null, all weights are 1.
+ */
+void histogram_contents::add(int *cells, int count, const float *weights)
+{
+  assert(count <= block);
+
+  // Consecutive values go to different replicas, so that increments of the
+  // same bin don't wait for each other
+  const int last = _replicas - 1;
+  for (int i = 0; i < count; ++i) {
+    cells[i] += (i & last) * _cells;
+  }
+  _entries += count;
+
+  double *sums = &_sums[0];
+  if (weights == nullptr) {
+    for (int i = 0; i < count; ++i) {
+      sums[cells[i]] += 1;
+    }
+    if (!_sumw2.empty()) {
+      double *sumw2 = &_sumw2[0];
+      for (int i = 0; i < count; ++i) {
+        sumw2[cells[i]] += 1;
+      }
+    }
+  } else {
+    if (_sumw2.empty()) {
+      _sumw2 = _sums; // All weights were 1 so far
+    }
+    double *sumw2 = &_sumw2[0];
+    for (int i = 0; i < count; ++i) {
+      const double w = weights[i];
+      sums[cells[i]] += w;
+      sumw2[cells[i]] += w * w;
+    }
+  }
+}
+
+/// Adds a single value to a bin
+void histogram_contents::add(int cell, double weight)
+{
+  if (weight != 1 && _sumw2.empty()) {
+    _sumw2 = _sums;
+  }
+  _sums[cell] += weight;
+  if (!_sumw2.empty()) {
+    _sumw2[cell] += weight * weight;
+  }
+  ++_entries;
+}
+
+/// Returns the sum of weights in a bin
+double histogram_contents::sum(int cell) const
+{
+  double result = 0;
+  for (int r = 0; r < _replicas; ++r) {
+    result += _sums[r * _cells + cell];
+  }
+  return result;
+}
+
+/// Returns the sum of squared weights in a bin
+double histogram_contents::sumw2(int cell) const
+{
+  if (_sumw2.empty()) {
+    return sum(cell);
+  }
+  double result = 0;
+  for (int r = 0; r < _replicas; ++r) {
+    result += _sumw2[r * _cells + cell];
+  }
+  return result;
+}
+
+/// Sets all bins to zero
+void histogram_contents::reset()
+{
+  std::fill(_sums.begin(), _sums.end(), 0);
+  _sumw2.clear();
+  _entries = 0;
+}
+
+/// Adds the contents of another object with the same number of bins
+void histogram_contents::merge(const histogram_contents &other)
+{
+  assert(other._cells == _cells);
+  if (other.weighted() && _sumw2.empty()) {
+    _sumw2 = _sums;
+  }
+  for (int cell = 0; cell < _cells; ++cell) {
+    _sums[cell] += other.sum(cell);
+    if (!_sumw2.empty()) {
+      _sumw2[cell] += other.sumw2(cell);
+    }
+  }
+  _entries += other._entries;
+}
+
+/**
+ * @class histogram calclean/histogram.h
+ * @brief A one-dimensional histogram filled from whole columns.
+ *
+ * Filling a ROOT histogram tower by tower costs a virtual call, a bin search
+ * and the update of several statistics for every value, which can take longer
+ * than the cleaning itself. A @c histogram is filled from the columns of a
+ * @ref towerset, with the selected towers given by a @ref tower_mask:
+ *
+ * ~~~~{.cpp}
+ * histogram energy(histogram_axis(100, 0, 50));
+ * filter_bank bank;
+ * bank.add(&goodeb);
+ * std::vector<tower_mask> masks;
+ * for (unsigned long i = 0; i < set.entries(); ++i) {
+ *   set.getentry(i);
+ *   bank.evaluate(set, masks);
+ *   energy.fill(set.columns().emenergy, masks[0]);
+ * }
+ * energy.to_root("energy", "EB energy;E [GeV]")->Write();
+ * ~~~~
+ *
+ * Values are processed in blocks of one mask word: the selected values are
+ * moved to the front of the block, their bins are computed in a loop that the
+ * compiler can vectorize, then the bins are incremented. To keep consecutive
+ * increments of the same bin independent, the contents are stored several
+ * times (the replicas), and consecutive values go to different replicas. The
+ * replicas are summed when the contents are read. Histograms filled
+ * separately, for instance in different threads, are merged with
+ * <tt>operator+=</tt>.
+ *
+ * Only the sums of weights (and of squared weights, once a weight other than
+ * 1 is used) are kept. The histogram is converted to a ROOT histogram with
+ * to_root() when it is written.
+ */
+
+/// Constructs an empty histogram
+/**
+ * Consecutive values are spread over @c replicas copies of the bins, which
+ * must be a power of two (see @ref histogram_contents).
+ */
+histogram::histogram(const histogram_axis &axis, int replicas) :
+  _axis(axis),
+  _contents(axis.bins() + 2, replicas)
+{}
+
+/// Adds a single value
+void histogram::fill(double x, double weight)
+{
+  _contents.add(_axis.index(x), weight);
+}
+
+/// Adds @c count values
+/**
+ * If @c weights is @c null, all values have a weight of 1.
+ */
+void histogram::fill(const float *values, int count, const float *weights)
+{
+  int cells[block];
+  for (int first = 0; first < count; first += block) {
+    const int n = std::min(block, count - first);
+    _axis.index(values + first, n, cells);
+    _contents.add(cells, n, weights == nullptr ? nullptr : weights + first);
+  }
+}
+
+/// Adds the values of the towers selected in @c mask
+/**
+ * @c values and @c weights are columns of the event the mask was computed for,
+ * for instance from @ref towerset::columns. If @c weights is @c null, all
+ * values have a weight of 1.
+ */
+void histogram::fill(const float *values,
+                     const tower_mask &mask,
+                     const float *weights)
+{
+  int cells[block];
+  float x[block], w[block];
+  for (int word = 0; word < mask.words(); ++word) {
+    const tower_mask::word_type bits = mask.word(word);
+    if (bits == 0) {
+      continue;
+    }
+    const int first = word * block;
+    const int count = std::min(block, mask.size() - first);
+    const int n = compact(values + first, count, bits, x);
+    _axis.index(x, n, cells);
+    if (weights != nullptr) {
+      compact(weights + first, count, bits, w);
+    }
+    _contents.add(cells, n, weights == nullptr ? nullptr : w);
+  }
+}
+
+/// Returns the statistical uncertainty on the content of a bin
+/**
+ * This is the square root of the sum of squared weights.
+ */
+double histogram::error(int bin) const
+{
+  return std::sqrt(_contents.sumw2(bin));
+}
+
+/// Adds the contents of another histogram
+/**
+ * An exception is thrown if the binnings differ (@c std::invalid_argument).
+ */
+histogram &histogram::operator+= (const histogram &other)
+{
+  if (_axis != other._axis) {
+    throw std::invalid_argument("histogram::operator+=: different binnings");
+  }
+  _contents.merge(other._contents);
+  return *this;
+}
+
+/// Returns a new ROOT histogram with the same contents
+/**
+ * The caller takes ownership of the histogram, which is attached to the
+ * current directory like any ROOT histogram. Errors are set when weights
+ * other than 1 were used. Statistics such as the mean are computed by ROOT
+ * from the bin contents.
+ */
+TH1F *histogram::to_root(const std::string &name,
+                         const std::string &title) const
+{
+  const int bins = _axis.bins();
+  TH1F *h;
+  if (_axis.uniform()) {
+    h = new TH1F(name.c_str(), title.c_str(), bins, _axis.low(), _axis.high());
+  } else {
+    const std::vector<double> edges = _axis.edges();
+    h = new TH1F(name.c_str(), title.c_str(), bins, &edges[0]);
+  }
+  const bool weighted = _contents.weighted();
+  if (weighted) {
+    h->Sumw2();
+  }
+  for (int bin = 0; bin <= bins + 1; ++bin) {
+    h->SetBinContent(bin, content(bin));
+    if (weighted) {
+      h->SetBinError(bin, error(bin));
+    }
+  }
+  h->SetEntries(entries());
+  return h;
+}
+
+/**
+ * @class histogram2d calclean/histogram.h
+ * @brief A two-dimensional histogram filled from whole columns.
+ *
+ * This is the two-dimensional version of @ref histogram, for instance for
+ * @f$(\eta, \phi)@f$ maps:
+ *
+ * ~~~~{.cpp}
+ * histogram2d map(histogram_axis(82, -5.191, 5.191),
+ *                 histogram_axis(72, -M_PI, M_PI));
+ * const tower_columns c = set.columns();
+ * map.fill(c.eta, c.phi, mask, c.totalenergy);
+ * ~~~~
+ */
+
+/// Constructs an empty histogram
+histogram2d::histogram2d(const histogram_axis &xaxis,
+                         const histogram_axis &yaxis,
+                         int replicas) :
+  _xaxis(xaxis),
+  _yaxis(yaxis),
+  _contents((xaxis.bins() + 2) * (yaxis.bins() + 2), replicas)
+{}
+
+// Stores the cells containing count (x, y) pairs, at most one block.
+void histogram2d::index(const float *x,
+                        const float *y,
+                        int count,
+                        int *cells) const
+{
+  int ybins[block];
+  _xaxis.index(x, count, cells);
+  _yaxis.index(y, count, ybins);
+  const int ny = _yaxis.bins() + 2;
+  for (int i = 0; i < count; ++i) {
+    cells[i] = cells[i] * ny + ybins[i];
+  }
+}
+
+/// Adds a single value
+void histogram2d::fill(double x, double y, double weight)
+{
+  _contents.add(_xaxis.index(x) * (_yaxis.bins() + 2) + _yaxis.index(y),
+                weight);
+}
+
+/// Adds @c count values
+/**
+ * If @c weights is @c null, all values have a weight of 1.
+ */
+void histogram2d::fill(const float *x,
+                       const float *y,
+                       int count,
+                       const float *weights)
+{
+  int cells[block];
+  for (int first = 0; first < count; first += block) {
+    const int n = std::min(block, count - first);
+    index(x + first, y + first, n, cells);
+    _contents.add(cells, n, weights == nullptr ? nullptr : weights + first);
+  }
+}
+
+/// Adds the values of the towers selected in @c mask
+/**
+ * @see histogram::fill(const float *, const tower_mask &, const float *)
+ */
+void histogram2d::fill(const float *x,
+                       const float *y,
+                       const tower_mask &mask,
+                       const float *weights)
+{
+  int cells[block];
+  float xs[block], ys[block], w[block];
+  for (int word = 0; word < mask.words(); ++word) {
+    const tower_mask::word_type bits = mask.word(word);
+    if (bits == 0) {
+      continue;
+    }
+    const int first = word * block;
+    const int count = std::min(block, mask.size() - first);
+    const int n = compact(x + first, count, bits, xs);
+    compact(y + first, count, bits, ys);
+    index(xs, ys, n, cells);
+    if (weights != nullptr) {
+      compact(weights + first, count, bits, w);
+    }
+    _contents.add(cells, n, weights == nullptr ? nullptr : w);
+  }
+}
+
+/// Returns the statistical uncertainty on the content of a bin
+double histogram2d::error(int xbin, int ybin) const
+{
+  return std::sqrt(_contents.sumw2(xbin * (_yaxis.bins() + 2) + ybin));
+}
+
+/// Adds the contents of another histogram
+/**
+ * An exception is thrown if the binnings differ (@c std::invalid_argument).
+ */
+histogram2d &histogram2d::operator+= (const histogram2d &other)
+{
+  if (_xaxis != other._xaxis || _yaxis != other._yaxis) {
+    throw std::invalid_argument("histogram2d::operator+=: different "
+                                "binnings");
+  }
+  _contents.merge(other._contents);
+  return *this;
+}
+
+/// Returns a new ROOT histogram with the same contents
+/**
+ * @see histogram::to_root
+ */
+TH2F *histogram2d::to_root(const std::string &name,
+                           const std::string &title) const
+{
+  const int nx = _xaxis.bins();
+  const int ny = _yaxis.bins();
+  TH2F *h;
+  if (_xaxis.uniform() && _yaxis.uniform()) {
+    h = new TH2F(name.c_str(), title.c_str(),
+                 nx, _xaxis.low(), _xaxis.high(),
+                 ny, _yaxis.low(), _yaxis.high());
+  } else {
+    const std::vector<double> xedges = _xaxis.edges();
+    const std::vector<double> yedges = _yaxis.edges();
+    h = new TH2F(name.c_str(), title.c_str(),
+                 nx, &xedges[0], ny, &yedges[0]);
+  }
+  const bool weighted = _contents.weighted();
+  if (weighted) {
+    h->Sumw2();
+  }
+  for (int x = 0; x <= nx + 1; ++x) {
+    for (int y = 0; y <= ny + 1; ++y) {
+      h->SetBinContent(x, y, content(x, y));
+      if (weighted) {
+        h->SetBinError(x, y, error(x, y));
+      }
+    }
+  }
+  h->SetEntries(entries());
+  return h;
+}
+
+} // namespace calo
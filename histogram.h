@@ -0,0 +1,181 @@
+#ifndef CALCLEAN_HISTOGRAM
+#define CALCLEAN_HISTOGRAM
+
+/**
+ * @file
+ * @brief  Header for histograms filled from tower columns
+ */
+
+#include <string>
+
+#include "calofilter.h"
+
+class TH1F;
+class TH2F;
+
+namespace calo {
+
+class histogram_axis
+{
+  int _bins;
+  double _low;
+  double _high;
+  double _scale;              // Bins per unit, for uniform binning
+  std::vector<double> _edges; // Empty for uniform binning
+
+public:
+  explicit histogram_axis(int bins, double low, double high);
+  explicit histogram_axis(const std::vector<double> &edges);
+
+  /// Returns the number of bins, without underflow and overflow
+  int bins() const { return _bins; }
+
+  /// Returns the lower edge of the first bin
+  double low() const { return _low; }
+
+  /// Returns the upper edge of the last bin
+  double high() const { return _high; }
+
+  /// Returns @c true if all bins have the same width
+  bool uniform() const { return _edges.empty(); }
+
+  std::vector<double> edges() const;
+
+  int index(double x) const;
+  void index(const float *values, int count, int *bins) const;
+
+  bool operator== (const histogram_axis &other) const;
+
+  /// Compares two axes for inequality
+  bool operator!= (const histogram_axis &other) const
+  {
+    return !(*this == other);
+  }
+};
+
+/// Bin contents shared by @ref histogram and @ref histogram2d
+/**
+ * Every bin is stored once per replica; the replicas are summed when the
+ * contents are read.
+ */
+class histogram_contents
+{
+  int _cells;    // Including underflows and overflows
+  int _replicas;
+  std::vector<double> _sums;
+  std::vector<double> _sumw2; // Empty until the first weighted fill
+  unsigned long _entries;
+
+public:
+  explicit histogram_contents(int cells, int replicas);
+
+  /// Returns the number of replicas
+  int replicas() const { return _replicas; }
+
+  void add(int *cells, int count, const float *weights);
+  void add(int cell, double weight);
+
+  double sum(int cell) const;
+  double sumw2(int cell) const;
+
+  /// Returns @c true if weights other than 1 were used
+  bool weighted() const { return !_sumw2.empty(); }
+
+  /// Returns the number of values filled
+  unsigned long entries() const { return _entries; }
+
+  void reset();
+  void merge(const histogram_contents &other);
+};
+
+class histogram
+{
+  histogram_axis _axis;
+  histogram_contents _contents;
+
+public:
+  explicit histogram(const histogram_axis &axis, int replicas = 4);
+
+  /// Returns the binning
+  const histogram_axis &axis() const { return _axis; }
+
+  void fill(double x, double weight = 1);
+  void fill(const float *values, int count, const float *weights = nullptr);
+  void fill(const float *values,
+            const tower_mask &mask,
+            const float *weights = nullptr);
+
+  /// Returns the sum of weights in a bin
+  /**
+   * Bin 0 is the underflow and bin <tt>axis().bins() + 1</tt> the overflow,
+   * like in ROOT.
+   */
+  double content(int bin) const { return _contents.sum(bin); }
+
+  double error(int bin) const;
+
+  /// Returns the number of values filled
+  unsigned long entries() const { return _contents.entries(); }
+
+  /// Sets all bins to zero
+  void reset() { _contents.reset(); }
+
+  histogram &operator+= (const histogram &other);
+
+  TH1F *to_root(const std::string &name, const std::string &title = "") const;
+};
+
+class histogram2d
+{
+  histogram_axis _xaxis;
+  histogram_axis _yaxis;
+  histogram_contents _contents;
+
+  void index(const float *x, const float *y, int count, int *cells) const;
+
+public:
+  explicit histogram2d(const histogram_axis &xaxis,
+                       const histogram_axis &yaxis,
+                       int replicas = 4);
+
+  /// Returns the binning along @f$x@f$
+  const histogram_axis &xaxis() const { return _xaxis; }
+
+  /// Returns the binning along @f$y@f$
+  const histogram_axis &yaxis() const { return _yaxis; }
+
+  void fill(double x, double y, double weight = 1);
+  void fill(const float *x,
+            const float *y,
+            int count,
+            const float *weights = nullptr);
+  void fill(const float *x,
+            const float *y,
+            const tower_mask &mask,
+            const float *weights = nullptr);
+
+  /// Returns the sum of weights in a bin
+  /**
+   * Bins are numbered like in @ref histogram along each axis.
+   */
+  double content(int xbin, int ybin) const
+  {
+    return _contents.sum(xbin * (_yaxis.bins() + 2) + ybin);
+  }
+
+  double error(int xbin, int ybin) const;
+
+  /// Returns the number of values filled
+  unsigned long entries() const { return _contents.entries(); }
+
+  /// Sets all bins to zero
+  void reset() { _contents.reset(); }
+
+  histogram2d &operator+= (const histogram2d &other);
+
+  TH2F *to_root(const std::string &name, const std::string &title = "") const;
+};
+
+} // namespace calo
+
+#endif // CALCLEAN_HISTOGRAM
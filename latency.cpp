@@ -0,0 +1,268 @@
+#include "latency.h"
+
+/**
+ * @file
+ * @brief  Source for per-event latency distributions
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+namespace calo {
+
+namespace {
+  // Names of the stages in reports
+  const char *const stage_names[event_latency::stages] = {
+    "getentry", "filter", "task", "total"
+  };
+
+  // Orders slow events by decreasing total time.
+  bool slower(const event_latency::slow_event &a,
+              const event_latency::slow_event &b)
+  {
+    return a.seconds[event_latency::total] > b.seconds[event_latency::total];
+  }
+}
+
+/**
+ * @class latency_histogram calclean/latency.h
+ * @brief A distribution of durations with a bounded relative error.
+ *
+ * Averages hide the few events that take much longer than the others, which
+ * are what matters when events must be processed within a fixed time. This
+ * class keeps the whole distribution of durations in log-linear bins, like
+ * HdrHistogram: durations are stored in nanoseconds, with one bin per
+ * nanosecond below 64 ns and 32 bins per power of two above. Percentiles are
+ * therefore known within about 3%, from nanoseconds to hours.
+ *
+ * The bins are a fixed array inside the object: recording a duration doesn't
+ * allocate memory and takes a few nanoseconds. The class doesn't use
+ * pointers, so objects can be copied to memory shared between processes.
+ * Objects aren't thread-safe; use one per thread and merge() them at the end.
+ */
+
+/// Returns the shortest duration in a bin, in nanoseconds
+unsigned long latency_histogram::lower(int bin)
+{
+  if (bin < 2 * sub_bins) {
+    return bin;
+  }
+  const int shift = bin / sub_bins - 1;
+  return (unsigned long) (bin % sub_bins + sub_bins) << shift;
+}
+
+/// Returns the longest duration in a bin, in nanoseconds
+unsigned long latency_histogram::upper(int bin)
+{
+  if (bin < 2 * sub_bins) {
+    return bin;
+  }
+  const int shift = bin / sub_bins - 1;
+  return lower(bin) + ((1ul << shift) - 1);
+}
+
+/// Returns the duration below which a fraction @c p of durations lie, in
+/// seconds
+/**
+ * @c p is between 0 and 1; for instance, the 99th percentile is
+ * <tt>percentile(0.99)</tt>. The result is the longest duration in the bin
+ * containing the percentile, but not more than max(). Returns 0 if no
+ * duration was recorded.
+ */
+double latency_histogram::percentile(double p) const
+{
+  if (_count == 0) {
+    return 0;
+  }
+  const double rank = std::max(1.0, std::ceil(p * _count));
+  unsigned long seen = 0;
+  for (int b = 0; b < bins; ++b) {
+    seen += _counts[b];
+    if (seen >= rank) {
+      return 1e-9 * std::min(upper(b), _max);
+    }
+  }
+  return max();
+}
+
+/// Forgets all durations
+void latency_histogram::reset()
+{
+  std::fill(_counts, _counts + bins, 0);
+  _count = 0;
+  _min = 0;
+  _max = 0;
+  _sum = 0;
+}
+
+/// Adds the durations recorded in another histogram
+void latency_histogram::merge(const latency_histogram &other)
+{
+  if (other._count == 0) {
+    return;
+  }
+  for (int b = 0; b < bins; ++b) {
+    _counts[b] += other._counts[b];
+  }
+  if (_count == 0 || other._min < _min) {
+    _min = other._min;
+  }
+  _max = std::max(_max, other._max);
+  _count += other._count;
+  _sum += other._sum;
+}
+
+/**
+ * @class event_latency calclean/latency.h
+ * @brief Distributions of the time spent processing every event.
+ *
+ * The processing of an event is split into stages: loading the entry,
+ * evaluating the event filter and running the user code. The time spent in
+ * every stage is recorded in a @ref latency_histogram, as well as the total
+ * per event. The slowest events are kept with their entry number and size, so
+ * that they can be reprocessed on their own.
+ *
+ * @ref event_loop records these distributions when asked to:
+ *
+ * ~~~~{.cpp}
+ * event_loop loop("data.root", 8);
+ * loop.set_latency(true);
+ * loop.run(task);
+ * loop.latency().report(std::cout);
+ * ~~~~
+ *
+ * They can also be recorded by hand, measuring time with @ref seconds:
+ *
+ * ~~~~{.cpp}
+ * event_latency latency;
+ * for (unsigned long i = 0; i < set.entries(); ++i) {
+ *   double start = seconds();
+ *   set.getentry(i);
+ *   latency.record(event_latency::read, seconds() - start);
+ *   // ...
+ *   latency.end_event(i, set.size());
+ * }
+ * ~~~~
+ *
+ * Like @ref latency_histogram, this class doesn't allocate memory and can be
+ * copied between processes.
+ */
+
+/// Ends the event being timed
+/**
+ * The sum of the stages recorded since the previous call is recorded as the
+ * total time of the event. @c entry and @c size identify the event in the list
+ * of the slowest ones.
+ */
+void event_latency::end_event(unsigned long entry, int size)
+{
+  slow_event event;
+  event.entry = entry;
+  event.size = size;
+  event.seconds[total] = 0;
+  for (int s = 0; s < total; ++s) {
+    event.seconds[s] = _current[s];
+    event.seconds[total] += _current[s];
+    _current[s] = 0;
+  }
+  _histograms[total].record(event.seconds[total]);
+  keep(event);
+}
+
+// Adds an event to the slowest ones if it is slow enough.
+void event_latency::keep(const slow_event &event)
+{
+  if (_slow < slowest_count) {
+    _slowest[_slow++] = event;
+    return;
+  }
+  slow_event *fastest = std::max_element(_slowest, _slowest + _slow, slower);
+  if (slower(event, *fastest)) {
+    *fastest = event;
+  }
+}
+
+/// Returns the slowest events, slowest first
+std::vector<event_latency::slow_event> event_latency::slowest() const
+{
+  std::vector<slow_event> result(_slowest, _slowest + _slow);
+  std::sort(result.begin(), result.end(), slower);
+  return result;
+}
+
+/// Forgets all events
+void event_latency::reset()
+{
+  for (int s = 0; s < stages; ++s) {
+    _histograms[s].reset();
+    _current[s] = 0;
+  }
+  _slow = 0;
+}
+
+/// Adds the events recorded in another object
+void event_latency::merge(const event_latency &other)
+{
+  for (int s = 0; s < stages; ++s) {
+    _histograms[s].merge(other._histograms[s]);
+  }
+  for (int e = 0; e < other._slow; ++e) {
+    keep(other._slowest[e]);
+  }
+}
+
+/// Prints the percentiles of every stage and the slowest events
+/**
+ * Durations are printed in microseconds.
+ *
+ * @warning
+ * This function is there for logging purposes; the format of the output
+ * should not be relied on.
+ */
+void event_latency::report(std::ostream &out) const
+{
+  const std::ios::fmtflags flags = out.flags();
+  const std::streamsize precision = out.precision();
+  out << std::left << std::setw(10) << "stage" << std::right
+      << std::setw(12) << "events"
+      << std::setw(12) << "p50"
+      << std::setw(12) << "p99"
+      << std::setw(12) << "p99.9"
+      << std::setw(12) << "max" << "   [us]" << std::endl;
+  out << std::fixed << std::setprecision(1);
+  for (int s = 0; s < stages; ++s) {
+    const latency_histogram &h = _histograms[s];
+    out << std::left << std::setw(10) << stage_names[s] << std::right
+        << std::setw(12) << h.count()
+        << std::setw(12) << 1e6 * h.percentile(0.5)
+        << std::setw(12) << 1e6 * h.percentile(0.99)
+        << std::setw(12) << 1e6 * h.percentile(0.999)
+        << std::setw(12) << 1e6 * h.max() << std::endl;
+  }
+
+  const std::vector<slow_event> events = slowest();
+  if (!events.empty()) {
+    out << std::endl << "slowest events:" << std::endl
+        << std::setw(12) << "entry" << std::setw(8) << "towers"
+        << std::setw(12) << stage_names[total];
+    for (int s = 0; s < total; ++s) {
+      out << std::setw(12) << stage_names[s];
+    }
+    out << "   [us]" << std::endl;
+    for (unsigned e = 0; e < events.size(); ++e) {
+      out << std::setw(12) << events[e].entry
+          << std::setw(8) << events[e].size
+          << std::setw(12) << 1e6 * events[e].seconds[total];
+      for (int s = 0; s < total; ++s) {
+        out << std::setw(12) << 1e6 * events[e].seconds[s];
+      }
+      out << std::endl;
+    }
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+} // namespace calo
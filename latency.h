@@ -0,0 +1,162 @@
+#ifndef CALCLEAN_LATENCY
+#define CALCLEAN_LATENCY
+
+/**
+ * @file
+ * @brief  Header for per-event latency distributions
+ */
+
+#include <climits>
+#include <iosfwd>
+#include <vector>
+
+namespace calo {
+
+class latency_histogram
+{
+public:
+  /// The number of bins per power of two, above 64 ns
+  static const int sub_bins = 32;
+
+  /// The number of bins, enough for any 64-bit duration in nanoseconds
+  static const int bins = 60 * sub_bins;
+
+private:
+  unsigned long _counts[bins];
+  unsigned long _count;
+  unsigned long _min; // In ns
+  unsigned long _max; // In ns
+  double _sum;        // In seconds
+
+public:
+  latency_histogram() { reset(); }
+
+  static int bin(unsigned long ns);
+  static unsigned long lower(int bin);
+  static unsigned long upper(int bin);
+
+  void record(double seconds);
+
+  /// Returns the number of durations recorded
+  unsigned long count() const { return _count; }
+
+  /// Returns the shortest duration recorded, in seconds
+  double min() const { return 1e-9 * _min; }
+
+  /// Returns the longest duration recorded, in seconds
+  double max() const { return 1e-9 * _max; }
+
+  /// Returns the average duration, in seconds
+  double mean() const { return _count > 0 ? _sum / _count : 0; }
+
+  double percentile(double p) const;
+
+  void reset();
+  void merge(const latency_histogram &other);
+};
+
+class event_latency
+{
+public:
+  /// The parts of the processing of an event that are timed
+  enum stage
+  {
+    read,    ///< Loading the entry, see @ref towerset::getentry
+    select,  ///< Evaluating the @ref event_filter
+    process, ///< Running the user code
+    total    ///< Everything above, for every event
+  };
+
+  /// The number of stages, including @ref total
+  static const int stages = 4;
+
+  /// The number of slowest events kept
+  static const int slowest_count = 16;
+
+  /// An event that took long to process
+  struct slow_event
+  {
+    /// Entry number in the tree
+    unsigned long entry;
+
+    /// Number of towers in the event (@c CaloSize)
+    int size;
+
+    /// Time spent in every stage, in seconds
+    double seconds[stages];
+  };
+
+private:
+  latency_histogram _histograms[stages];
+  double _current[stages]; // Stages of the event being timed
+  slow_event _slowest[slowest_count]; // Unordered
+  int _slow;
+
+  void keep(const slow_event &event);
+
+public:
+  event_latency() { reset(); }
+
+  /// Adds the time spent in a stage by the current event
+  /**
+   * The time is recorded in the distribution of the stage right away, and
+   * counted in the total of the event when end_event() is called.
+   */
+  void record(stage s, double seconds)
+  {
+    _histograms[s].record(seconds);
+    _current[s] += seconds;
+  }
+
+  void end_event(unsigned long entry, int size);
+
+  /// Returns the distribution of the time spent in a stage
+  const latency_histogram &histogram(stage s) const { return _histograms[s]; }
+
+  std::vector<slow_event> slowest() const;
+
+  void reset();
+  void merge(const event_latency &other);
+  void report(std::ostream &out) const;
+};
+
+/// Records a duration
+/**
+ * Negative durations are counted as 0.
+ */
+inline void latency_histogram::record(double seconds)
+{
+  const unsigned long ns = seconds > 0 ? (unsigned long) (1e9 * seconds) : 0;
+  ++_counts[bin(ns)];
+  if (_count == 0 || ns < _min) {
+    _min = ns;
+  }
+  if (ns > _max) {
+    _max = ns;
+  }
+  ++_count;
+  _sum += seconds > 0 ? seconds : 0;
+}
+
+/// Returns the bin containing a duration in nanoseconds
+/**
+ * Durations below 64 ns have one bin per nanosecond. Above, every power of two
+ * is divided into @ref sub_bins bins, so that the width of a bin is at most
+ * 1/32 of the durations it contains.
+ */
+inline int latency_histogram::bin(unsigned long ns)
+{
+  // Find the largest shift leaving at least sub_bins, by bisection
+  const int bits = sizeof(unsigned long) * CHAR_BIT;
+  int shift = 0;
+  for (int step = 32; step > 0; step /= 2) {
+    if (shift + step < bits && (ns >> (shift + step)) >= sub_bins) {
+      shift += step;
+    }
+  }
+  return shift * sub_bins + int(ns >> shift);
+}
+
+} // namespace calo
+
+#endif // CALCLEAN_LATENCY
@@ -34,7 +34,8 @@ class and_filter : public filter
 public:
   /// Creates a filter that returns @c true when both @c lhs and @c rhs are
   /// @c true
-  and_filter(const filter *lhs, const filter *rhs) : _lhs(lhs), _rhs(rhs) {}
+  CALO_CONSTEXPR and_filter(const filter *lhs, const filter *rhs) :
+    _lhs(lhs), _rhs(rhs) {}
 
   inline bool operator() (const tower_ref &tower) const;
 };
@@ -44,7 +45,7 @@ bool and_filter::operator() (const tower_ref &tower) const
   const filter &lhs = *_lhs;
   const filter &rhs = *_rhs;
   const tower_ref t = tower; // ROOT's pseudo-C++ parser
-  return lhs(t) && rhs(t);
+  return CALO_FILTER_CALL(lhs, t) && CALO_FILTER_CALL(rhs, t);
 }
 
 /// A filter that implements a logical OR between two filters
@@ -59,7 +60,8 @@ class or_filter : public filter
 public:
   /// Creates a filter that returns @c true when at least one of @c lhs and
   /// @c rhs is @c true
-  or_filter(const filter *lhs, const filter *rhs) : _lhs(lhs), _rhs(rhs) {}
+  CALO_CONSTEXPR or_filter(const filter *lhs, const filter *rhs) :
+    _lhs(lhs), _rhs(rhs) {}
 
   inline bool operator() (const tower_ref &tower) const;
 };
@@ -69,7 +71,7 @@ bool or_filter::operator() (const tower_ref &tower) const
   const filter &lhs = *_lhs;
   const filter &rhs = *_rhs;
   const tower_ref t = tower; // ROOT's pseudo-C++ parser
-  return lhs(t) || rhs(t);
+  return CALO_FILTER_CALL(lhs, t) || CALO_FILTER_CALL(rhs, t);
 }
 
 /// A filter that negates another (logical NOT)
@@ -83,7 +85,7 @@ class not_filter : public filter
   const filter *_arg;
 public:
   /// Creates a filter that returns @c true when @c arg is @c false
-  explicit not_filter(const filter *arg) : _arg(arg) {}
+  explicit CALO_CONSTEXPR not_filter(const filter *arg) : _arg(arg) {}
 
   inline bool operator() (const tower_ref &tower) const;
 };
@@ -92,7 +94,7 @@ bool not_filter::operator() (const tower_ref &tower) const
 {
   const filter &arg = *_arg;
   const tower_ref t = tower; // ROOT's pseudo-C++ parser
-  return !arg(t);
+  return !CALO_FILTER_CALL(arg, t);
 }
 
 } // namespace calo
@@ -0,0 +1,533 @@
+#include "loop.h"
+
+/**
+ * @file
+ * @brief  Source for the multi-process event loop
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <TFile.h>
+
+#include "eventfilter.h"
+#include "timing.h"
+#include "trace.h"
+
+namespace calo {
+
+/**
+ * @class event_loop calclean/loop.h
+ * @brief Processes the entries of a file in several processes.
+ *
+ * ROOT objects can't safely be shared between threads, especially with older
+ * versions of ROOT. An @c event_loop avoids threads altogether: it splits the
+ * entries of a file into contiguous ranges and forks one worker process per
+ * range. Every worker opens the file on its own, loads its entries into a
+ * @ref towerset and passes them to an @ref event_task:
+ *
+ * ~~~~{.cpp}
+ * class hot_towers : public event_task
+ * {
+ * public:
+ *   int towers, map, events;
+ *
+ *   void process(const towerset &set, loop_output &out)
+ *   {
+ *     for (towerset::iterator it = set.begin(&hoteb); it != set.end(); ++it) {
+ *       out.count(towers);
+ *       out.fill(map, *it);
+ *       out.select(events);
+ *     }
+ *   }
+ * };
+ *
+ * event_loop loop("data.root", 8);
+ * hot_towers task;
+ * task.towers = loop.add_counter();
+ * task.map = loop.add_occupancy();
+ * task.events = loop.add_list();
+ * loop.run(task);
+ * std::cout << loop.counter(task.towers) << " hot towers in "
+ *           << loop.list(task.events).size() << " events" << std::endl;
+ * ~~~~
+ *
+ * Results are integer counters, occupancy maps counting towers on the
+ * @f$(i_\eta, i_\phi)@f$ grid, and @ref event_list "event lists". Every
+ * worker writes them to its own part of a memory region shared with the
+ * parent process, which adds them up once all workers are done. Since the
+ * results are integers and lists are merged in the order of the ranges, they
+ * are identical to those of a serial run. Floating-point sums can be made
+ * exact in the same way with @ref event_summary::deterministic summation,
+ * converted to integers.
+ *
+ * The exit status of every worker is checked. If a worker crashes, throws an
+ * exception or doesn't finish its range, run() throws an exception
+ * (@c std::runtime_error) giving the range of entries concerned; details are
+ * available from failures(). The results of the other workers are merged
+ * anyway, but they are incomplete.
+ *
+ * Events can be selected before they reach the task with an
+ * @ref event_filter, see set_event_filter(). Event-level columns and runs
+ * used by the filters are set up by overriding @ref event_task::configure,
+ * which receives the set of every worker before it reads its first entry. The
+ * time spent on every entry
+ * can be recorded with set_latency(), to find the events that are slow to
+ * process, and a timeline of all workers can be saved with set_trace().
+ *
+ * With a single worker, entries are processed in the calling process without
+ * forking, which is convenient for debugging. Workers are started with
+ * @c fork(), so this class is only available on POSIX systems, and the
+ * calling process must not have started threads. Output streams are flushed
+ * before forking so that buffered text isn't printed twice.
+ */
+
+namespace {
+  // Status of a worker, at the beginning of its part of the shared region
+  struct worker_status
+  {
+    int done;
+    unsigned long processed;
+    unsigned long selected;
+    char message[256];
+  };
+
+  // Number of cells in an occupancy map
+  const int map_cells = loop_output::eta_cells * loop_output::phi_cells;
+
+  // Returns the file where a worker writes its trace.
+  std::string trace_part(const std::string &path, int worker)
+  {
+    std::ostringstream ss;
+    ss << path << "." << worker;
+    return ss.str();
+  }
+
+  // Returns a human-readable description of a failed worker.
+  std::string describe(const loop_failure &failure)
+  {
+    std::ostringstream ss;
+    ss << "worker " << failure.worker << " (entries " << failure.first
+       << " to " << failure.end - 1 << "): " << failure.reason;
+    return ss.str();
+  }
+}
+
+/// Constructs a loop over the @c CaloTree in file @c path
+/**
+ * An exception is thrown if @c workers is smaller than 1
+ * (@c std::invalid_argument).
+ */
+event_loop::event_loop(const std::string &path, int workers) :
+  _path(path),
+  _workers(workers),
+  _event_filter(nullptr),
+  _timed(false),
+  _processed(0),
+  _selected(0)
+{
+  if (workers < 1) {
+    throw std::invalid_argument("event_loop: need at least one worker");
+  }
+}
+
+/// Sets the filter used to select events
+/**
+ * Entries rejected by the filter are skipped: the task isn't called for them.
+ * The filter is evaluated in the worker processes, after the entry is loaded
+ * (see @ref towerset::set_event_filter). Passing @c null processes all
+ * entries, which is the default.
+ */
+void event_loop::set_event_filter(const event_filter *f)
+{
+  _event_filter = f;
+}
+
+/// Enables the timing of every entry
+/**
+ * When enabled, the time spent loading every entry, evaluating the event
+ * filter and running the task is recorded by the workers and available from
+ * latency() after run(). The filter is then evaluated by the loop instead of
+ * @ref towerset::getentry, so that it is timed separately. Timing costs four
+ * calls to @ref seconds per entry and is disabled by default.
+ */
+void event_loop::set_latency(bool timed)
+{
+  _timed = timed;
+}
+
+/// Saves a timeline of the next runs to @c path
+/**
+ * When @c path isn't empty, run() records a @ref trace of the parent process
+ * and all workers, and writes it to @c path in the Chrome trace format. Every
+ * worker writes its events to <tt>path.N</tt>, where @c N is the number of
+ * the worker, and the parent merges them. Tracing is stopped at the end of
+ * run(). Passing an empty path disables tracing, which is the default.
+ */
+void event_loop::set_trace(const std::string &path)
+{
+  _trace = path;
+}
+
+/// Adds a counter, and returns the number to use in @ref loop_output::count
+int event_loop::add_counter()
+{
+  _counters.push_back(0);
+  return _counters.size() - 1;
+}
+
+/// Adds an occupancy map, and returns the number to use in
+/// @ref loop_output::fill
+int event_loop::add_occupancy()
+{
+  _maps.resize(_maps.size() + map_cells, 0);
+  return _maps.size() / map_cells - 1;
+}
+
+/// Adds an event list, and returns the number to use in
+/// @ref loop_output::select
+int event_loop::add_list()
+{
+  _lists.push_back(event_list());
+  return _lists.size() - 1;
+}
+
+/// Returns the number of towers counted in a cell of an occupancy map
+/**
+ * An exception is thrown if the map or the cell doesn't exist
+ * (@c std::out_of_range).
+ */
+long event_loop::occupancy(int id, int ieta, int iphi) const
+{
+  const int row = ieta + loop_output::eta_cells / 2;
+  const int n = loop_output::phi_cells;
+  if (id < 0 || row < 0 || row >= loop_output::eta_cells) {
+    throw std::out_of_range("event_loop::occupancy: no such cell");
+  }
+  return _maps.at((id * loop_output::eta_cells + row) * n
+                  + ((iphi + n / 2) % n + n) % n);
+}
+
+// Returns the size of the status and timing at the beginning of a part of the
+// shared region.
+std::size_t event_loop::header_size() const
+{
+  return sizeof(worker_status) + (_timed ? sizeof(event_latency) : 0);
+}
+
+// Returns the size of the part of the shared region used by a worker.
+std::size_t event_loop::slot_size(unsigned long capacity) const
+{
+  return header_size()
+       + (_counters.size() + _maps.size()) * sizeof(long)
+       + _lists.size() * (capacity + 1) * sizeof(unsigned long);
+}
+
+// Returns an output writing to the given part of the shared region. Event
+// lists are added to lists instead if it isn't null.
+loop_output event_loop::bind(char *slot,
+                             unsigned long capacity,
+                             std::vector<event_list> *lists) const
+{
+  loop_output out;
+  out._counters = reinterpret_cast<long *>(slot + header_size());
+  out._maps = out._counters + _counters.size();
+  out._lists = reinterpret_cast<unsigned long *>(out._maps + _maps.size());
+  out._capacity = capacity;
+  out._direct = lists;
+  out._entry = 0;
+  return out;
+}
+
+// Processes entries [first, end), writing the results to slot and, if it isn't
+// null, to lists.
+void event_loop::work(event_task &task,
+                      char *slot,
+                      unsigned long capacity,
+                      std::vector<event_list> *lists,
+                      unsigned long first,
+                      unsigned long end) const
+{
+  worker_status *status = reinterpret_cast<worker_status *>(slot);
+  loop_output out = bind(slot, capacity, lists);
+
+  const double opening = seconds();
+  TFile file(_path.c_str());
+  trace::complete("open", "io", opening, seconds());
+  if (file.IsZombie()) {
+    throw std::runtime_error("event_loop: cannot open " + _path);
+  }
+  towerset set(&file);
+  task.configure(set);
+  if (!_timed) {
+    set.set_event_filter(_event_filter);
+    for (unsigned long entry = first; entry < end; ++entry) {
+      if (set.getentry(entry)) {
+        out._entry = entry;
+        const trace::scope traced("process", "task", "entry", entry);
+        task.process(set, out);
+        ++status->selected;
+      }
+      ++status->processed;
+    }
+    status->done = 1;
+    return;
+  }
+
+  event_latency *latency =
+    new (slot + sizeof(worker_status)) event_latency();
+  for (unsigned long entry = first; entry < end; ++entry) {
+    double start = seconds();
+    set.getentry(entry);
+    double stop = seconds();
+    latency->record(event_latency::read, stop - start);
+
+    bool accepted = true;
+    if (_event_filter != nullptr) {
+      start = stop;
+      accepted = _event_filter->accept(set);
+      stop = seconds();
+      latency->record(event_latency::select, stop - start);
+      trace::complete("event_filter", "filter", start, stop);
+    }
+    if (accepted) {
+      out._entry = entry;
+      start = stop;
+      task.process(set, out);
+      stop = seconds();
+      latency->record(event_latency::process, stop - start);
+      trace::complete("process", "task", start, stop, "entry", entry);
+      ++status->selected;
+    }
+    latency->end_event(entry, set.size());
+    ++status->processed;
+  }
+  status->done = 1;
+}
+
+// Writes the trace of the parent and the workers, and stops tracing.
+void event_loop::write_trace(int workers) const
+{
+  trace::stop();
+  std::vector<std::string> parts;
+  for (int w = 0; w < workers; ++w) {
+    parts.push_back(trace_part(_trace, w));
+  }
+  trace::write(_trace, parts);
+  for (int w = 0; w < workers; ++w) {
+    std::remove(parts[w].c_str());
+  }
+}
+
+// Adds the results stored in a part of the shared region.
+void event_loop::merge(const char *slot, unsigned long capacity)
+{
+  const worker_status *status =
+    reinterpret_cast<const worker_status *>(slot);
+  _processed += status->processed;
+  _selected += status->selected;
+  if (_timed) {
+    _latency.merge(*reinterpret_cast<const event_latency *>(
+      slot + sizeof(worker_status)));
+  }
+
+  const long *values = reinterpret_cast<const long *>(slot + header_size());
+  for (unsigned i = 0; i < _counters.size(); ++i) {
+    _counters[i] += *values++;
+  }
+  for (unsigned i = 0; i < _maps.size(); ++i) {
+    _maps[i] += *values++;
+  }
+  const unsigned long *lists = reinterpret_cast<const unsigned long *>(values);
+  for (unsigned l = 0; l < _lists.size(); ++l) {
+    const unsigned long *list = lists + l * (capacity + 1);
+    for (unsigned long k = 1; k <= list[0]; ++k) {
+      _lists[l].add(list[k]);
+    }
+  }
+}
+
+/// Runs @c task over a range of entries
+/**
+ * Entries @c first to <tt>first + count - 1</tt> are processed, stopping at
+ * the end of the tree. They are split into one contiguous range per worker.
+ * All results are reset before starting.
+ *
+ * An exception is thrown if the file can't be opened or the shared memory
+ * can't be allocated (@c std::runtime_error), or if a worker fails (see
+ * failures()). Exceptions thrown by @c task in worker processes are reported
+ * as failures; with a single worker, they are passed to the caller.
+ */
+void event_loop::run(event_task &task,
+                     unsigned long first,
+                     unsigned long count)
+{
+  std::fill(_counters.begin(), _counters.end(), 0);
+  std::fill(_maps.begin(), _maps.end(), 0);
+  std::fill(_lists.begin(), _lists.end(), event_list());
+  _processed = _selected = 0;
+  _failures.clear();
+  _latency.reset();
+
+  unsigned long entries;
+  {
+    TFile file(_path.c_str());
+    if (file.IsZombie()) {
+      throw std::runtime_error("event_loop: cannot open " + _path);
+    }
+    entries = towerset(&file).entries();
+  }
+  const unsigned long last = first < entries
+                           ? first + std::min(count, entries - first)
+                           : first;
+  const unsigned long total = last - first;
+  const int workers = std::max(1, int(std::min<unsigned long>(_workers,
+                                                              total)));
+  const unsigned long capacity = (total + workers - 1) / workers;
+
+  if (!_trace.empty()) {
+    trace::start();
+    trace::set_process_name("event_loop");
+  }
+
+  if (workers == 1) {
+    // Lists grow as needed in-process: only the counters and maps need a
+    // buffer
+    const std::size_t size = slot_size(0);
+    std::vector<unsigned long> buffer(size / sizeof(unsigned long) + 1, 0);
+    char *slot = reinterpret_cast<char *>(&buffer[0]);
+    try {
+      work(task, slot, 0, &_lists, first, last);
+    } catch (...) {
+      std::fill(_lists.begin(), _lists.end(), event_list());
+      if (!_trace.empty()) {
+        write_trace(0);
+      }
+      throw;
+    }
+    merge(slot, 0);
+    if (!_trace.empty()) {
+      write_trace(0);
+    }
+    return;
+  }
+
+  const std::size_t size = slot_size(capacity);
+  int flags = MAP_SHARED | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE; // Lists are sized for the worst case
+#endif
+  void *region = mmap(nullptr, size * workers, PROT_READ | PROT_WRITE,
+                      flags, -1, 0);
+  if (region == MAP_FAILED) {
+    throw std::runtime_error("event_loop: cannot allocate shared memory");
+  }
+  char *slots = static_cast<char *>(region);
+
+  std::cout.flush();
+  std::cerr.flush();
+  std::fflush(nullptr);
+
+  std::vector<pid_t> pids(workers, -1);
+  std::vector<std::string> reasons(workers);
+  for (int w = 0; w < workers; ++w) {
+    const unsigned long begin = first + w * capacity;
+    const unsigned long end = std::min(last, begin + capacity);
+    pids[w] = fork();
+    if (pids[w] < 0) {
+      reasons[w] = std::string("fork failed: ") + std::strerror(errno);
+    } else if (pids[w] == 0) {
+      worker_status *status = reinterpret_cast<worker_status *>(
+        slots + w * size);
+      int code = 0;
+      if (!_trace.empty()) {
+        std::ostringstream name;
+        name << "worker " << w;
+        trace::clear(); // Events of the parent
+        trace::set_process_name(name.str());
+      }
+      try {
+        work(task, slots + w * size, capacity, nullptr, begin, end);
+      } catch (std::exception &e) {
+        std::strncpy(status->message, e.what(), sizeof(status->message) - 1);
+        code = 1;
+      } catch (...) {
+        std::strcpy(status->message, "unknown exception");
+        code = 1;
+      }
+      if (!_trace.empty()) {
+        try {
+          trace::write(trace_part(_trace, w));
+        } catch (std::exception &) {
+          // The trace misses this worker, but the results are complete
+        }
+      }
+      std::cout.flush();
+      std::cerr.flush();
+      std::fflush(nullptr);
+      _exit(code); // Don't run the destructors of the parent's objects
+    }
+  }
+
+  for (int w = 0; w < workers; ++w) {
+    const unsigned long begin = first + w * capacity;
+    const unsigned long end = std::min(last, begin + capacity);
+    const char *slot = slots + w * size;
+    const worker_status *status =
+      reinterpret_cast<const worker_status *>(slot);
+
+    std::ostringstream reason;
+    reason << reasons[w];
+    int code = 0;
+    if (pids[w] > 0) {
+      const trace::scope traced("wait", "loop", "worker", w);
+      while (waitpid(pids[w], &code, 0) < 0 && errno == EINTR) {}
+      if (WIFSIGNALED(code)) {
+        reason << "killed by signal " << WTERMSIG(code);
+      } else if (status->message[0] != 0) {
+        reason << status->message;
+      } else if (WEXITSTATUS(code) != 0) {
+        reason << "exit status " << WEXITSTATUS(code);
+      } else if (!status->done) {
+        reason << "stopped after " << status->processed << " entries";
+      }
+    }
+
+    if (reason.str().empty()) {
+      const trace::scope traced("merge", "loop", "worker", w);
+      merge(slot, capacity);
+    } else {
+      loop_failure failure;
+      failure.worker = w;
+      failure.first = begin;
+      failure.end = end;
+      failure.reason = reason.str();
+      _failures.push_back(failure);
+    }
+  }
+  munmap(region, size * workers);
+  if (!_trace.empty()) {
+    write_trace(workers);
+  }
+
+  if (!_failures.empty()) {
+    std::string msg = "event_loop::run: ";
+    for (unsigned i = 0; i < _failures.size(); ++i) {
+      msg += (i > 0 ? "; " : "") + describe(_failures[i]);
+    }
+    throw std::runtime_error(msg);
+  }
+}
+
+} // namespace calo
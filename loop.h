@@ -0,0 +1,213 @@
+#ifndef CALCLEAN_LOOP
+#define CALCLEAN_LOOP
+
+/**
+ * @file
+ * @brief  Header for the multi-process event loop
+ */
+
+#include <string>
+
+#include "calofilter.h"
+#include "eventlist.h"
+#include "latency.h"
+
+namespace calo {
+
+/// Where a worker of an @ref event_loop writes its results
+/**
+ * The results are stored in memory shared with the process that started the
+ * loop. Counters, maps and lists are referred to by the numbers returned by
+ * @ref event_loop::add_counter, @ref event_loop::add_occupancy and
+ * @ref event_loop::add_list.
+ */
+class loop_output
+{
+  friend class event_loop;
+
+  long *_counters;
+  long *_maps;
+  unsigned long *_lists;
+  unsigned long _capacity;
+  std::vector<event_list> *_direct; // Lists filled in-process, or null
+  unsigned long _entry;
+
+  loop_output() {}
+
+public:
+  /// The number of @f$i_\eta@f$ values in an occupancy map
+  static const int eta_cells = 128;
+
+  /// The number of @f$i_\phi@f$ values in an occupancy map
+  static const int phi_cells = 72;
+
+  /// Returns the entry being processed
+  unsigned long entry() const { return _entry; }
+
+  /// Adds @c n to a counter
+  void count(int counter, long n = 1) { _counters[counter] += n; }
+
+  inline void fill(int map, int ieta, int iphi);
+
+  /// Adds a tower to an occupancy map
+  void fill(int map, const tower_ref &t) { fill(map, t.ieta(), t.iphi()); }
+
+  inline void select(int list);
+};
+
+/// A user-defined analysis run by an @ref event_loop
+class event_task
+{
+public:
+  /// Destructor
+  virtual ~event_task() {}
+
+  /// Prepares the set of a worker, before the first entry is read
+  /**
+   * This is the place to call @ref towerset::read_run,
+   * @ref towerset::add_event_column or @ref towerset::set_cache_size, which
+   * event filters and tower filters may rely on. It is called once in every
+   * worker, in the order the calls must be made to get the same columns
+   * everywhere. Does nothing by default.
+   */
+  virtual void configure(towerset &) {}
+
+  /// Processes the current event of @c set
+  /**
+   * @c out.entry() gives the entry that was loaded.
+   */
+  virtual void process(const towerset &set, loop_output &out) = 0;
+};
+
+/// Describes a worker of an @ref event_loop that didn't complete its range
+struct loop_failure
+{
+  /// Number of the worker
+  int worker;
+
+  /// First entry of the range given to the worker
+  unsigned long first;
+
+  /// Entry past the end of the range
+  unsigned long end;
+
+  /// What went wrong
+  std::string reason;
+};
+
+class event_loop
+{
+  std::string _path;
+  int _workers;
+  const event_filter *_event_filter;
+  bool _timed;
+  std::string _trace;
+
+  // Merged results
+  std::vector<long> _counters;
+  std::vector<long> _maps;
+  std::vector<event_list> _lists;
+  unsigned long _processed;
+  unsigned long _selected;
+  std::vector<loop_failure> _failures;
+  event_latency _latency;
+
+  std::size_t header_size() const;
+  std::size_t slot_size(unsigned long capacity) const;
+  loop_output bind(char *slot,
+                   unsigned long capacity,
+                   std::vector<event_list> *lists) const;
+  void work(event_task &task,
+            char *slot,
+            unsigned long capacity,
+            std::vector<event_list> *lists,
+            unsigned long first,
+            unsigned long end) const;
+  void merge(const char *slot, unsigned long capacity);
+  void write_trace(int workers) const;
+
+public:
+  explicit event_loop(const std::string &path, int workers = 1);
+
+  /// Returns the number of worker processes
+  int workers() const { return _workers; }
+
+  void set_event_filter(const event_filter *f);
+  void set_latency(bool timed);
+  void set_trace(const std::string &path);
+
+  int add_counter();
+  int add_occupancy();
+  int add_list();
+
+  void run(event_task &task,
+           unsigned long first = 0,
+           unsigned long count = ULONG_MAX);
+
+  /// Returns the number of entries read by the last run
+  /**
+   * This includes entries rejected by the event filter.
+   */
+  unsigned long processed() const { return _processed; }
+
+  /// Returns the number of entries passed to the task by the last run
+  /**
+   * This is the number of entries accepted by the event filter, see
+   * set_event_filter().
+   */
+  unsigned long selected() const { return _selected; }
+
+  /// Returns the value of a counter after run()
+  long counter(int id) const { return _counters.at(id); }
+
+  long occupancy(int id, int ieta, int iphi) const;
+
+  /// Returns the entries added to a list after run(), in increasing order
+  const event_list &list(int id) const { return _lists.at(id); }
+
+  /// Returns the time spent on every entry by the last run
+  /**
+   * Only available when enabled with set_latency().
+   */
+  const event_latency &latency() const { return _latency; }
+
+  /// Returns the workers that failed during the last run
+  const std::vector<loop_failure> &failures() const { return _failures; }
+};
+
+/// Adds a tower at the given logical coordinates to an occupancy map
+/**
+ * Towers with @f$i_\eta@f$ outside of [-64, 63] are ignored.
+ */
+void loop_output::fill(int map, int ieta, int iphi)
+{
+  const int row = ieta + eta_cells / 2;
+  if (row >= 0 && row < eta_cells) {
+    const int column = ((iphi + phi_cells / 2) % phi_cells + phi_cells)
+                     % phi_cells;
+    ++_maps[(map * eta_cells + row) * phi_cells + column];
+  }
+}
+
+/// Adds the current entry to a list
+/**
+ * Adding the same entry several times has no effect.
+ */
+void loop_output::select(int list)
+{
+  if (_direct != nullptr) {
+    event_list &l = (*_direct)[list];
+    if (!l.contains(_entry)) {
+      l.add(_entry);
+    }
+    return;
+  }
+  unsigned long *l = _lists + list * (_capacity + 1);
+  if (l[0] == 0 || l[l[0]] != _entry) {
+    l[++l[0]] = _entry;
+  }
+}
+
+} // namespace calo
+
+#endif // CALCLEAN_LOOP
@@ -0,0 +1,284 @@
+#include "probe.h"
+#include "calofilter.h"
+
+/**
+ * @file
+ * @brief  Source for the optional instrumentation of the framework
+ */
+
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+#ifdef __GNUG__
+# include <cstdlib>
+# include <cxxabi.h>
+#endif
+
+#if __cplusplus >= 201103L
+/// Storage class for thread-local variables
+# define CALO_THREAD_LOCAL thread_local
+#else
+# define CALO_THREAD_LOCAL __thread
+#endif
+
+/**
+ * @namespace calo::probe
+ *
+ * When @c CALO_INSTRUMENT is defined, every filter call made by the framework
+ * (through @ref towerset::iterator, the @ref logic filters, @ref filter_bank,
+ * ...) records the number of calls, the number of towers that passed and the
+ * time spent in the filter. The time spent reading data in
+ * @ref towerset::getentry is recorded as well.
+ *
+ * Counters are stored in a small hash table private to each thread, so
+ * recording a call needs neither locks nor atomic operations. Time is measured
+ * using @ref ticks. At the end of the job, counters from all threads are
+ * merged and a summary table is printed to @c std::cerr:
+ *
+ * ~~~~
+ * name                              calls      passes  pass rate   ticks/call    share
+ * calo::goodeb_filter             1520412      103512     0.0681        112.4   61.25%
+ * towerset::getentry                10000                              3890.2   13.94%
+ * ...
+ * ~~~~
+ *
+ * The time per call includes the time spent in nested filters and sections,
+ * whereas the share excludes it: shares add up to 100% of the recorded time.
+ *
+ * Filters are identified by their address and shown under their type name,
+ * unless a name is given with label(). The summary can also be printed at any
+ * time with summary().
+ */
+
+namespace calo {
+namespace probe {
+
+namespace {
+  const std::size_t table_size = 256; // Must be a power of 2
+
+  // A counter and its identification
+  struct entry
+  {
+    const void *key;
+    const char *name;
+    counters data;
+  };
+
+  // Counters recorded by a single thread
+  struct table
+  {
+    entry entries[table_size];
+    counters overflow; // Used when the table is full
+    double nested;     // Time spent in nested calls of the innermost one
+    table *next;
+  };
+
+  // All tables ever created, as a linked list
+  table *tables = nullptr;
+
+  // The table of the current thread
+  CALO_THREAD_LOCAL table *local = nullptr;
+
+  // Names given with label(). Never deleted, so that it can be used while
+  // printing at exit.
+  std::map<const void *, std::string> &labels()
+  {
+    static std::map<const void *, std::string> *labels =
+      new std::map<const void *, std::string>();
+    return *labels;
+  }
+
+  // Creates the table of the current thread and registers it.
+  table *make_table()
+  {
+    table *t = new table();
+    t->next = tables;
+#ifdef __GNUC__
+    while (!__sync_bool_compare_and_swap(&tables, t->next, t)) {
+      t->next = tables;
+    }
+#else
+    tables = t;
+#endif
+    return t;
+  }
+
+  // Returns a human-readable version of a type name.
+  std::string demangle(const char *name)
+  {
+#ifdef __GNUG__
+    int status;
+    char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status == 0) {
+      std::string result = demangled;
+      std::free(demangled);
+      return result;
+    }
+#endif
+    return name;
+  }
+
+  // Prints the summary when the program exits.
+  class printer
+  {
+  public:
+    ~printer()
+    {
+      for (table *t = tables; t != nullptr; t = t->next) {
+        for (std::size_t i = 0; i < table_size; ++i) {
+          if (t->entries[i].key != nullptr) {
+            summary(std::cerr);
+            return;
+          }
+        }
+      }
+    }
+  } print_at_exit;
+}
+
+/// Returns the counters identified by @c key for the current thread
+/**
+ * @c name is used in the summary when no label was set for @c key. It must
+ * stay valid until the end of the program.
+ */
+counters &slot(const void *key, const char *name)
+{
+  table *t = local;
+  if (t == nullptr) {
+    t = local = make_table();
+  }
+
+  std::size_t hash = reinterpret_cast<std::size_t>(key);
+  hash = (hash >> 4) * 2654435761u;
+  for (std::size_t probe = 0; probe < table_size; ++probe) {
+    entry &e = t->entries[(hash + probe) & (table_size - 1)];
+    if (e.key == key) {
+      return e.data;
+    } else if (e.key == nullptr) {
+      e.key = key;
+      e.name = name;
+      return e.data;
+    }
+  }
+  return t->overflow;
+}
+
+/// Returns the time spent in nested calls by the current thread
+/**
+ * Used by @ref call and @ref scope to compute exclusive times: every call adds
+ * its duration to this value, which the enclosing call subtracts from its own.
+ */
+double &nested()
+{
+  table *t = local;
+  if (t == nullptr) {
+    t = local = make_table();
+  }
+  return t->nested;
+}
+
+/// Sets the name under which @c key is shown in the summary
+/**
+ * @c key is the address of a filter or the name given to
+ * @c CALO_PROBE_SCOPE. Counters with the same label are merged.
+ *
+ * This function isn't thread-safe.
+ */
+void label(const void *key, const std::string &name)
+{
+  labels()[key] = name;
+}
+
+/// Prints the counters of all threads
+/**
+ * @warning
+ * This function is there for logging purposes; the format of the output
+ * should not be relied on.
+ */
+void summary(std::ostream &out)
+{
+  // Merge threads and filters with the same name
+  std::map<std::string, counters> merged;
+  std::map<std::string, bool> is_filter;
+  counters overflow = counters();
+  double total = 0;
+  for (table *t = tables; t != nullptr; t = t->next) {
+    for (std::size_t i = 0; i < table_size; ++i) {
+      const entry &e = t->entries[i];
+      if (e.key == nullptr) {
+        continue;
+      }
+
+      std::string name;
+      std::map<const void *, std::string>::const_iterator it =
+        labels().find(e.key);
+      if (it != labels().end()) {
+        name = it->second;
+      } else if (e.name != nullptr) {
+        name = demangle(e.name);
+      } else {
+        name = "?";
+      }
+
+      counters &c = merged[name];
+      c.calls += e.data.calls;
+      c.passes += e.data.passes;
+      c.ticks += e.data.ticks;
+      c.self += e.data.self;
+      is_filter[name] = e.key != e.name; // Scopes use their name as key
+      total += e.data.self;
+    }
+    overflow.calls += t->overflow.calls;
+  }
+
+  const std::ios::fmtflags flags = out.flags();
+  const std::streamsize precision = out.precision();
+  out << std::left << std::setw(30) << "name" << std::right
+      << std::setw(14) << "calls"
+      << std::setw(14) << "passes"
+      << std::setw(11) << "pass rate"
+      << std::setw(13) << "ticks/call"
+      << std::setw(9) << "share" << std::endl;
+  for (std::map<std::string, counters>::const_iterator it = merged.begin();
+       it != merged.end(); ++it) {
+    const counters &c = it->second;
+    out << std::left << std::setw(30) << it->first << std::right
+        << std::setw(14) << c.calls;
+    if (is_filter[it->first]) {
+      out << std::setw(14) << c.passes
+          << std::setw(11) << std::fixed << std::setprecision(4)
+          << double(c.passes) / c.calls;
+    } else {
+      out << std::setw(25) << "";
+    }
+    out << std::setw(13) << std::fixed << std::setprecision(1)
+        << c.ticks / c.calls
+        << std::setw(8) << std::setprecision(2)
+        << (total > 0 ? 100 * c.self / total : 0) << "%" << std::endl;
+  }
+  if (overflow.calls > 0) {
+    out << "(" << overflow.calls << " calls not attributed: too many filters)"
+        << std::endl;
+  }
+  out.flags(flags);
+  out.precision(precision);
+}
+
+/// Sets all counters to zero
+/**
+ * This function must not be called while other threads record counters.
+ */
+void reset()
+{
+  for (table *t = tables; t != nullptr; t = t->next) {
+    for (std::size_t i = 0; i < table_size; ++i) {
+      t->entries[i].data = counters();
+    }
+    t->overflow = counters();
+  }
+}
+
+} // namespace probe
+} // namespace calo
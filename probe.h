@@ -0,0 +1,129 @@
+#ifndef CALCLEAN_PROBE
+#define CALCLEAN_PROBE
+
+/**
+ * @file
+ * @brief  Header for the optional instrumentation of the framework
+ *
+ * Instrumentation is enabled by defining @c CALO_INSTRUMENT when compiling
+ * both the library and the analysis code:
+ *
+ * ~~~~
+ * CXXFLAGS=-DCALO_INSTRUMENT make
+ * ~~~~
+ *
+ * Without it, the macros below expand to exactly the code they wrap.
+ */
+
+#include <iosfwd>
+#include <string>
+#include <typeinfo>
+
+#include "timing.h"
+
+namespace calo {
+
+/// Instrumentation of filters and I/O
+/**
+ * See @ref probe.h for how to enable it.
+ */
+namespace probe {
+
+/// Counters recorded for a filter or a section of code
+struct counters
+{
+  /// Number of calls
+  unsigned long calls;
+
+  /// Number of calls that returned @c true (filters only)
+  unsigned long passes;
+
+  /// Time spent, in units of @ref ticks
+  double ticks;
+
+  /// Time spent, excluding the time spent in nested calls and scopes
+  double self;
+};
+
+counters &slot(const void *key, const char *name = 0);
+double &nested();
+
+void label(const void *key, const std::string &name);
+void summary(std::ostream &out);
+void reset();
+
+/// Calls @c f with argument @c t and records the call
+/**
+ * Time is recorded both inclusive and exclusive: when filters call other
+ * filters, the time spent in the children is counted in the inclusive time of
+ * the parent, but not in its exclusive time.
+ */
+template<class F, class T>
+inline bool call(const F &f, const T &t)
+{
+  counters &c = slot(&f, typeid(f).name());
+  double &children = nested();
+  const double outer = children;
+  children = 0;
+  const double start = ticks();
+  const bool value = f(t);
+  const double elapsed = ticks() - start;
+  c.ticks += elapsed;
+  c.self += elapsed - children;
+  children = outer + elapsed;
+  ++c.calls;
+  c.passes += value;
+  return value;
+}
+
+/// Records the time spent between construction and destruction
+class scope
+{
+  counters &_counters;
+  double &_children;
+  double _outer;
+  double _start;
+
+  // Not copyable
+  scope(const scope &);
+  scope &operator= (const scope &);
+
+public:
+  /// Starts timing a section named @c name
+  /**
+   * @c name must be a string literal: its address identifies the section.
+   */
+  explicit scope(const char *name) :
+    _counters(slot(name, name)),
+    _children(nested()),
+    _outer(_children),
+    _start(ticks())
+  {
+    _children = 0;
+  }
+
+  /// Stops timing
+  ~scope()
+  {
+    const double elapsed = ticks() - _start;
+    _counters.ticks += elapsed;
+    _counters.self += elapsed - _children;
+    _children = _outer + elapsed;
+    ++_counters.calls;
+  }
+};
+
+} // namespace probe
+} // namespace calo
+
+#if defined(CALO_INSTRUMENT) && !defined(__CINT__)
+/// Evaluates filter @c f on tower @c t, recording the call when instrumented
+# define CALO_FILTER_CALL(f, t) (::calo::probe::call((f), (t)))
+/// Times the enclosing scope when instrumented
+# define CALO_PROBE_SCOPE(name) ::calo::probe::scope calo_probe_scope_(name)
+#else
+# define CALO_FILTER_CALL(f, t) ((f)(t))
+# define CALO_PROBE_SCOPE(name) ((void) 0)
+#endif
+
+#endif // CALCLEAN_PROBE
@@ -0,0 +1,224 @@
+#include "schema.h"
+
+/**
+ * @file
+ * @brief  Source for the description of tower trees
+ */
+
+#include <stdexcept>
+
+namespace calo {
+
+/**
+ * @class tree_schema calclean/schema.h
+ * @brief Describes where the fields of towers are stored in a tree.
+ *
+ * By default, a @ref towerset reads the layout of @c CaloTree, described in
+ * @ref towerset::towerset(TTree *). Trees written by other producers can use
+ * different branch names and types; a schema maps every field to its branch:
+ *
+ * ~~~~{.cpp}
+ * tree_schema schema;
+ * schema.set_tree("Towers");
+ * schema.set(tree_schema::size, "");  // Taken from the size of the vectors
+ * schema.set(tree_schema::eta, "towerEta", tree_schema::vector_float32);
+ * schema.set(tree_schema::emenergy, "towerEm");  // Type detected
+ * // ...
+ * towerset set(file, schema);
+ * ~~~~
+ *
+ * Fields can be stored as C arrays of @c UChar_t, @c Short_t, @c UShort_t,
+ * @c Int_t, @c UInt_t, @c Float_t or @c Double_t, whose size is given by the
+ * @ref size branch, or as @c std::vector. Hit counts can't be stored as
+ * @c UInt_t, whose values don't all fit in an @c int. When @ref size has no
+ * branch, the number of towers is the size of the @ref eta vector, and all
+ * fields must be vectors.
+ *
+ * The schema is checked once, when the @c towerset is created: an exception is
+ * thrown if a branch is missing or doesn't have the expected type. Branches
+ * whose type matches the column (@c Float_t for energies and positions,
+ * @c Int_t for hit counts) are read directly into the @c towerset. Others are
+ * read into a buffer and converted after every read.
+ */
+
+/// Constructs the schema of @c CaloTree
+tree_schema::tree_schema() :
+  _tree("CaloTree")
+{
+  const char *const names[field_count] = {
+    "CaloSize", "CaloEta", "CaloPhi",
+    "CaloEBHits", "CaloEEHits", "CaloHBHits", "CaloHEHits", "CaloHFHits",
+    "CaloEmEnergy", "CaloHadEnergy", "CaloEnergy"
+  };
+  for (int f = 0; f < field_count; ++f) {
+    _branches[f] = names[f];
+    _types[f] = is_integer(field(f)) || f == size ? int32 : float32;
+  }
+}
+
+/// Sets the name of the tree
+void tree_schema::set_tree(const std::string &name)
+{
+  _tree = name;
+}
+
+/// Sets the branch holding a field, and how it is stored
+/**
+ * With @ref automatic, the type is read from the tree when it is opened. The
+ * branch of @ref size can be empty (see above); it must otherwise hold a single
+ * @c Int_t. An exception is thrown if these rules are violated
+ * (@c std::invalid_argument).
+ */
+void tree_schema::set(field f, const std::string &branch, storage type)
+{
+  if (f < size || f >= field_count) {
+    throw std::invalid_argument("tree_schema::set: no such field");
+  }
+  if (branch.empty() && f != size) {
+    throw std::invalid_argument("tree_schema::set: empty branch name");
+  }
+  if (f == size && type != automatic && type != int32) {
+    throw std::invalid_argument("tree_schema::set: the size must be an int");
+  }
+  _branches[f] = branch;
+  _types[f] = type;
+}
+
+/// Returns the ROOT name of a type
+/**
+ * This is the name returned by @c TLeaf::GetTypeName.
+ */
+const char *tree_schema::type_name(storage type)
+{
+  switch (type) {
+  case uint8:
+    return "UChar_t";
+  case int16:
+    return "Short_t";
+  case uint16:
+    return "UShort_t";
+  case int32:
+    return "Int_t";
+  case uint32:
+    return "UInt_t";
+  case float32:
+    return "Float_t";
+  case float64:
+    return "Double_t";
+  case vector_int32:
+    return "vector<int>";
+  case vector_float32:
+    return "vector<float>";
+  case vector_float64:
+    return "vector<double>";
+  default:
+    return "automatic";
+  }
+}
+
+/// Returns the type with the given ROOT name, or @ref automatic if unknown
+tree_schema::storage tree_schema::parse_type(const std::string &name)
+{
+  std::string n = name;
+  if (n.compare(0, 5, "std::") == 0) {
+    n.erase(0, 5);
+  }
+  if (n == "UChar_t" || n == "Bool_t") {
+    return uint8;
+  } else if (n == "Short_t") {
+    return int16;
+  } else if (n == "UShort_t") {
+    return uint16;
+  } else if (n == "Int_t") {
+    return int32;
+  } else if (n == "UInt_t") {
+    return uint32;
+  } else if (n == "Float_t") {
+    return float32;
+  } else if (n == "Double_t") {
+    return float64;
+  } else if (n == "vector<int>") {
+    return vector_int32;
+  } else if (n == "vector<float>") {
+    return vector_float32;
+  } else if (n == "vector<double>") {
+    return vector_float64;
+  }
+  return automatic;
+}
+
+namespace {
+  // Converts count values of type From to To. Written as a plain loop so that
+  // the compiler can vectorize it.
+  template<class From, class To>
+  void convert(const void *data, int count, To *column)
+  {
+    const From *values = static_cast<const From *>(data);
+    for (int i = 0; i < count; ++i) {
+      column[i] = static_cast<To>(values[i]);
+    }
+  }
+
+  // Converts data of any type to To.
+  template<class To>
+  void convert_any(tree_schema::storage type,
+                   const void *data,
+                   int count,
+                   To *column)
+  {
+    switch (type) {
+    case tree_schema::uint8:
+      convert<unsigned char>(data, count, column);
+      break;
+    case tree_schema::int16:
+      convert<short>(data, count, column);
+      break;
+    case tree_schema::uint16:
+      convert<unsigned short>(data, count, column);
+      break;
+    case tree_schema::int32:
+    case tree_schema::vector_int32:
+      convert<int>(data, count, column);
+      break;
+    case tree_schema::uint32:
+      convert<unsigned>(data, count, column);
+      break;
+    case tree_schema::float32:
+    case tree_schema::vector_float32:
+      convert<float>(data, count, column);
+      break;
+    case tree_schema::float64:
+    case tree_schema::vector_float64:
+      convert<double>(data, count, column);
+      break;
+    default:
+      throw std::logic_error("convert_column: unknown type");
+    }
+  }
+}
+
+/// Converts @c count values stored as @c type to floats
+/**
+ * For vector types, @c data points to the elements of the vector.
+ */
+void convert_column(tree_schema::storage type,
+                    const void *data,
+                    int count,
+                    float *column)
+{
+  convert_any(type, data, count, column);
+}
+
+/// Converts @c count values stored as @c type to integers
+/**
+ * Floating-point values are truncated.
+ */
+void convert_column(tree_schema::storage type,
+                    const void *data,
+                    int count,
+                    int *column)
+{
+  convert_any(type, data, count, column);
+}
+
+} // namespace calo
@@ -0,0 +1,112 @@
+#ifndef CALCLEAN_SCHEMA
+#define CALCLEAN_SCHEMA
+
+/**
+ * @file
+ * @brief  Header for the description of tower trees
+ */
+
+#include <string>
+
+namespace calo {
+
+class tree_schema
+{
+public:
+  /// The fields of a tower, and the number of towers
+  enum field {
+    /// Number of towers in the event
+    size,
+    /// @f$\eta@f$
+    eta,
+    /// @f$\phi@f$
+    phi,
+    /// Number of EB crystals
+    ebcount,
+    /// Number of EE crystals
+    eecount,
+    /// Number of HB cells
+    hbcount,
+    /// Number of HE cells
+    hecount,
+    /// Number of HF cells
+    hfcount,
+    /// Electromagnetic energy
+    emenergy,
+    /// Hadronic energy
+    hadenergy,
+    /// Total energy
+    totalenergy,
+    /// The number of fields
+    field_count
+  };
+
+  /// How a field is stored in its branch
+  enum storage {
+    /// Detected when the tree is opened
+    automatic,
+    /// Array of @c UChar_t or @c Bool_t
+    uint8,
+    /// Array of @c Short_t
+    int16,
+    /// Array of @c UShort_t
+    uint16,
+    /// Array of @c Int_t (a single @c Int_t for @ref size)
+    int32,
+    /// Array of @c UInt_t (floating-point fields only)
+    uint32,
+    /// Array of @c Float_t
+    float32,
+    /// Array of @c Double_t
+    float64,
+    /// <tt>std::vector<int></tt>
+    vector_int32,
+    /// <tt>std::vector<float></tt>
+    vector_float32,
+    /// <tt>std::vector<double></tt>
+    vector_float64
+  };
+
+private:
+  std::string _tree;
+  std::string _branches[field_count];
+  storage _types[field_count];
+
+public:
+  explicit tree_schema();
+
+  void set_tree(const std::string &name);
+
+  /// Returns the name of the tree
+  const std::string &tree() const { return _tree; }
+
+  void set(field f, const std::string &branch, storage type = automatic);
+
+  /// Returns the name of the branch holding a field
+  const std::string &branch(field f) const { return _branches[f]; }
+
+  /// Returns how a field is stored
+  storage type(field f) const { return _types[f]; }
+
+  /// Returns @c true if the field is stored as a @c std::vector
+  static bool is_vector(storage type) { return type >= vector_int32; }
+
+  /// Returns @c true if the field holds integers
+  static bool is_integer(field f) { return f >= ebcount && f <= hfcount; }
+
+  static const char *type_name(storage type);
+  static storage parse_type(const std::string &name);
+};
+
+void convert_column(tree_schema::storage type,
+                    const void *data,
+                    int count,
+                    float *column);
+void convert_column(tree_schema::storage type,
+                    const void *data,
+                    int count,
+                    int *column);
+
+} // namespace calo
+
+#endif // CALCLEAN_SCHEMA
@@ -0,0 +1,367 @@
+#include "store.h"
+#include "codec.h"
+
+/**
+ * @file
+ * @brief  Source for the in-memory event store
+ */
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#include <TTree.h>
+
+namespace calo {
+
+/**
+ * @class event_store calclean/store.h
+ * @brief Keeps a whole dataset in memory, in a columnar layout.
+ *
+ * Reading an event with @ref towerset::getentry decompresses it from the
+ * @c TTree. When the same events are processed again and again, for instance
+ * while tuning thresholds from the ROOT prompt, this cost is paid on every
+ * pass. An @c event_store reads the tree once and keeps every column in a
+ * single contiguous array, with an offset table giving the first tower of
+ * every event. Afterwards, loading an event is a copy:
+ *
+ * ~~~~{.cpp}
+ * TFile *file = new TFile("data.root");
+ * event_store store(static_cast<TTree *>(file->Get("CaloTree")));
+ * store.memory_report(std::cout);
+ *
+ * std::vector<tower> empty;
+ * towerset set(empty);
+ * for (int pass = 0; pass < 10; ++pass) {
+ *   for (unsigned long event = 0; event < store.events(); ++event) {
+ *     store.get(event, set);
+ *     for (towerset::iterator it = set.begin(&goodeb); it != set.end(); ++it) {
+ *       // ...
+ *     }
+ *   }
+ * }
+ * ~~~~
+ *
+ * Filters that look at one tower at a time don't need event boundaries; for
+ * them, scan() and count() go through all towers of the dataset in large
+ * blocks.
+ *
+ * Hit counts are stored in a single byte, which is enough for all real
+ * towers. To fit larger samples in memory, the compact encoding described in
+ * @ref codec.h can be used:
+ *
+ *   - With @ref reduced precision, energies are stored in 16 bits with a
+ *     relative error of at most @f$2^{-11}@f$. This is small compared to the
+ *     calorimeter resolution, but can move towers that are exactly at a
+ *     threshold. Positions are stored exactly;
+ *   - With @ref compact precision, positions are additionally replaced by
+ *     16-bit tower IDs. Logical coordinates (@ref tower_ref::ieta) are
+ *     preserved, but @f$\eta@f$ and @f$\phi@f$ are moved to the center of
+ *     their cell.
+ *
+ * A tower then takes 19 or 13 bytes instead of 25. Data is decoded in batches
+ * when it is loaded into a @ref towerset.
+ */
+
+namespace {
+  // Checks that logical coordinates fit in a tower ID.
+  void check_coordinates(int ieta, int iphi)
+  {
+    if (ieta < -64 || ieta > 63 || iphi < -64 || iphi > 63) {
+      throw std::out_of_range("event_store::append: tower out of range");
+    }
+  }
+
+  // Checks that a hit count fits in a byte.
+  void check_count(int count)
+  {
+    if (count < 0 || count > UCHAR_MAX) {
+      throw std::out_of_range("event_store::append: hit count out of range");
+    }
+  }
+
+  // Frees the memory a vector doesn't use.
+  template<class T>
+  void shrink_vector(std::vector<T> &v)
+  {
+    std::vector<T>(v).swap(v);
+  }
+
+  // Returns the memory used by a vector.
+  template<class T>
+  std::size_t bytes(const std::vector<T> &v)
+  {
+    return v.capacity() * sizeof(T);
+  }
+}
+
+/// Constructs an empty store
+event_store::event_store(precision p) :
+  _precision(p),
+  _offsets(1, 0)
+{}
+
+/// Constructs a store holding all events of the given @c TTree
+/**
+ * The tree must have the branches listed in @ref towerset::towerset(TTree *).
+ * Its branch addresses are reset after reading.
+ */
+event_store::event_store(TTree *tree, precision p) :
+  _precision(p),
+  _offsets(1, 0)
+{
+  {
+    towerset source(tree);
+    read(source);
+  }
+  tree->ResetBranchAddresses();
+}
+
+/// Appends the current event of a @ref towerset to the store
+/**
+ * An exception is thrown if a hit count is negative or larger than 255
+ * (@c std::out_of_range).
+ */
+void event_store::append(const towerset &set)
+{
+  const tower_columns c = set.columns();
+
+  // Check first, so nothing is added if a count is out of range
+  for (int i = 0; i < c.size; ++i) {
+    if (_precision == compact) {
+      check_coordinates(eta_index(c.eta[i]), phi_index(c.phi[i]));
+    }
+    check_count(c.ebcount[i]);
+    check_count(c.eecount[i]);
+    check_count(c.hbcount[i]);
+    check_count(c.hecount[i]);
+    check_count(c.hfcount[i]);
+  }
+
+  if (_precision == compact) {
+    for (int i = 0; i < c.size; ++i) {
+      _id.push_back(encode_id(eta_index(c.eta[i]), phi_index(c.phi[i]),
+                              region_of(c.ebcount[i], c.eecount[i],
+                                        c.hbcount[i], c.hecount[i],
+                                        c.hfcount[i])));
+    }
+  } else {
+    _eta.insert(_eta.end(), c.eta, c.eta + c.size);
+    _phi.insert(_phi.end(), c.phi, c.phi + c.size);
+  }
+  _ebcount.insert(_ebcount.end(), c.ebcount, c.ebcount + c.size);
+  _eecount.insert(_eecount.end(), c.eecount, c.eecount + c.size);
+  _hbcount.insert(_hbcount.end(), c.hbcount, c.hbcount + c.size);
+  _hecount.insert(_hecount.end(), c.hecount, c.hecount + c.size);
+  _hfcount.insert(_hfcount.end(), c.hfcount, c.hfcount + c.size);
+  if (_precision == full) {
+    _emenergy.insert(_emenergy.end(), c.emenergy, c.emenergy + c.size);
+    _hadenergy.insert(_hadenergy.end(), c.hadenergy, c.hadenergy + c.size);
+    _totalenergy.insert(_totalenergy.end(),
+                        c.totalenergy, c.totalenergy + c.size);
+  } else {
+    for (int i = 0; i < c.size; ++i) {
+      _emenergy16.push_back(encode_energy(c.emenergy[i]));
+      _hadenergy16.push_back(encode_energy(c.hadenergy[i]));
+      _totalenergy16.push_back(encode_energy(c.totalenergy[i]));
+    }
+  }
+  _offsets.push_back(_ebcount.size());
+}
+
+/// Appends events read from a @ref towerset
+/**
+ * Entries @c first to <tt>first + count - 1</tt> are read, stopping at the end
+ * of the tree.
+ */
+void event_store::read(towerset &source,
+                       unsigned long first,
+                       unsigned long count)
+{
+  const unsigned long entries = source.entries();
+  if (first >= entries) {
+    return;
+  }
+  const unsigned long last = first + std::min(count, entries - first);
+  _offsets.reserve(_offsets.size() + last - first);
+  for (unsigned long entry = first; entry < last; ++entry) {
+    source.getentry(entry);
+    append(source);
+  }
+  shrink();
+}
+
+// Releases the memory reserved by the vectors for future use.
+void event_store::shrink()
+{
+  shrink_vector(_offsets);
+  shrink_vector(_eta);
+  shrink_vector(_phi);
+  shrink_vector(_id);
+  shrink_vector(_ebcount);
+  shrink_vector(_eecount);
+  shrink_vector(_hbcount);
+  shrink_vector(_hecount);
+  shrink_vector(_hfcount);
+  shrink_vector(_emenergy);
+  shrink_vector(_hadenergy);
+  shrink_vector(_totalenergy);
+  shrink_vector(_emenergy16);
+  shrink_vector(_hadenergy16);
+  shrink_vector(_totalenergy16);
+}
+
+/// Returns the event a tower belongs to
+/**
+ * @c tower is the position of the tower in the store, as given by scan().
+ */
+unsigned long event_store::event_of(unsigned long tower) const
+{
+  assert(tower < towers());
+  return std::upper_bound(_offsets.begin(), _offsets.end(), tower)
+       - _offsets.begin() - 1;
+}
+
+// Copies count towers starting at first into set.
+void event_store::fill(towerset &set, unsigned long first, int count) const
+{
+  assert(count >= 0 && (unsigned) count <= towerset::big);
+  assert(first + count <= towers());
+
+  // Decoding functions take pointers, which are invalid past the end
+  if (_precision == compact && count > 0) {
+    decode_ids(&_id[first], count, set._eta, set._phi);
+  } else if (_precision != compact) {
+    std::copy(_eta.begin() + first, _eta.begin() + first + count, set._eta);
+    std::copy(_phi.begin() + first, _phi.begin() + first + count, set._phi);
+  }
+  std::copy(_ebcount.begin() + first, _ebcount.begin() + first + count,
+            set._ebcount);
+  std::copy(_eecount.begin() + first, _eecount.begin() + first + count,
+            set._eecount);
+  std::copy(_hbcount.begin() + first, _hbcount.begin() + first + count,
+            set._hbcount);
+  std::copy(_hecount.begin() + first, _hecount.begin() + first + count,
+            set._hecount);
+  std::copy(_hfcount.begin() + first, _hfcount.begin() + first + count,
+            set._hfcount);
+  if (_precision == full) {
+    std::copy(_emenergy.begin() + first, _emenergy.begin() + first + count,
+              set._emenergy);
+    std::copy(_hadenergy.begin() + first, _hadenergy.begin() + first + count,
+              set._hadenergy);
+    std::copy(_totalenergy.begin() + first,
+              _totalenergy.begin() + first + count,
+              set._totalenergy);
+  } else if (count > 0) {
+    decode_energies(&_emenergy16[first], count, set._emenergy);
+    decode_energies(&_hadenergy16[first], count, set._hadenergy);
+    decode_energies(&_totalenergy16[first], count, set._totalenergy);
+  }
+
+  set._size = count;
+  set.invalidate();
+  set.filter_event();
+}
+
+/// Loads an event into a @ref towerset
+/**
+ * This operation invalidates all iterators of @c set, like
+ * @ref towerset::getentry. If @c set is backed by a @c TTree, the next call to
+ * @ref towerset::getentry overwrites the towers. The event filter of @c set is
+ * evaluated as in @ref towerset::getentry, see @ref towerset::accepted.
+ */
+void event_store::get(unsigned long event, towerset &set) const
+{
+  assert(event < events());
+  fill(set, _offsets[event], size(event));
+}
+
+namespace {
+  // Counts the towers it is called for.
+  struct counter
+  {
+    unsigned long value;
+
+    counter() : value(0) {}
+    void operator() (unsigned long, const tower_ref &) { ++value; }
+  };
+}
+
+/// Returns the number of towers in the store that pass @c f
+/**
+ * As for scan(), @c f must only look at one tower at a time.
+ */
+unsigned long event_store::count(const filter *f) const
+{
+  counter c;
+  scan(f, c);
+  return c.value;
+}
+
+/// Returns the number of bytes used by the store
+std::size_t event_store::memory() const
+{
+  return bytes(_offsets)
+       + bytes(_eta) + bytes(_phi) + bytes(_id)
+       + bytes(_ebcount) + bytes(_eecount) + bytes(_hbcount)
+       + bytes(_hecount) + bytes(_hfcount)
+       + bytes(_emenergy) + bytes(_hadenergy) + bytes(_totalenergy)
+       + bytes(_emenergy16) + bytes(_hadenergy16) + bytes(_totalenergy16);
+}
+
+namespace {
+  // Prints a line of the memory report.
+  void report_line(std::ostream &out,
+                   const char *name,
+                   std::size_t bytes,
+                   unsigned long towers)
+  {
+    const std::ios::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::left << std::setw(14) << name << std::right
+        << std::setw(12) << std::fixed << std::setprecision(1)
+        << bytes / 1048576. << " MiB"
+        << std::setw(10) << std::setprecision(2)
+        << (towers > 0 ? double(bytes) / towers : 0.) << " B/tower"
+        << std::endl;
+    out.flags(flags);
+    out.precision(precision);
+  }
+}
+
+/// Prints the memory used by every column of the store
+/**
+ * @warning
+ * This function is there for logging purposes; the format of the output
+ * should not be relied on.
+ */
+void event_store::memory_report(std::ostream &out) const
+{
+  const unsigned long n = towers();
+  out << "event_store: " << events() << " events, " << n << " towers, "
+      << (_precision == full ? "full"
+          : _precision == reduced ? "reduced" : "compact") << " precision"
+      << std::endl;
+  report_line(out, "offsets", bytes(_offsets), n);
+  if (_precision == compact) {
+    report_line(out, "ids", bytes(_id), n);
+  } else {
+    report_line(out, "eta", bytes(_eta), n);
+    report_line(out, "phi", bytes(_phi), n);
+  }
+  report_line(out, "counts", bytes(_ebcount) + bytes(_eecount)
+                             + bytes(_hbcount) + bytes(_hecount)
+                             + bytes(_hfcount), n);
+  if (_precision == full) {
+    report_line(out, "energies", bytes(_emenergy) + bytes(_hadenergy)
+                                 + bytes(_totalenergy), n);
+  } else {
+    report_line(out, "energies", bytes(_emenergy16) + bytes(_hadenergy16)
+                                 + bytes(_totalenergy16), n);
+  }
+  report_line(out, "total", memory(), n);
+}
+
+} // namespace calo
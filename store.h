@@ -0,0 +1,133 @@
+#ifndef CALCLEAN_STORE
+#define CALCLEAN_STORE
+
+/**
+ * @file
+ * @brief  Header for the in-memory event store
+ */
+
+#include <algorithm>
+#include <iosfwd>
+
+#include "calofilter.h"
+
+namespace calo {
+
+class event_store
+{
+public:
+  /// How towers are stored
+  enum precision {
+    /// 32-bit floats, as in the @c TTree
+    full,
+    /// 16 bits, with a relative error of at most @f$2^{-11}@f$
+    /// (see @ref encode_energy)
+    reduced,
+    /// As @ref reduced, and positions are replaced by tower IDs
+    /// (see @ref encode_id)
+    compact
+  };
+
+private:
+  precision _precision;
+
+  // Index of the first tower of every event, plus the total number of towers
+  std::vector<unsigned long> _offsets;
+
+  std::vector<float> _eta;
+  std::vector<float> _phi;
+
+  // With compact precision, instead of positions
+  std::vector<unsigned short> _id;
+
+  std::vector<unsigned char> _ebcount;
+  std::vector<unsigned char> _eecount;
+  std::vector<unsigned char> _hbcount;
+  std::vector<unsigned char> _hecount;
+  std::vector<unsigned char> _hfcount;
+
+  // With full precision
+  std::vector<float> _emenergy;
+  std::vector<float> _hadenergy;
+  std::vector<float> _totalenergy;
+
+  // With reduced and compact precision
+  std::vector<unsigned short> _emenergy16;
+  std::vector<unsigned short> _hadenergy16;
+  std::vector<unsigned short> _totalenergy16;
+
+  void fill(towerset &set, unsigned long first, int count) const;
+  void shrink();
+
+public:
+  explicit event_store(precision p = full);
+  explicit event_store(TTree *tree, precision p = full);
+
+  void append(const towerset &set);
+  void read(towerset &source,
+            unsigned long first = 0,
+            unsigned long count = ULONG_MAX);
+
+  /// Returns how towers are stored
+  precision storage() const { return _precision; }
+
+  /// Returns the number of events in the store
+  unsigned long events() const { return _offsets.size() - 1; }
+
+  /// Returns the number of towers in all events
+  unsigned long towers() const { return _offsets.back(); }
+
+  /// Returns the number of towers in the given event
+  int size(unsigned long event) const
+  {
+    assert(event < events());
+    return _offsets[event + 1] - _offsets[event];
+  }
+
+  /// Returns the index of the first tower of the given event
+  unsigned long offset(unsigned long event) const
+  {
+    assert(event <= events());
+    return _offsets[event];
+  }
+
+  unsigned long event_of(unsigned long tower) const;
+
+  void get(unsigned long event, towerset &set) const;
+
+  template<class Visitor>
+  void scan(const filter *f, Visitor &visit) const;
+
+  unsigned long count(const filter *f) const;
+
+  std::size_t memory() const;
+  void memory_report(std::ostream &out) const;
+};
+
+/// Calls @c visit for every tower of the store that passes @c f
+/**
+ * Event boundaries are ignored: towers are loaded in blocks of
+ * @ref towerset::big, so this is only correct for filters that look at one
+ * tower at a time. @c visit is called as
+ * <tt>visit(unsigned long index, const tower_ref &tower)</tt>, where @c index
+ * is the position of the tower in the whole store (see event_of()). If @c f
+ * is @c null, all towers are visited.
+ */
+template<class Visitor>
+void event_store::scan(const filter *f, Visitor &visit) const
+{
+  const std::vector<tower> empty;
+  towerset block(empty);
+  const unsigned long total = towers();
+  for (unsigned long first = 0; first < total; first += towerset::big) {
+    fill(block, first, std::min<unsigned long>(total - first, towerset::big));
+    const towerset::iterator end = block.end();
+    for (towerset::iterator it = block.begin(f); it != end; ++it) {
+      visit(first + it->index(), *it);
+    }
+  }
+}
+
+} // namespace calo
+
+#endif // CALCLEAN_STORE
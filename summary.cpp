@@ -0,0 +1,264 @@
+#include "summary.h"
+
+/**
+ * @file
+ * @brief  Source for event-level energy sums
+ */
+
+#include <algorithm>
+#include <cstring>
+
+namespace calo {
+
+/**
+ * @struct event_summary calclean/summary.h
+ * @brief Energy sums over the towers of an event.
+ *
+ * Most analyses start with event-level quantities: the total energy in every
+ * subdetector, the transverse energy, or the energy in each side of the HF
+ * used for centrality in pPb collisions. An @c event_summary computes all of
+ * them in a single pass over the columns of a @ref towerset:
+ *
+ * ~~~~{.cpp}
+ * event_summary summary(set, &goodeb);
+ * std::cout << summary.et << " GeV in " << summary.towers << " towers"
+ *           << std::endl;
+ * ~~~~
+ *
+ * The towers to sum are given by a filter or by a @ref tower_mask, for
+ * instance from a @ref filter_bank. The filter is called once per tower; the
+ * sums themselves have no branches and can be vectorized by the compiler. The
+ * transverse energy uses the values of @f$1/\cosh\eta@f$ cached in the set
+ * (see @ref towerset::inv_cosh_eta), so they are computed only once even when
+ * several summaries are made for the same event.
+ *
+ * Towers are assigned to subdetectors from their hit counts. Electromagnetic
+ * energy goes to the EB if the tower has EB hits and to the EE otherwise;
+ * hadronic energy goes to the HB or HE in the same way. The total energy of
+ * towers with HF hits goes to the HF and, depending on the sign of
+ * @f$\eta@f$, to @ref hf_plus or @ref hf_minus.
+ *
+ * Summaries of several events are combined with <tt>operator+=</tt>. When
+ * this is done in parallel, the order of the additions changes from one run
+ * to the next, and so do the last bits of floating-point results. With
+ * @ref deterministic summation, energies are rounded to multiples of
+ * @f$2^{-20}@f$ GeV (about 1 eV) tower by tower and all sums are exact, so
+ * they don't depend on the order in which they are made. This holds as long
+ * as no sum exceeds @f$2^{33}@f$ GeV, and only between summaries that all use
+ * deterministic summation.
+ */
+
+namespace {
+  // Quantities summed by the kernel
+  enum quantity {
+    sum_em, sum_had, sum_total, sum_et, sum_eb, sum_ee, sum_hb, sum_he,
+    sum_hf_plus, sum_hf_minus, quantities
+  };
+
+  // Number of partial sums kept for every quantity. Each of them fits in a
+  // lane of a vector register, so towers can be summed in parallel without
+  // changing the order of the additions.
+  const int lanes = 4;
+
+  // Deterministic sums count multiples of 1 / grid GeV
+  const double grid = 1048576.;
+
+  // Adding then removing this constant rounds a double to the nearest
+  // integer, provided its magnitude is below 2^51
+  const double round_constant = 6755399441055744.;
+
+  // Converts an energy to the units used for the sums.
+  template<bool Deterministic>
+  inline double to_sum(double energy)
+  {
+    return Deterministic
+         ? (energy * grid + round_constant) - round_constant
+         : energy;
+  }
+
+  // Returns 1 if count is positive and 0 otherwise, without branching.
+  inline int has_hits(int count)
+  {
+    return count > 0;
+  }
+
+  // Returns 1 if x is negative and 0 otherwise, without branching.
+  inline unsigned int sign_of(float x)
+  {
+    unsigned int bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return bits >> 31;
+  }
+
+  // Adds the contribution of tower i to the partial sums of a lane.
+  template<bool Deterministic>
+  inline void accumulate(double (&sums)[quantities][lanes],
+                         int lane,
+                         const tower_columns &c,
+                         const float *inv_cosh,
+                         const float *weights,
+                         int i)
+  {
+    const double em_energy =
+      to_sum<Deterministic>(weights[i] * c.emenergy[i]);
+    const double had_energy =
+      to_sum<Deterministic>(weights[i] * c.hadenergy[i]);
+    const double total_energy =
+      to_sum<Deterministic>(weights[i] * c.totalenergy[i]);
+    const double has_eb = has_hits(c.ebcount[i]);
+    const double has_ee = has_hits(c.eecount[i]);
+    const double has_hb = has_hits(c.hbcount[i]);
+    const double has_he = has_hits(c.hecount[i]);
+    const double forward = has_hits(c.hfcount[i]);
+    const double minus = sign_of(c.eta[i]);
+
+    sums[sum_em][lane] += em_energy;
+    sums[sum_had][lane] += had_energy;
+    sums[sum_total][lane] += total_energy;
+    sums[sum_et][lane] +=
+      to_sum<Deterministic>(weights[i] * c.totalenergy[i] * inv_cosh[i]);
+    sums[sum_eb][lane] += em_energy * has_eb;
+    sums[sum_ee][lane] += em_energy * (1 - has_eb) * has_ee;
+    sums[sum_hb][lane] += had_energy * has_hb;
+    sums[sum_he][lane] += had_energy * (1 - has_hb) * has_he;
+    sums[sum_hf_plus][lane] += total_energy * forward * (1 - minus);
+    sums[sum_hf_minus][lane] += total_energy * forward * minus;
+  }
+
+  // Sums the towers of set, each weighted by 0 or 1.
+  template<bool Deterministic>
+  void summarize(const towerset &set, const float *weights, event_summary &s)
+  {
+    const tower_columns c = set.columns();
+    const float *inv_cosh = set.inv_cosh_eta();
+
+    double sums[quantities][lanes] = {{0}};
+    int i = 0;
+    for (; i + lanes <= c.size; i += lanes) {
+      for (int lane = 0; lane < lanes; ++lane) {
+        accumulate<Deterministic>(sums, lane, c, inv_cosh, weights, i + lane);
+      }
+    }
+    for (int lane = 0; i < c.size; ++i, ++lane) {
+      accumulate<Deterministic>(sums, lane, c, inv_cosh, weights, i);
+    }
+
+    // Combine the lanes, always in the same order
+    double result[quantities];
+    for (int q = 0; q < quantities; ++q) {
+      result[q] = 0;
+      for (int lane = 0; lane < lanes; ++lane) {
+        result[q] += sums[q][lane];
+      }
+      if (Deterministic) {
+        result[q] /= grid;
+      }
+    }
+
+    s.towers = 0;
+    for (i = 0; i < c.size; ++i) {
+      s.towers += weights[i] != 0;
+    }
+    s.emenergy = result[sum_em];
+    s.hadenergy = result[sum_had];
+    s.totalenergy = result[sum_total];
+    s.et = result[sum_et];
+    s.eb = result[sum_eb];
+    s.ee = result[sum_ee];
+    s.hb = result[sum_hb];
+    s.he = result[sum_he];
+    s.hf = result[sum_hf_plus] + result[sum_hf_minus];
+    s.hf_plus = result[sum_hf_plus];
+    s.hf_minus = result[sum_hf_minus];
+  }
+
+  // Calls the kernel for the requested summation mode.
+  void summarize(const towerset &set,
+                 const float *weights,
+                 event_summary::summation mode,
+                 event_summary &s)
+  {
+    if (mode == event_summary::deterministic) {
+      summarize<true>(set, weights, s);
+    } else {
+      summarize<false>(set, weights, s);
+    }
+  }
+}
+
+/// Constructs an empty summary
+event_summary::event_summary() :
+  towers(0),
+  emenergy(0),
+  hadenergy(0),
+  totalenergy(0),
+  et(0),
+  eb(0),
+  ee(0),
+  hb(0),
+  he(0),
+  hf(0),
+  hf_plus(0),
+  hf_minus(0)
+{}
+
+/// Sums the towers of the current event that pass a filter
+/**
+ * If @c f is @c null, all towers are summed.
+ */
+event_summary::event_summary(const towerset &set,
+                             const filter *f,
+                             summation mode)
+{
+  float weights[towerset::big];
+  if (f == nullptr) {
+    std::fill(weights, weights + set.size(), 1.f);
+  } else {
+    const filter &pass = *f;
+    for (int i = 0; i < set.size(); ++i) {
+      weights[i] = CALO_FILTER_CALL(pass, tower_ref(&set, i));
+    }
+  }
+  summarize(set, weights, mode, *this);
+}
+
+/// Sums the towers of the current event that are set in a mask
+/**
+ * The mask must have been computed for the current event.
+ */
+event_summary::event_summary(const towerset &set,
+                             const tower_mask &mask,
+                             summation mode)
+{
+  assert(mask.size() == set.size());
+  float weights[towerset::big];
+  for (int i = 0; i < set.size(); ++i) {
+    weights[i] = (mask.word(i / tower_mask::word_bits)
+                  >> (i % tower_mask::word_bits)) & 1;
+  }
+  summarize(set, weights, mode, *this);
+}
+
+/// Adds the sums of another summary
+/**
+ * The result depends on the order of the additions, unless all summaries use
+ * @ref deterministic summation.
+ */
+event_summary &event_summary::operator+= (const event_summary &other)
+{
+  towers += other.towers;
+  emenergy += other.emenergy;
+  hadenergy += other.hadenergy;
+  totalenergy += other.totalenergy;
+  et += other.et;
+  eb += other.eb;
+  ee += other.ee;
+  hb += other.hb;
+  he += other.he;
+  hf += other.hf;
+  hf_plus += other.hf_plus;
+  hf_minus += other.hf_minus;
+  return *this;
+}
+
+} // namespace calo
@@ -0,0 +1,65 @@
+#ifndef CALCLEAN_SUMMARY
+#define CALCLEAN_SUMMARY
+
+/**
+ * @file
+ * @brief  Header for event-level energy sums
+ */
+
+#include "calofilter.h"
+
+namespace calo {
+
+struct event_summary
+{
+  /// How sums are accumulated
+  enum summation {
+    /// Plain floating-point sums
+    fast,
+    /// Sums of energies rounded to @f$2^{-20}@f$ GeV, which don't depend on
+    /// the order of the additions
+    deterministic
+  };
+
+  /// Number of towers summed
+  int towers;
+
+  /// Electromagnetic energy
+  double emenergy;
+  /// Hadronic energy
+  double hadenergy;
+  /// Total energy
+  double totalenergy;
+  /// Transverse energy, @f$E/\cosh\eta@f$
+  double et;
+
+  /// Electromagnetic energy of towers with EB hits
+  double eb;
+  /// Electromagnetic energy of towers with EE hits, but no EB hits
+  double ee;
+  /// Hadronic energy of towers with HB hits
+  double hb;
+  /// Hadronic energy of towers with HE hits, but no HB hits
+  double he;
+  /// Total energy of towers with HF hits
+  double hf;
+
+  /// Total energy of towers with HF hits and @f$\eta \geq 0@f$
+  double hf_plus;
+  /// Total energy of towers with HF hits and @f$\eta < 0@f$
+  double hf_minus;
+
+  explicit event_summary();
+  explicit event_summary(const towerset &set,
+                         const filter *f = nullptr,
+                         summation mode = fast);
+  explicit event_summary(const towerset &set,
+                         const tower_mask &mask,
+                         summation mode = fast);
+
+  event_summary &operator+= (const event_summary &other);
+};
+
+} // namespace calo
+
+#endif // CALCLEAN_SUMMARY
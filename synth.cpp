@@ -0,0 +1,227 @@
+#include "synth.h"
+
+/**
+ * @file
+ * @brief  Source for the synthetic event generator
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include <TTree.h>
+
+#include "eb.h"
+
+namespace calo {
+
+/**
+ * @class synthetic_generator calclean/synth.h
+ * @brief Generates random events that look like @c CaloTree data.
+ *
+ * Measuring the performance of the framework needs data, but real files are
+ * large and not available everywhere. This class generates events with
+ * similar properties:
+ *
+ *   - The number of towers follows a log-normal distribution with the mean and
+ *     relative width given in the @ref synthetic_config, truncated at
+ *     @ref towerset::big;
+ *   - Towers are spread uniformly over the @f$(i_\eta, i_\phi)@f$ grid for
+ *     @f$|\eta| < 5.2@f$. The subdetectors are chosen from @f$\eta@f$: EB and
+ *     HB in the barrel, EE and HE in the endcaps, HF in the forward region;
+ *   - Every crystal or cell contributes exponentially distributed noise, and a
+ *     fraction of the towers receive an additional deposit with a power-law
+ *     spectrum;
+ *   - Hot cells (by default, those of @ref coldeb) appear with a fixed
+ *     probability and a large energy.
+ *
+ * Events can be generated in memory and loaded into a @ref towerset with
+ * @ref towerset::assign, or written to a @c TTree with the same branches as
+ * @c CaloTree:
+ *
+ * ~~~~{.cpp}
+ * synthetic_config config;
+ * config.mean_size = 400;
+ * synthetic_generator gen(config);
+ *
+ * std::vector<tower> event;
+ * gen.generate(event);
+ * towerset set(event);
+ * ~~~~
+ *
+ * The generator is deterministic: the same configuration always produces the
+ * same events.
+ */
+
+/// Constructs a generator with the given configuration
+synthetic_generator::synthetic_generator(const synthetic_config &config) :
+  _config(config),
+  _state(config.seed == 0 ? 1 : config.seed),
+  _hotcells_eta(coldeb.hotcells_eta()),
+  _hotcells_phi(coldeb.hotcells_phi())
+{}
+
+/// Sets the list of hot cells to inject
+/**
+ * Cells are given by their logical coordinates, as for @ref coldeb_filter.
+ */
+void synthetic_generator::set_hotcells(const std::vector<int> &hotcells_eta,
+                                       const std::vector<int> &hotcells_phi)
+{
+  assert(hotcells_eta.size() == hotcells_phi.size());
+  _hotcells_eta = hotcells_eta;
+  _hotcells_phi = hotcells_phi;
+}
+
+// Returns a number uniformly distributed in ]0, 1[.
+double synthetic_generator::uniform()
+{
+  return (next() + 0.5) / 4294967296.0;
+}
+
+// Returns an exponentially distributed number.
+double synthetic_generator::exponential(double mean)
+{
+  return -mean * std::log(uniform());
+}
+
+// Returns a number with a standard normal distribution (Box-Muller).
+double synthetic_generator::gaussian()
+{
+  return std::sqrt(-2 * std::log(uniform()))
+       * std::cos(2 * 3.141592653589793238462643383279502884 * uniform());
+}
+
+// Adds a tower at the given logical coordinates.
+void synthetic_generator::add_tower(std::vector<tower> &event,
+                                    int ieta,
+                                    int iphi)
+{
+  // Stay away from the edges of the cell
+  const float eta = (ieta + 0.1 + 0.8 * uniform()) * 0.085;
+  const float phi = (iphi + 0.1 + 0.8 * uniform())
+                  * 3.141592653589793238462643383279502884 / 36;
+  const double abseta = std::abs(eta);
+
+  int eb = 0, ee = 0, hb = 0, he = 0, hf = 0;
+  if (abseta < 3) {
+    // ECAL crystals, favoring small numbers as for real towers
+    const int crystals = std::min(25, 1 + int(exponential(3)));
+    const bool ecal = uniform() < 0.8;
+    (abseta < 1.479 ? eb : ee) = ecal ? crystals : 0;
+    (abseta < 1.392 ? hb : he) = (!ecal || uniform() < 0.3) ? 1 : 0;
+  } else {
+    hf = 1 + int(2 * uniform());
+  }
+
+  float em = 0, had = 0;
+  for (int i = 0; i < eb + ee; ++i) {
+    em += exponential(_config.noise);
+  }
+  for (int i = 0; i < hb + he + hf; ++i) {
+    had += exponential(2 * _config.noise);
+  }
+  if (uniform() < _config.signal_fraction) {
+    // Power law with index 3 above 0.5 GeV
+    const double deposit = 0.5 / std::sqrt(uniform());
+    if (hf > 0) {
+      em += 0.5 * deposit;
+      had += 0.5 * deposit;
+    } else if (eb + ee > 0) {
+      em += deposit;
+    } else {
+      had += deposit;
+    }
+  }
+
+  event.push_back(tower(eta, phi, eb, ee, hb, he, hf, em, had, em + had));
+}
+
+/// Generates a new event
+/**
+ * The contents of @c event are replaced.
+ */
+void synthetic_generator::generate(std::vector<tower> &event)
+{
+  event.clear();
+
+  // Log-normal distribution with the requested mean and width
+  const double sigma2 = std::log(1 + _config.size_spread
+                                   * _config.size_spread);
+  const double mu = std::log(_config.mean_size) - sigma2 / 2;
+  const double size = std::exp(mu + std::sqrt(sigma2) * gaussian());
+  const unsigned count = std::min<double>(size, towerset::big);
+
+  // Hot cells first, so they're never dropped
+  for (unsigned i = 0; i < _hotcells_eta.size(); ++i) {
+    if (event.size() < count && uniform() < _config.hot_probability) {
+      add_tower(event, _hotcells_eta[i], _hotcells_phi[i]);
+      const tower t = event.back();
+      event.pop_back();
+
+      // Always in EB, with a large energy
+      const float em = exponential(_config.hot_energy);
+      event.push_back(tower(t.eta(), t.phi(), std::max(1, t.ebcount()), 0,
+                            t.hbcount(), t.hecount(), 0,
+                            em, t.hadenergy(), em + t.hadenergy()));
+    }
+  }
+
+  while (event.size() < count) {
+    add_tower(event, int(123 * uniform()) - 61, int(72 * uniform()) - 36);
+  }
+}
+
+/// Writes synthetic events to a new @c TTree
+/**
+ * The tree is named @c CaloTree and has the branches expected by
+ * @ref towerset::towerset(TTree *). It is created in the current directory
+ * (@c gDirectory), which owns it: if that's a file, use @c TFile::Write to save
+ * it; else, the tree is kept in memory.
+ */
+TTree *synthetic_generator::write_tree(unsigned long events)
+{
+  int size;
+  std::vector<float> eta(towerset::big), phi(towerset::big);
+  std::vector<int> eb(towerset::big), ee(towerset::big), hb(towerset::big),
+                   he(towerset::big), hf(towerset::big);
+  std::vector<float> em(towerset::big), had(towerset::big),
+                     total(towerset::big);
+
+  TTree *tree = new TTree("CaloTree", "Synthetic calorimeter towers");
+  tree->Branch("CaloSize", &size, "CaloSize/I");
+  tree->Branch("CaloEta", &eta[0], "CaloEta[CaloSize]/F");
+  tree->Branch("CaloPhi", &phi[0], "CaloPhi[CaloSize]/F");
+  tree->Branch("CaloEBHits", &eb[0], "CaloEBHits[CaloSize]/I");
+  tree->Branch("CaloEEHits", &ee[0], "CaloEEHits[CaloSize]/I");
+  tree->Branch("CaloHBHits", &hb[0], "CaloHBHits[CaloSize]/I");
+  tree->Branch("CaloHEHits", &he[0], "CaloHEHits[CaloSize]/I");
+  tree->Branch("CaloHFHits", &hf[0], "CaloHFHits[CaloSize]/I");
+  tree->Branch("CaloEmEnergy", &em[0], "CaloEmEnergy[CaloSize]/F");
+  tree->Branch("CaloHadEnergy", &had[0], "CaloHadEnergy[CaloSize]/F");
+  tree->Branch("CaloEnergy", &total[0], "CaloEnergy[CaloSize]/F");
+
+  std::vector<tower> event;
+  for (unsigned long entry = 0; entry < events; ++entry) {
+    generate(event);
+    size = event.size();
+    for (int i = 0; i < size; ++i) {
+      eta[i] = event[i].eta();
+      phi[i] = event[i].phi();
+      eb[i] = event[i].ebcount();
+      ee[i] = event[i].eecount();
+      hb[i] = event[i].hbcount();
+      he[i] = event[i].hecount();
+      hf[i] = event[i].hfcount();
+      em[i] = event[i].emenergy();
+      had[i] = event[i].hadenergy();
+      total[i] = event[i].totalenergy();
+    }
+    tree->Fill();
+  }
+
+  // The buffers are about to be destroyed
+  tree->ResetBranchAddresses();
+  return tree;
+}
+
+} // namespace calo
@@ -0,0 +1,90 @@
+#ifndef CALCLEAN_SYNTH
+#define CALCLEAN_SYNTH
+
+/**
+ * @file
+ * @brief  Header for the synthetic event generator
+ */
+
+#include "calofilter.h"
+
+namespace calo {
+
+/// Parameters of the @ref synthetic_generator
+struct synthetic_config
+{
+  /// Seed of the random number generator (must not be zero)
+  unsigned int seed;
+
+  /// Mean number of towers per event
+  double mean_size;
+
+  /// Width of the distribution of the number of towers, relative to the mean
+  double size_spread;
+
+  /// Mean noise energy per crystal or cell, in GeV
+  double noise;
+
+  /// Fraction of towers with a physics deposit above the noise
+  double signal_fraction;
+
+  /// Probability for each hot cell to appear in an event
+  double hot_probability;
+
+  /// Mean energy of hot cells, in GeV
+  double hot_energy;
+
+  /// Constructs the default configuration
+  synthetic_config() :
+    seed(2013),
+    mean_size(200),
+    size_spread(0.6),
+    noise(0.15),
+    signal_fraction(0.1),
+    hot_probability(0.05),
+    hot_energy(2)
+  {}
+};
+
+class synthetic_generator
+{
+  synthetic_config _config;
+  unsigned int _state;
+  std::vector<int> _hotcells_eta;
+  std::vector<int> _hotcells_phi;
+
+  inline unsigned int next();
+  double uniform();
+  double exponential(double mean);
+  double gaussian();
+
+  void add_tower(std::vector<tower> &event, int ieta, int iphi);
+
+public:
+  explicit synthetic_generator(const synthetic_config &config =
+                                 synthetic_config());
+
+  void set_hotcells(const std::vector<int> &hotcells_eta,
+                    const std::vector<int> &hotcells_phi);
+
+  /// Returns the configuration of the generator
+  const synthetic_config &config() const { return _config; }
+
+  void generate(std::vector<tower> &event);
+
+  TTree *write_tree(unsigned long events);
+};
+
+/// Returns a new pseudo-random number
+unsigned int synthetic_generator::next()
+{
+  // xorshift32
+  _state ^= _state << 13;
+  _state ^= _state >> 17;
+  _state ^= _state << 5;
+  return _state;
+}
+
+} // namespace calo
+
+#endif // CALCLEAN_SYNTH
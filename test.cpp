@@ -10,26 +10,334 @@
 #include <TFile.h>
 
 #include "calofilter.h"
+#include "dag.h"
 #include "logic.h"
 #include "eb.h"
 
 // ROOT's pseudo-C++ parser
 #ifdef __CINT__
+# include "schema.cpp"
+# include "trace.cpp"
 # include "calofilter.cpp"
 # include "eb.cpp"
+# include "dag.cpp"
+#endif
+
+// Self-checks that don't need a data file. They are only built by the
+// compiler, not by ROOT's pseudo-C++ parser.
+#ifndef __CINT__
+# include <cassert>
+# include <climits>
+# include <cmath>
+# include <cstdio>
+# include <sstream>
+
+# include "adaptive.h"
+# include "cluster.h"
+# include "codec.h"
+# include "conditions.h"
+# include "eventfilter.h"
+# include "eventlist.h"
+# include "gap.h"
+# include "latency.h"
+# include "store.h"
+# include "trace.h"
+
+// Checks that an event list survives being written and read back.
+void check_event_list()
+{
+  calo::event_list list;
+  list.add(3);
+  list.add(4);
+  list.add(5);
+  list.add(10);
+  list.add(4000000000ul);
+
+  std::stringstream stream;
+  list.write(stream);
+  const calo::event_list copy = calo::event_list::read(stream);
+  assert(copy.size() == 5);
+  assert(copy.runs() == 3);
+  assert(copy.contains(4) && copy.contains(10) && !copy.contains(6));
+  assert(copy.next(6) == 10);
+
+  calo::event_list::iterator it = list.begin();
+  for (calo::event_list::iterator c = copy.begin(); c != copy.end(); ++c) {
+    assert(*c == *it);
+    ++it;
+  }
+  assert(it == list.end());
+}
+
+// Returns a tower with only electromagnetic energy.
+calo::tower em_tower(float eta, float phi, float energy)
+{
+  return calo::tower(eta, phi, 1, 0, 0, 0, 0, energy, 0, energy);
+}
+
+// Returns true if two floating-point values are almost equal.
+bool close(float a, float b)
+{
+  return std::fabs(a - b) < 1e-4;
+}
+
+// Checks that compact towers keep positions, counts and energies.
+void check_codec()
+{
+  const calo::tower t(-1.3, 2.9, 0, 25, 1, 0, 0, 12.345, -0.75, 11.595);
+  const calo::tower d = calo::compact_tower(t).decode();
+  assert(d.ieta() == t.ieta() && d.iphi() == t.iphi());
+  assert(d.eecount() == 25 && d.hbcount() == 1 && d.hfcount() == 0);
+  assert(std::fabs(d.emenergy() - 12.345) <= 12.345 / 2048);
+  assert(std::fabs(d.hadenergy() + 0.75) <= 0.75 / 2048);
+
+  const unsigned short id = calo::encode_id(-64, 63, calo::forward_region);
+  assert(calo::id_ieta(id) == -64 && calo::id_iphi(id) == 63);
+  assert(calo::id_region(id) == calo::forward_region);
+
+  assert(calo::decode_energy(calo::encode_energy(0)) == 0);
+  assert(calo::decode_energy(calo::encode_energy(1e6)) == 65504);
+}
+
+// Checks that conditions survive being saved and loaded back.
+void check_conditions()
+{
+  calo::eb_conditions early;
+  calo::eb_conditions late;
+  late.hotcells_eta.push_back(-3);
+  late.hotcells_phi.push_back(17);
+  late.thresholds.assign(1, 0.125);
+
+  calo::conditions_store store;
+  store.add(calo::iov(210000, 1, 210100, 50), early);
+  store.add(calo::iov(210100, 51, 211000, UINT_MAX), late);
+
+  const std::string path = "test_conditions.txt";
+  store.save(path);
+  const calo::conditions_store loaded(path);
+  std::remove(path.c_str());
+
+  assert(loaded.size() == 2);
+  assert(loaded.find(210100, 50) == 0 && loaded.find(210100, 51) == 1);
+  assert(loaded.find(209999) == -1 && loaded.find(211001) == -1);
+  assert(loaded.range(0).first_lumi == 1);
+  assert(loaded.range(1).last_lumi == UINT_MAX);
+  assert(loaded.payload(0).hotcells_eta == early.hotcells_eta);
+  assert(loaded.payload(0).thresholds == early.thresholds);
+  assert(loaded.payload(1).hotcells_eta == late.hotcells_eta);
+  assert(loaded.payload(1).hotcells_phi == late.hotcells_phi);
+  assert(loaded.payload(1).thresholds == late.thresholds);
+}
+
+// Checks the rapidity gap of an event with towers in two eta bins.
+void check_gap()
+{
+  std::vector<calo::tower> towers;
+  towers.push_back(em_tower(0.04, 0.1, 1));   // Bin 0
+  towers.push_back(em_tower(0.05, 1.1, 1));   // Bin 0 again
+  towers.push_back(em_tower(1.06, 0.1, 1));   // Bin 12
+  towers.push_back(em_tower(9.00, 0.1, 1));   // Outside of the acceptance
+  const calo::towerset set(towers);
+
+  const calo::gap_finder finder;
+  const calo::rapidity_gap gap = finder.find(set);
+  assert(gap.occupied == 2);
+  assert(close(gap.backward, finder.acceptance()));
+  assert(close(gap.forward, finder.acceptance() - 13 * 0.085));
+  assert(close(gap.size, gap.backward));
+  assert(close(gap.low, -finder.acceptance()) && close(gap.high, 0));
+
+  const calo::rapidity_gap none = finder.find(set, &calo::hoteb);
+  assert(none.occupied == 0 && close(none.size, 2 * finder.acceptance()));
+}
+
+// Checks the clusters found in an event with three groups of towers.
+void check_cluster()
+{
+  std::vector<calo::tower> towers;
+  towers.push_back(em_tower(0.04, 0.04, 5));    // Seed
+  towers.push_back(em_tower(0.12, 0.04, 0.5));  // Next to it in eta
+  towers.push_back(em_tower(0.04, -0.04, 0.3)); // Next to it in phi
+  towers.push_back(em_tower(1.06, 0.04, 2));    // Seed on its own
+  towers.push_back(em_tower(1.06, 0.10, 0.1));  // Below the tower threshold
+  towers.push_back(em_tower(2.00, 3.10, 1.5));  // Seed at the phi boundary
+  towers.push_back(em_tower(2.00, -3.1, 0.4));  // Next to it across it
+  const calo::towerset set(towers);
+
+  calo::cluster_finder finder;
+  const std::vector<calo::tower_cluster> &clusters = finder.find(set);
+  assert(clusters.size() == 3);
+  assert(clusters[0].seed == 0 && clusters[0].size == 3);
+  assert(close(clusters[0].energy, 5.8));
+  assert(clusters[1].seed == 3 && clusters[1].size == 1);
+  assert(close(clusters[1].energy, 2));
+  assert(clusters[2].seed == 5 && clusters[2].size == 2);
+  assert(close(clusters[2].energy, 1.9));
+  assert(finder.members()[clusters[0].first] == 0);
+}
+
+// Checks that adaptive filters sample again after every period.
+void check_adaptive()
+{
+  const calo::tower t = em_tower(0.04, 0.04, 1);
+  const calo::towerset set(std::vector<calo::tower>(1, t));
+  const calo::tower_ref ref(&set, 0);
+
+  calo::adaptive_and_filter f(&calo::eb, &calo::coldeb);
+  f.set_sampling(10, 10);
+  for (int i = 0; i < 100; ++i) {
+    f(ref);
+  }
+  assert(f.adaptations() == 10);
+
+  f.set_sampling(10, 25);
+  for (int i = 0; i < 100; ++i) {
+    f(ref);
+  }
+  assert(f.adaptations() == 14);
+}
+
+// Checks that events loaded from a store go through the event filter.
+void check_store()
+{
+  const std::vector<calo::tower> three(3, em_tower(0.04, 0.04, 1));
+  const std::vector<calo::tower> one(1, three.front());
+  calo::event_store store;
+  store.append(calo::towerset(three));
+  store.append(calo::towerset(one));
+
+  calo::towerset set(one);
+  const calo::count_event_filter two_eb(&calo::eb, 2);
+  set.set_event_filter(&two_eb);
+  store.get(0, set);
+  assert(set.size() == 3 && set.accepted());
+  store.get(1, set);
+  assert(set.size() == 1 && !set.accepted());
+
+  // Reports leave the format of the stream as it was
+  std::ostringstream out;
+  store.memory_report(out);
+  out.str("");
+  out << 1234.5;
+  assert(out.str() == "1234.5");
+}
+
+// Checks that latency bins cover all durations with a bounded error.
+void check_latency()
+{
+  typedef calo::latency_histogram histogram;
+  assert(histogram::bin(0) == 0 && histogram::bin(63) == 63);
+  for (unsigned long ns = 1; ns < ULONG_MAX / 3; ns = 3 * ns + 1) {
+    const int bin = histogram::bin(ns);
+    assert(bin >= 0 && bin < histogram::bins);
+    assert(histogram::lower(bin) <= ns && ns <= histogram::upper(bin));
+    assert(histogram::upper(bin) - histogram::lower(bin)
+           <= histogram::lower(bin) / histogram::sub_bins);
+    assert(histogram::bin(histogram::upper(bin) + 1) == bin + 1);
+  }
+  assert(histogram::bin(ULONG_MAX) < histogram::bins);
+
+  histogram h;
+  for (int i = 1; i <= 1000; ++i) {
+    h.record(1e-6 * i); // 1 to 1000 us
+  }
+  assert(h.count() == 1000);
+  assert(std::fabs(h.percentile(0.5) - 500e-6) <= 500e-6 / 32);
+  assert(std::fabs(h.percentile(0.99) - 990e-6) <= 990e-6 / 32);
+  assert(h.percentile(1) == h.max());
+
+  // Reports leave the format of the stream as it was
+  calo::event_latency latency;
+  latency.record(calo::event_latency::read, 1e-6);
+  latency.end_event(0, 1);
+  std::ostringstream out;
+  out.precision(3);
+  latency.report(out);
+  out.str("");
+  out << 1234.5;
+  assert(out.str() == "1.23e+03");
+}
+
+// Returns the number of times a string appears in another.
+int occurrences(const std::string &text, const std::string &s)
+{
+  int count = 0;
+  for (std::size_t pos = text.find(s); pos != std::string::npos;
+       pos = text.find(s, pos + 1)) {
+    ++count;
+  }
+  return count;
+}
+
+// Checks that traces are valid JSON in the Chrome trace format.
+void check_trace()
+{
+  calo::trace::start(4);
+  calo::trace::set_process_name("test \"trace\"");
+  for (unsigned long i = 0; i < 6; ++i) {
+    const calo::trace::scope section("check", "test", "i", i);
+  }
+  calo::trace::stop();
+  calo::trace::complete("ignored", "test", 0, 1);
+
+  std::ostringstream out;
+  calo::trace::write(out);
+  const std::string json = out.str();
+  assert(json.compare(0, 16, "{\"traceEvents\":[") == 0);
+  assert(json.find("],\"displayTimeUnit\":\"ns\"}") != std::string::npos);
+  assert(occurrences(json, "{") == occurrences(json, "}"));
+  assert(occurrences(json, "\"name\":\"process_name\"") == 1);
+  assert(json.find("\"name\":\"test \\\"trace\\\"\"") != std::string::npos);
+  assert(occurrences(json, "\"ph\":\"X\",\"name\":\"check\"") == 4);
+  assert(json.find("\"args\":{\"i\":5}") != std::string::npos);
+  assert(json.find("\"args\":{\"i\":1}") == std::string::npos);
+  assert(json.find("ignored") == std::string::npos);
+
+  // Merge with a trace saved by "another process"
+  const std::string path = "test_trace.json";
+  calo::trace::write(path);
+  std::ostringstream merged;
+  calo::trace::write(merged, std::vector<std::string>(1, path));
+  std::remove(path.c_str());
+  assert(occurrences(merged.str(), "\"name\":\"check\"") == 8);
+  assert(occurrences(merged.str(), "{") == occurrences(merged.str(), "}"));
+  calo::trace::clear();
+}
+
+// Runs all self-checks.
+void check()
+{
+  check_adaptive();
+  check_codec();
+  check_conditions();
+  check_event_list();
+  check_store();
+  check_gap();
+  check_cluster();
+  check_latency();
+  check_trace();
+  std::cout << "Self-checks passed." << std::endl;
+}
 #endif
 
 int main()
 {
   std::cout << "Running..." << std::endl;
 
+#ifndef __CINT__
+  check();
+#endif
+
   TFile *in = new TFile("../../../data/pPb_MinBias_2013_v5.root", "READ");
   in->cd();
 
-  // There is a memory leak here, but it's ok as long as it stays outside of the
-  // main loop.
-  calo::and_filter f = calo::and_filter(&calo::goodeb,
-                                        new calo::not_filter(&calo::coldeb));
+  // Share the hot tower scan between goodeb and the outer not_filter, so that
+  // it runs only once per tower.
+  calo::filter_dag dag;
+  const calo::filter *cold = dag.share(&calo::coldeb, "coldeb");
+  calo::goodeb_filter good(cold);
+  const calo::filter &f = *dag.make_and(dag.share(&good, "goodeb"),
+                                        dag.make_not(cold));
 
   calo::towerset set;
   for (long entry = 0; entry < 100; ++entry) {
@@ -48,6 +356,8 @@ int main()
 #endif
   }
 
+  dag.print(std::cout);
+
   std::cout << "Finished!" << std::endl;
   return 0;
 }
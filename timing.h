@@ -0,0 +1,51 @@
+#ifndef CALCLEAN_TIMING
+#define CALCLEAN_TIMING
+
+/**
+ * @file
+ * @brief  Header for time measurements
+ */
+
+#include <sys/time.h>
+#include <time.h>
+
+namespace calo {
+
+/// Returns the time elapsed since an arbitrary point, in seconds
+/**
+ * The clock is monotonic when the system supports it. Only differences between
+ * two calls are meaningful.
+ */
+inline double seconds()
+{
+#ifdef CLOCK_MONOTONIC
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+#else
+  timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#endif
+}
+
+/// Returns a fine-grained time stamp in arbitrary units
+/**
+ * This reads the CPU time stamp counter where available, which is much cheaper
+ * than seconds() but doesn't have a well-defined unit. Use it to compare the
+ * cost of several operations measured on the same machine.
+ */
+inline double ticks()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  unsigned int lo, hi;
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return 4294967296.0 * hi + lo;
+#else
+  return 1e9 * seconds();
+#endif
+}
+
+} // namespace calo
+
+#endif // CALCLEAN_TIMING
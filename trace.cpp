@@ -0,0 +1,294 @@
+#include "trace.h"
+#include "calofilter.h"
+
+/**
+ * @file
+ * @brief  Source for timeline traces of the framework
+ */
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#if __cplusplus >= 201103L
+# define CALO_THREAD_LOCAL thread_local
+#else
+# define CALO_THREAD_LOCAL __thread
+#endif
+
+/**
+ * @namespace calo::trace
+ *
+ * A trace shows what every process and thread was doing over time: how long
+ * each entry took to load, when baskets were read from the file, when filters
+ * were evaluated and when the user code ran. It is recorded in the Chrome
+ * trace format and can be opened in Perfetto (https://ui.perfetto.dev) or in
+ * @c chrome://tracing.
+ *
+ * The following events are recorded by the framework:
+ *
+ * - @c open (category @c io): opening the file in an @ref event_loop;
+ * - @c towerset::getentry (@c towerset): loading an entry, with the entry
+ *   number;
+ * - <tt>read baskets</tt> (@c io): the part of loading an entry, or a column
+ *   in lazy mode, that read data from the file, with the number of bytes;
+ * - @c event_filter (@c filter): evaluating the @ref event_filter of a
+ *   @ref towerset or an @ref event_loop;
+ * - @c event_context::mask (@c filter): evaluating a tower filter on all
+ *   towers for event filters, with the number of towers;
+ * - @c filter_bank::evaluate (@c filter): evaluating a @ref filter_bank, with
+ *   the number of towers;
+ * - @c process (@c task): running the task of an @ref event_loop, with the
+ *   entry number;
+ * - @c wait and @c merge (@c loop): waiting for the workers of an
+ *   @ref event_loop and adding up their results.
+ *
+ * Other sections can be added with @ref scope. When tracing is off, which is
+ * the default, the cost of every section is one test of @ref enabled.
+ *
+ * Every thread records events into its own ring buffer, so recording needs
+ * neither locks nor atomic operations. The buffer is allocated when the
+ * thread records its first event; when it is full, the oldest events are
+ * overwritten. write() saves the events of all threads of the process, and can
+ * merge traces saved by other processes.
+ */
+
+namespace calo {
+namespace trace {
+
+bool enabled = false;
+
+namespace {
+  // An event with a duration
+  struct event
+  {
+    const char *name;
+    const char *category;
+    const char *arg_name;
+    unsigned long arg;
+    double start;
+    double stop;
+  };
+
+  // The ring buffer of a thread
+  struct buffer
+  {
+    std::vector<event> events;
+    unsigned long recorded; // Including overwritten events
+    int tid;
+    buffer *next;
+  };
+
+  // Number of events kept per thread
+  std::size_t capacity = 65536;
+
+  // All buffers ever created, as a linked list
+  buffer *buffers = nullptr;
+
+  // Number of buffers ever created, used as thread ids
+  int threads = 0;
+
+  // The buffer of the current thread
+  CALO_THREAD_LOCAL buffer *local = nullptr;
+
+  // Name shown for the process
+  std::string process_name;
+
+  // Creates the buffer of the current thread and registers it.
+  buffer *make_buffer()
+  {
+    buffer *b = new buffer();
+    b->events.resize(capacity);
+    b->recorded = 0;
+    b->next = buffers;
+#ifdef __GNUC__
+    b->tid = __sync_add_and_fetch(&threads, 1);
+    while (!__sync_bool_compare_and_swap(&buffers, b->next, b)) {
+      b->next = buffers;
+    }
+#else
+    b->tid = ++threads;
+    buffers = b;
+#endif
+    return b;
+  }
+
+  // Writes a string as a JSON string.
+  void quote(std::ostream &out, const std::string &s)
+  {
+    out << '"';
+    for (unsigned i = 0; i < s.size(); ++i) {
+      if (s[i] == '"' || s[i] == '\\') {
+        out << '\\';
+      }
+      out << s[i];
+    }
+    out << '"';
+  }
+
+  // Prefix of the lines holding events in written traces
+  const std::string event_prefix = "{\"ph\":";
+}
+
+/// Starts recording events
+/**
+ * @c capacity is the number of events kept per thread. Events recorded
+ * before are discarded.
+ *
+ * This function must not be called while other threads record events.
+ */
+void start(std::size_t capacity)
+{
+  if (capacity == 0) {
+    throw std::invalid_argument("trace::start: capacity must be positive");
+  }
+  trace::capacity = capacity;
+  for (buffer *b = buffers; b != nullptr; b = b->next) {
+    b->events.assign(capacity, event());
+    b->recorded = 0;
+  }
+  enabled = true;
+}
+
+/// Stops recording events
+/**
+ * Events recorded so far are kept and can be written with write().
+ */
+void stop()
+{
+  enabled = false;
+}
+
+/// Discards the events recorded so far
+/**
+ * This function must not be called while other threads record events.
+ */
+void clear()
+{
+  for (buffer *b = buffers; b != nullptr; b = b->next) {
+    b->recorded = 0;
+  }
+}
+
+/// Sets the name under which the current process is shown
+void set_process_name(const std::string &name)
+{
+  process_name = name;
+}
+
+/// Records an event that lasted from @c start to @c stop
+/**
+ * Times are given in seconds, as returned by @ref seconds. @c name,
+ * @c category and @c arg_name must be string literals. When @c arg_name isn't
+ * null, @c arg is shown as an argument of the event. Nothing is recorded when
+ * tracing is disabled.
+ */
+void complete(const char *name,
+              const char *category,
+              double start,
+              double stop,
+              const char *arg_name,
+              unsigned long arg)
+{
+  if (!enabled) {
+    return;
+  }
+  buffer *b = local;
+  if (b == nullptr) {
+    b = local = make_buffer();
+  }
+  event &e = b->events[b->recorded % b->events.size()];
+  e.name = name;
+  e.category = category;
+  e.arg_name = arg_name;
+  e.arg = arg;
+  e.start = start;
+  e.stop = stop;
+  ++b->recorded;
+}
+
+/// Writes the events of all threads as a Chrome trace
+/**
+ * The events stored in the files listed in @c others, which must have been
+ * written by this function, are added to the trace. This is used to merge the
+ * traces of several processes.
+ *
+ * This function must not be called while other threads record events.
+ */
+void write(std::ostream &out, const std::vector<std::string> &others)
+{
+  const int pid = getpid();
+  const std::ios::fmtflags flags = out.flags();
+  const std::streamsize precision = out.precision();
+  out << std::fixed << std::setprecision(3);
+
+  out << "{\"traceEvents\":[\n";
+  bool first = true;
+  if (!process_name.empty()) {
+    out << event_prefix << "\"M\",\"name\":\"process_name\",\"pid\":" << pid
+        << ",\"tid\":0,\"args\":{\"name\":";
+    quote(out, process_name);
+    out << "}}";
+    first = false;
+  }
+
+  for (const buffer *b = buffers; b != nullptr; b = b->next) {
+    const unsigned long size = b->events.size();
+    const unsigned long begin = b->recorded > size ? b->recorded - size : 0;
+    for (unsigned long i = begin; i < b->recorded; ++i) {
+      const event &e = b->events[i % size];
+      out << (first ? "" : ",\n")
+          << event_prefix << "\"X\",\"name\":\"" << e.name
+          << "\",\"cat\":\"" << e.category << "\",\"pid\":" << pid
+          << ",\"tid\":" << b->tid
+          << ",\"ts\":" << 1e6 * e.start
+          << ",\"dur\":" << 1e6 * (e.stop - e.start);
+      if (e.arg_name != nullptr) {
+        out << ",\"args\":{\"" << e.arg_name << "\":" << e.arg << "}";
+      }
+      out << "}";
+      first = false;
+    }
+  }
+
+  for (unsigned f = 0; f < others.size(); ++f) {
+    std::ifstream in(others[f].c_str());
+    std::string line;
+    while (std::getline(in, line)) {
+      if (line.compare(0, event_prefix.size(), event_prefix) != 0) {
+        continue;
+      }
+      if (line[line.size() - 1] == ',') {
+        line.erase(line.size() - 1);
+      }
+      out << (first ? "" : ",\n") << line;
+      first = false;
+    }
+  }
+
+  out << "\n],\"displayTimeUnit\":\"ns\"}" << std::endl;
+  out.flags(flags);
+  out.precision(precision);
+}
+
+/// Writes the events of all threads to a file
+/**
+ * @see write(std::ostream &, const std::vector<std::string> &)
+ *
+ * An exception is thrown if the file can't be written
+ * (@c std::runtime_error).
+ */
+void write(const std::string &path, const std::vector<std::string> &others)
+{
+  std::ofstream out(path.c_str());
+  write(out, others);
+  if (!out) {
+    throw std::runtime_error("trace::write: cannot write " + path);
+  }
+}
+
+} // namespace trace
+} // namespace calo
@@ -0,0 +1,105 @@
+#ifndef CALCLEAN_TRACE
+#define CALCLEAN_TRACE
+
+/**
+ * @file
+ * @brief  Header for timeline traces of the framework
+ *
+ * Tracing is switched on at run time:
+ *
+ * ~~~~{.cpp}
+ * trace::start();
+ * // ...
+ * trace::write("trace.json");
+ * ~~~~
+ *
+ * The file can be opened in Perfetto (https://ui.perfetto.dev) or in
+ * @c chrome://tracing. @ref event_loop::set_trace does the same for all
+ * workers of a loop.
+ */
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "timing.h"
+
+namespace calo {
+
+/// Timeline traces in the Chrome trace format
+/**
+ * See @ref trace.h for how to enable them.
+ */
+namespace trace {
+
+/// @c true while events are recorded, see start()
+/**
+ * Don't set it directly: buffers are prepared by start().
+ */
+extern bool enabled;
+
+void start(std::size_t capacity = 65536);
+void stop();
+void clear();
+
+void set_process_name(const std::string &name);
+
+void complete(const char *name,
+              const char *category,
+              double start,
+              double stop,
+              const char *arg_name = 0,
+              unsigned long arg = 0);
+
+void write(std::ostream &out,
+           const std::vector<std::string> &others = std::vector<std::string>());
+void write(const std::string &path,
+           const std::vector<std::string> &others = std::vector<std::string>());
+
+/// Records the time spent between construction and destruction
+/**
+ * When tracing is disabled, the cost is a test of @ref enabled.
+ */
+class scope
+{
+  const char *_name;
+  const char *_category;
+  const char *_arg_name;
+  unsigned long _arg;
+  double _start; // Negative when not recording
+
+  // Not copyable
+  scope(const scope &);
+  scope &operator= (const scope &);
+
+public:
+  /// Starts a section named @c name
+  /**
+   * @c name, @c category and @c arg_name must be string literals. When
+   * @c arg_name isn't null, @c arg is shown as an argument of the event.
+   */
+  explicit scope(const char *name,
+                 const char *category,
+                 const char *arg_name = 0,
+                 unsigned long arg = 0) :
+    _name(name),
+    _category(category),
+    _arg_name(arg_name),
+    _arg(arg),
+    _start(enabled ? seconds() : -1)
+  {}
+
+  /// Ends the section
+  ~scope()
+  {
+    if (_start >= 0) {
+      complete(_name, _category, _start, seconds(), _arg_name, _arg);
+    }
+  }
+};
+
+} // namespace trace
+} // namespace calo
+
+#endif // CALCLEAN_TRACE